@@ -5,8 +5,34 @@
 
 #include "buffer.h"
 
+#include <pthread.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+
+#define ARENA_ALIGN alignof(max_align_t)
+#define POOL_MIN_SHIFT 6                                  /* smallest class, cache line */
+#define POOL_MAX_SHIFT 26                                 /* largest class, 64 MiB */
+#define POOL_NCLASS (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1) /* number of capacity classes */
+#define POOL_TCACHE 4                                     /* blocks cached per thread per class */
+#define POOL_PAGE 4096                                    /* largest alignment below huge pages */
+#define POOL_TAG_SHIFT 48                                 /* free-list head is tag:16 pointer:48 */
+#define POOL_PTR_MASK ((UINT64_C(1) << POOL_TAG_SHIFT) - 1)
+
+typedef struct _pool_tcache
+{
+    int registered;                         /* thread exit destructor registered */
+    size_t n[POOL_NCLASS];                  /* number of cached blocks per class */
+    void *blocks[POOL_NCLASS][POOL_TCACHE]; /* cached blocks per class */
+} _pool_tcache_t;
+
+uint64_t _pool_heads[POOL_NCLASS]; /* shared free-lists (Treiber stacks), tagged against ABA */
+_Thread_local _pool_tcache_t _pool_tcache;
+pthread_once_t _pool_once = PTHREAD_ONCE_INIT;
+pthread_key_t _pool_key;
 
 size_t _align_cap(size_t cap)
 {
@@ -14,14 +40,147 @@ size_t _align_cap(size_t cap)
     return cap - (cap % sizeof(size_t)) + sizeof(size_t);
 }
 
+void _buf_rebase(buffer_t *buf)
+{
+    /* inline bytes move with the struct, data may still point at a bitwise copied from buffer */
+    if (buf->flags & BUF_INLINE)
+    {
+        buf->data = buf->inl;
+    }
+}
+
+void *_buf_realloc(buffer_t *buf, void *ptr, size_t cap)
+{
+    /* realloc(3) semantics using allocator of buffer, ptr left allocated if failed */
+    if (buf->alloc)
+    {
+        return buf->alloc->realloc(buf->alloc->ctx, ptr, ptr ? buf->capacity : 0, cap);
+    }
+    return realloc(ptr, cap);
+}
+
+size_t _huge_cap(size_t cap)
+{
+    return (cap + BUF_HUGEPAGE_SZ - 1) / BUF_HUGEPAGE_SZ * BUF_HUGEPAGE_SZ;
+}
+
+int _buf_special(const buffer_t *buf, size_t cap)
+{
+    /* alignment or huge pages beyond what realloc(3) provides (allocator hooks choose their own) */
+    const int huge = (buf->flags & (BUF_HUGEPAGE | BUF_HUGETLB)) && cap >= BUF_HUGEPAGE_SZ;
+    return !buf->alloc && (buf->align > alignof(max_align_t) || huge);
+}
+
+void *_buf_alloc_special(const buffer_t *buf, size_t cap, int *mmapped)
+{
+    const int huge = (buf->flags & (BUF_HUGEPAGE | BUF_HUGETLB)) && cap >= BUF_HUGEPAGE_SZ;
+    void *data = NULL;
+    *mmapped = 0;
+    if (huge && (buf->flags & BUF_HUGETLB))
+    {
+        data = mmap(NULL, _huge_cap(cap), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED)
+        {
+            *mmapped = 1;
+            return data;
+        }
+        /* no explicit huge pages reserved, fall back to transparent huge pages */
+        data = NULL;
+    }
+    size_t align = buf->align > sizeof(void *) ? buf->align : sizeof(void *);
+    align = huge && align < BUF_HUGEPAGE_SZ ? BUF_HUGEPAGE_SZ : align;
+    if (posix_memalign(&data, align, huge ? _huge_cap(cap) : (cap ? cap : 1)))
+    {
+        return NULL;
+    }
+    if (huge)
+    {
+        /* whole huge pages only, advice ignored if transparent huge pages are disabled */
+        madvise(data, _huge_cap(cap), MADV_HUGEPAGE);
+    }
+    return data;
+}
+
+void _buf_dealloc(buffer_t *buf)
+{
+    if (buf->flags & BUF_INLINE)
+    {
+        /* nothing allocated */
+    }
+    else if (buf->flags & BUF_MMAP)
+    {
+        munmap(buf->data, _huge_cap(buf->capacity));
+    }
+    else if (buf->alloc && buf->data)
+    {
+        buf->alloc->free(buf->alloc->ctx, buf->data, buf->capacity);
+    }
+    else
+    {
+        free(buf->data);
+    }
+}
+
 size_t buf_init(buffer_t *buf, size_t cap)
 {
-    buf->data = realloc(buf->data, cap);
+    _buf_rebase(buf);
+    const size_t keep = buf->capacity < cap ? buf->capacity : cap;
+    const int special = _buf_special(buf, cap);
+    void *data;
+    if (cap <= BUF_INLINE_CAP && !special && buf->align <= alignof(max_align_t))
+    {
+        /* small enough to store inline, no allocation */
+        if (!(buf->flags & BUF_INLINE))
+        {
+            if (buf->data)
+            {
+                memcpy(buf->inl, buf->data, keep);
+            }
+            _buf_dealloc(buf);
+            buf->flags = (buf->flags & ~BUF_MMAP) | BUF_INLINE;
+        }
+        data = buf->inl;
+    }
+    else if (!special && !(buf->flags & (BUF_INLINE | BUF_MMAP)))
+    {
+        data = _buf_realloc(buf, buf->data, cap);
+        if (!data)
+        {
+            /* buffer left empty */
+            _buf_dealloc(buf);
+        }
+    }
+    else
+    {
+        /* fresh allocation (inline, aligned, or huge pages), bytes copied */
+        int mmapped = 0;
+        data = special ? _buf_alloc_special(buf, cap, &mmapped) : _buf_realloc(buf, NULL, cap);
+        if (data && buf->data)
+        {
+            memcpy(data, buf->data, keep);
+        }
+        _buf_dealloc(buf);
+        buf->flags = (buf->flags & ~(BUF_INLINE | BUF_MMAP)) | (mmapped ? BUF_MMAP : 0);
+    }
+    buf->data = data;
     buf->capacity = buf->data ? cap : 0;
     buf->size = 0;
     return buf->capacity;
 }
 
+size_t buf_init_aligned(buffer_t *buf, size_t cap, size_t align, int flags)
+{
+    if (align & (align - 1))
+    {
+        /* alignment must be a power of 2 */
+        return 0;
+    }
+    /* storage flags kept, existing bytes moved to memory meeting new requirements */
+    buf->align = align;
+    buf->flags = (buf->flags & (BUF_INLINE | BUF_MMAP)) | (flags & (BUF_HUGEPAGE | BUF_HUGETLB));
+    return buf_init(buf, cap);
+}
+
 size_t buf_copy(buffer_t *buf, const void *src, size_t sz)
 {
     if (buf_init(buf, _align_cap(sz)))
@@ -34,9 +193,19 @@ size_t buf_copy(buffer_t *buf, const void *src, size_t sz)
 
 void buf_move(buffer_t *buf, buffer_t *src)
 {
+    _buf_rebase(src);
     buf->data = src->data;
     buf->capacity = src->capacity;
     buf->size = src->size;
+    buf->alloc = src->alloc;
+    buf->align = src->align;
+    buf->flags = src->flags;
+    if (src->flags & BUF_INLINE)
+    {
+        /* inline bytes copied, never pointing into source */
+        memcpy(buf->inl, src->inl, src->capacity);
+        buf->data = buf->inl;
+    }
     /* clear source */
     memset(src, 0, sizeof(*src));
 }
@@ -45,7 +214,7 @@ void buf_free(buffer_t *buf)
 {
     if (buf)
     {
-        free(buf->data);
+        _buf_dealloc(buf);
         memset(buf, 0, sizeof(*buf));
     }
 }
@@ -57,6 +226,7 @@ void buf_clear(buffer_t *buf)
 
 size_t buf_resize(buffer_t *buf, size_t sz)
 {
+    _buf_rebase(buf);
     if (sz <= buf->capacity || buf_init(buf, _align_cap(sz)))
     {
         buf->size = sz;
@@ -66,6 +236,7 @@ size_t buf_resize(buffer_t *buf, size_t sz)
 
 size_t buf_push(buffer_t *buf, const void *src, size_t sz)
 {
+    _buf_rebase(buf);
     const size_t insz = buf->size;
     if (sz > buf->capacity - insz)
     {
@@ -92,4 +263,244 @@ size_t buf_push(buffer_t *buf, const void *src, size_t sz)
         memset((char *)buf->data + insz, 0, sz);
     }
     return sz;
+}
+
+void *_arena_realloc(void *ctx, void *ptr, size_t oldcap, size_t cap)
+{
+    buf_arena_t *arena = ctx;
+    const size_t acap = (cap + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    char *block = arena->block;
+    if (ptr && ptr == block + arena->last && acap <= arena->blocksz - arena->last)
+    {
+        /* most recent allocation, grow or shrink in place */
+        arena->used = arena->last + acap;
+        return ptr;
+    }
+    if (!block || acap > arena->blocksz - arena->used)
+    {
+        /* retire full block, next one at least doubled */
+        const size_t dsz = arena->blocksz * 2;
+        const size_t blocksz = dsz < acap ? acap : dsz;
+        void *next = malloc(blocksz);
+        if (!next || (block && !buf_push(&arena->retired, &block, sizeof(block))))
+        {
+            free(next);
+            return NULL;
+        }
+        arena->spill += arena->used;
+        arena->block = next;
+        arena->blocksz = blocksz;
+        arena->used = 0;
+        block = next;
+    }
+    arena->last = arena->used;
+    arena->used += acap;
+    if (ptr)
+    {
+        memcpy(block + arena->last, ptr, oldcap < cap ? oldcap : cap);
+    }
+    return block + arena->last;
+}
+
+void _arena_free(void *ctx, void *ptr, size_t cap)
+{
+    /* only most recent allocation reclaimed, everything else at reset */
+    buf_arena_t *arena = ctx;
+    if (ptr == (char *)arena->block + arena->last)
+    {
+        arena->used = arena->last;
+    }
+}
+
+size_t buf_arena_init(buf_arena_t *arena, size_t blocksz)
+{
+    buf_arena_free(arena);
+    arena->alloc.realloc = &_arena_realloc;
+    arena->alloc.free = &_arena_free;
+    arena->alloc.ctx = arena;
+    arena->block = malloc(blocksz);
+    arena->blocksz = arena->block ? blocksz : 0;
+    return arena->blocksz;
+}
+
+void buf_arena_reset(buf_arena_t *arena)
+{
+    void **retired = arena->retired.data;
+    const size_t n = arena->retired.size / sizeof(void *);
+    size_t i;
+    for (i = 0; i < n; i++)
+    {
+        free(retired[i]);
+    }
+    buf_clear(&arena->retired);
+    if (arena->spill)
+    {
+        /* merge into single block sized for everything used since last reset (current block may be reused entirely) */
+        const size_t blocksz = arena->spill + arena->blocksz;
+        void *block = malloc(blocksz);
+        if (block)
+        {
+            free(arena->block);
+            arena->block = block;
+            arena->blocksz = blocksz;
+        }
+    }
+    arena->used = 0;
+    arena->last = 0;
+    arena->spill = 0;
+}
+
+void buf_arena_free(buf_arena_t *arena)
+{
+    if (arena)
+    {
+        buf_arena_reset(arena);
+        free(arena->block);
+        buf_free(&arena->retired);
+        memset(arena, 0, sizeof(*arena));
+    }
+}
+
+int _pool_class(size_t cap)
+{
+    int shift = POOL_MIN_SHIFT;
+    while (shift <= POOL_MAX_SHIFT && ((size_t)1 << shift) < cap)
+    {
+        shift++;
+    }
+    return shift <= POOL_MAX_SHIFT ? shift - POOL_MIN_SHIFT : -1;
+}
+
+void _pool_push(int cls, void *block)
+{
+    /* free block stores next pointer in its first bytes */
+    uint64_t head = __atomic_load_n(&_pool_heads[cls], __ATOMIC_ACQUIRE);
+    uint64_t next;
+    do
+    {
+        *(void **)block = (void *)(uintptr_t)(head & POOL_PTR_MASK);
+        next = ((head >> POOL_TAG_SHIFT) + 1) << POOL_TAG_SHIFT | (uint64_t)(uintptr_t)block;
+    } while (!__atomic_compare_exchange_n(&_pool_heads[cls], &head, next, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+void *_pool_pop(int cls)
+{
+    /* blocks are never freed while pooled, reading next of a block popped concurrently is harmless (tag fails CAS) */
+    uint64_t head = __atomic_load_n(&_pool_heads[cls], __ATOMIC_ACQUIRE);
+    while (head & POOL_PTR_MASK)
+    {
+        void **block = (void **)(uintptr_t)(head & POOL_PTR_MASK);
+        const uint64_t next = ((head >> POOL_TAG_SHIFT) + 1) << POOL_TAG_SHIFT |
+                              (uint64_t)(uintptr_t)__atomic_load_n(block, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&_pool_heads[cls], &head, next, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+void _pool_thread_exit(void *arg)
+{
+    /* cached blocks of exiting thread go to shared free-lists */
+    _pool_tcache_t *tc = arg;
+    int cls;
+    for (cls = 0; cls < POOL_NCLASS; cls++)
+    {
+        while (tc->n[cls])
+        {
+            _pool_push(cls, tc->blocks[cls][--tc->n[cls]]);
+        }
+    }
+}
+
+void _pool_make_key(void)
+{
+    pthread_key_create(&_pool_key, &_pool_thread_exit);
+}
+
+void *_pool_block_alloc(size_t cap)
+{
+    /* cache line, page, or huge page aligned by size */
+    const size_t align = cap >= BUF_HUGEPAGE_SZ ? BUF_HUGEPAGE_SZ : (cap < POOL_PAGE ? cap : POOL_PAGE);
+    void *block = NULL;
+    if (posix_memalign(&block, align < sizeof(void *) ? sizeof(void *) : align, cap ? cap : 1))
+    {
+        return NULL;
+    }
+    if (cap >= BUF_HUGEPAGE_SZ)
+    {
+        madvise(block, cap, MADV_HUGEPAGE);
+    }
+    return block;
+}
+
+void _pool_free(void *ctx, void *ptr, size_t cap)
+{
+    const int cls = _pool_class(cap);
+    _pool_tcache_t *tc = &_pool_tcache;
+    if (cls < 0 || ((uint64_t)(uintptr_t)ptr & ~POOL_PTR_MASK))
+    {
+        /* unpooled (too large, or pointer not taggable) */
+        free(ptr);
+        return;
+    }
+    if (!tc->registered)
+    {
+        pthread_once(&_pool_once, &_pool_make_key);
+        pthread_setspecific(_pool_key, tc);
+        tc->registered = 1;
+    }
+    if (tc->n[cls] < POOL_TCACHE)
+    {
+        tc->blocks[cls][tc->n[cls]++] = ptr;
+        return;
+    }
+    _pool_push(cls, ptr);
+}
+
+void *_pool_realloc(void *ctx, void *ptr, size_t oldcap, size_t cap)
+{
+    const int cls = _pool_class(cap);
+    if (ptr && cls >= 0 && cls == _pool_class(oldcap))
+    {
+        /* same class, block already large enough */
+        return ptr;
+    }
+    void *block = NULL;
+    if (cls >= 0)
+    {
+        _pool_tcache_t *tc = &_pool_tcache;
+        block = tc->n[cls] ? tc->blocks[cls][--tc->n[cls]] : _pool_pop(cls);
+    }
+    if (!block)
+    {
+        block = _pool_block_alloc(cls >= 0 ? (size_t)1 << (cls + POOL_MIN_SHIFT) : cap);
+    }
+    if (block && ptr)
+    {
+        memcpy(block, ptr, oldcap < cap ? oldcap : cap);
+        _pool_free(ctx, ptr, oldcap);
+    }
+    return block;
+}
+
+const buf_alloc_t buf_pool = {&_pool_realloc, &_pool_free, NULL};
+
+void buf_pool_trim(void)
+{
+    _pool_tcache_t *tc = &_pool_tcache;
+    int cls;
+    for (cls = 0; cls < POOL_NCLASS; cls++)
+    {
+        void *block;
+        while (tc->n[cls])
+        {
+            free(tc->blocks[cls][--tc->n[cls]]);
+        }
+        while ((block = _pool_pop(cls)))
+        {
+            free(block);
+        }
+    }
 }
\ No newline at end of file
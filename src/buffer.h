@@ -8,18 +8,119 @@
 
 #include <stdlib.h>
 
+/**
+ * @def BUF_INLINE_CAP
+ * @brief largest capacity stored inline in the buffer struct instead of allocated
+ */
+#define BUF_INLINE_CAP 64
+
+/**
+ * @def BUF_INLINE
+ * @brief buffer flag set while bytes are stored inline (@ref buffer::data points to @ref buffer::inl)
+ */
+#define BUF_INLINE 1
+
+/**
+ * @def BUF_HUGEPAGE
+ * @brief buffer flag for backing capacities of at least @ref BUF_HUGEPAGE_SZ with transparent huge pages
+ *
+ * Memory is aligned to and sized in whole huge pages, then advised with MADV_HUGEPAGE.
+ */
+#define BUF_HUGEPAGE 2
+
+/**
+ * @def BUF_HUGETLB
+ * @brief buffer flag for backing capacities of at least @ref BUF_HUGEPAGE_SZ with explicit huge pages
+ *
+ * Memory is mapped with MAP_HUGETLB (requires reserved huge pages), falling back to @ref BUF_HUGEPAGE.
+ */
+#define BUF_HUGETLB 4
+
+/**
+ * @def BUF_MMAP
+ * @brief buffer flag set while bytes are stored in a mapping from @ref BUF_HUGETLB
+ */
+#define BUF_MMAP 8
+
+/**
+ * @def BUF_HUGEPAGE_SZ
+ * @brief huge page size assumed by @ref BUF_HUGEPAGE and @ref BUF_HUGETLB
+ */
+#define BUF_HUGEPAGE_SZ (2 << 20)
+
+/**
+ * @struct buf_alloc
+ * @brief allocator hook used by buffers instead of realloc(3) and free(3)
+ * @typedef buf_alloc_t
+ */
+typedef struct buf_alloc
+{
+    /** reallocate ptr (NULL to allocate) to cap bytes preserving min(oldcap, cap) bytes, NULL if failed */
+    void *(*realloc)(void *ctx, void *ptr, size_t oldcap, size_t cap);
+    /** free ptr of cap bytes */
+    void (*free)(void *ctx, void *ptr, size_t cap);
+    /** context passed to hook functions */
+    void *ctx;
+} buf_alloc_t;
+
 /**
  * @struct buffer
  * @brief control over dynamically allocated region of memory
  * @typedef buffer_t
+ *
+ * Capacities up to @ref BUF_INLINE_CAP are stored inline without allocating.
+ * Inline bytes live in the struct, so buffers must not be copied bitwise while in use
+ * (use @ref buf_move, or place the struct first and fill its buffers in place).
  */
 typedef struct buffer
 {
-    void *data;      /** the allocated bytes */
-    size_t capacity; /** the number of allocated bytes */
-    size_t size;     /** the number of bytes considered used */
+    void *data;               /** the allocated bytes */
+    size_t capacity;          /** the number of allocated bytes */
+    size_t size;              /** the number of bytes considered used */
+    const buf_alloc_t *alloc; /** allocator of data, NULL for realloc(3) and free(3) */
+    size_t align;             /** required alignment of data (0 for default), ignored by allocator hooks */
+    int flags;                /** storage flags (e.g. @ref BUF_INLINE, @ref BUF_HUGEPAGE) */
+    _Alignas(16) char inl[BUF_INLINE_CAP]; /** inline bytes for small capacities */
 } buffer_t;
 
+/**
+ * @brief allocator hook recycling memory through a process-wide pool (thread-safe)
+ *
+ * Capacities are rounded up to power of 2 classes, growing within a class never moves bytes.
+ * Freed blocks go to a small per-thread cache, then to a lock-free free-list shared by all threads,
+ * so identical buffers are reused without malloc(3) or page faults.
+ * Blocks are cache line aligned, page aligned from a page, and huge page aligned (MADV_HUGEPAGE) from a huge page.
+ * Capacities beyond the largest class are allocated and freed directly.
+ */
+extern const buf_alloc_t buf_pool;
+
+/**
+ * @brief free the blocks held by the pool (shared free-lists and cache of calling thread)
+ *
+ * Must not be invoked while other threads use the pool.
+ */
+void buf_pool_trim(void);
+
+/**
+ * @struct buf_arena
+ * @brief region of memory buffers bump-allocate from, released all at once
+ * @typedef buf_arena_t
+ *
+ * Set @ref buffer::alloc of an empty buffer to @ref buf_arena::alloc to allocate from the arena.
+ * Growing the most recent allocation extends it in place, freeing only reclaims the most recent allocation.
+ * Generally, arenas should be zero-initialized before @ref buf_arena_init.
+ */
+typedef struct buf_arena
+{
+    buf_alloc_t alloc; /** allocator hook for buffers using the arena */
+    void *block;       /** current block allocations are bumped from */
+    size_t blocksz;    /** the number of bytes in current block */
+    size_t used;       /** the number of bytes used in current block */
+    size_t last;       /** offset of most recent allocation in current block */
+    size_t spill;      /** the number of bytes used in retired blocks since last reset */
+    buffer_t retired;  /** pointers to blocks filled since last reset */
+} buf_arena_t;
+
 /**
  * @brief initialize buffer with specified number of bytes allocated
  *
@@ -29,6 +130,20 @@ typedef struct buffer
  */
 size_t buf_init(buffer_t *buf, size_t cap);
 
+/**
+ * @brief initialize buffer with specified number of bytes allocated with alignment and page requirements
+ *
+ * Requirements are kept for all later (re)allocations of the buffer, until freed.
+ * Capacities stored inline only meet alignments up to that of max_align_t.
+ *
+ * @param[inout] buf the buffer to initialize
+ * @param cap the number of bytes to allocate
+ * @param align the alignment of the allocated bytes (power of 2, e.g. cache line, page, or device block size)
+ * @param flags @ref BUF_HUGEPAGE or @ref BUF_HUGETLB (0 for normal pages)
+ * @return the number of bytes allocated (cap if succesful, 0 if failed)
+ */
+size_t buf_init_aligned(buffer_t *buf, size_t cap, size_t align, int flags);
+
 /**
  * @brief copy data into buffer
  *
@@ -42,6 +157,7 @@ size_t buf_copy(buffer_t *buf, const void *src, size_t sz);
 /**
  * @brief move data ownership from one buffer to another
  *
+ * The allocator moves along with the data.
  * the source buffer will be cleared and set to all 0
  *
  * @param[inout] buf the buffer to own the data
@@ -52,7 +168,7 @@ void buf_move(buffer_t *buf, buffer_t *src);
 /**
  * @brief free the memory owned by the buffer
  *
- * the buffer will be cleared and set to all 0
+ * the buffer will be cleared and set to all 0 (including its allocator)
  *
  * @param[inout] buf the buffer to free memory from
  */
@@ -84,4 +200,33 @@ size_t buf_resize(buffer_t *buf, size_t sz);
  */
 size_t buf_push(buffer_t *buf, const void *src, size_t sz);
 
+/**
+ * @brief initialize arena with a first block of the specified number of bytes
+ *
+ * @param[inout] arena the arena to initialize
+ * @param blocksz the number of bytes in the first block (more blocks are allocated as needed)
+ * @return the number of bytes allocated (blocksz if successful, 0 if failed)
+ */
+size_t buf_arena_init(buf_arena_t *arena, size_t blocksz);
+
+/**
+ * @brief release all allocations of arena at once, keeping its memory
+ *
+ * Buffers allocated from the arena must not be used (or freed) after reset, only zeroed.
+ * If more than the current block was used since last reset, blocks are merged into one large enough,
+ * so resetting is O(1) once the arena is sized for the workload.
+ *
+ * @param[inout] arena the arena to reset
+ */
+void buf_arena_reset(buf_arena_t *arena);
+
+/**
+ * @brief free the memory owned by the arena
+ *
+ * the arena will be cleared and set to all 0
+ *
+ * @param[inout] arena the arena to free memory from
+ */
+void buf_arena_free(buf_arena_t *arena);
+
 #endif
\ No newline at end of file
@@ -4,10 +4,12 @@
  */
 
 #include "bufferedio.h"
+#include "bufseg.h"
 
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 int _bio_wstatus(const bio_data_t *bd)
 {
@@ -15,6 +17,12 @@ int _bio_wstatus(const bio_data_t *bd)
     return BIO_STATUS_INIT + 1;
 }
 
+int _bio_sstatus(const bio_data_t *bd)
+{
+    /* usable once segmented buffer is owned */
+    return BIO_STATUS_INIT + (bd->opaque.data ? 1 : 0);
+}
+
 void _bio_wstatus_str(const bio_data_t *bd, char *str, size_t n)
 {
     const char *fmt = "wrapped buffer %sallocated {data: %zu, size: %zu, capacity: %zu}";
@@ -31,22 +39,38 @@ size_t _bio_wread(bio_data_t *bd, void *data, size_t sz)
     const size_t osz = rsz < sz ? rsz : sz;
     memcpy(data, (const char *)bd->buf.data + bd->offset, osz);
     bd->offset += osz;
+    bd->stats.rbytes += osz;
     return osz;
 }
 
+const void *_bio_wpeek(bio_data_t *bd, size_t *sz)
+{
+    *sz = bd->buf.size - bd->offset;
+    return *sz ? (const char *)bd->buf.data + bd->offset : NULL;
+}
+
+void _bio_wconsume(bio_data_t *bd, size_t sz)
+{
+    bd->offset += sz;
+    bd->stats.rbytes += sz;
+}
+
 size_t _bio_wwrite(bio_data_t *bd, const void *data, size_t sz)
 {
-    return buf_push(&bd->buf, data, sz);
+    const size_t osz = buf_push(&bd->buf, data, sz);
+    bd->stats.wbytes += osz;
+    return osz;
 }
 
 void _bio_wflush(bio_data_t *bd)
 {
     buf_clear(&bd->buf);
+    bd->stats.nflush++;
 }
 
-ssize_t _bio_wseek(bio_data_t *bd, long offset, int whence)
+ssize_t _bio_seek_bounded(bio_data_t *bd, size_t sz, long offset, int whence)
 {
-    const size_t sz = bd->buf.size;
+    /* seek within bytes [0, sz] held in memory */
     const size_t offset_a = offset < 0 ? -offset : offset;
     ssize_t rv;
     switch (whence)
@@ -105,6 +129,17 @@ ssize_t _bio_wseek(bio_data_t *bd, long offset, int whence)
     return rv;
 }
 
+ssize_t _bio_wseek(bio_data_t *bd, long offset, int whence)
+{
+    return _bio_seek_bounded(bd, bd->buf.size, offset, whence);
+}
+
+int _bio_wsize_hint(const bio_data_t *bd, size_t *sz)
+{
+    *sz = bd->buf.size - bd->offset;
+    return BIO_HINT_EXACT;
+}
+
 void _bio_wdfree(bio_data_t *bd)
 {
     buf_free(&bd->buf);
@@ -124,12 +159,126 @@ void bio_wrap(bufferedio_t *bio, buffer_t *buf)
     bio->status = &_bio_wstatus;
     bio->status_str = &_bio_wstatus_str;
     bio->read = &_bio_wread;
+    bio->peek = &_bio_wpeek;
+    bio->consume = &_bio_wconsume;
     bio->write = &_bio_wwrite;
     bio->flush = &_bio_wflush;
     bio->seek = &_bio_wseek;
+    bio->size_hint = &_bio_wsize_hint;
     bio->dfree = &_bio_wdfree;
 }
 
+void _bio_sstatus_str(const bio_data_t *bd, char *str, size_t n)
+{
+    const char *fmt = "segmented buffer {chunks: %zu, chunksz: %zu, size: %zu}";
+    const bufseg_t *seg = bd->opaque.data;
+    if (!seg)
+    {
+        strncpy(str, "segmented buffer not configured", n);
+        return;
+    }
+    if (snprintf(str, n, fmt, seg->chunks.size / sizeof(void *), seg->chunksz, seg->size) < 0)
+    {
+        strncpy(str, "(failed to write segmented buffer status)", n);
+    }
+}
+
+size_t _bio_sread(bio_data_t *bd, void *data, size_t sz)
+{
+    const bufseg_t *seg = bd->opaque.data;
+    if (!seg || !seg->chunksz)
+    {
+        /* empty and uninitialized, nothing to read */
+        return 0;
+    }
+    size_t csz;
+    const char *chunk = bseg_chunk(seg, bd->offset / seg->chunksz, &csz);
+    if (!chunk)
+    {
+        return 0;
+    }
+    /* only read within a single chunk, relies on bio_read re-trying */
+    const size_t coff = bd->offset % seg->chunksz;
+    const size_t rsz = csz - coff;
+    const size_t osz = rsz < sz ? rsz : sz;
+    memcpy(data, chunk + coff, osz);
+    bd->offset += osz;
+    bd->stats.rbytes += osz;
+    return osz;
+}
+
+const void *_bio_speek(bio_data_t *bd, size_t *sz)
+{
+    /* remaining bytes of current chunk only */
+    const bufseg_t *seg = bd->opaque.data;
+    if (!seg || !seg->chunksz)
+    {
+        *sz = 0;
+        return NULL;
+    }
+    size_t csz;
+    const char *chunk = bseg_chunk(seg, bd->offset / seg->chunksz, &csz);
+    const size_t coff = bd->offset % seg->chunksz;
+    *sz = chunk ? csz - coff : 0;
+    return *sz ? chunk + coff : NULL;
+}
+
+size_t _bio_swrite(bio_data_t *bd, const void *data, size_t sz)
+{
+    const size_t osz = bseg_push(bd->opaque.data, data, sz);
+    bd->stats.wbytes += osz;
+    return osz;
+}
+
+void _bio_sflush(bio_data_t *bd)
+{
+    bseg_clear(bd->opaque.data);
+    bd->offset = 0;
+    bd->stats.nflush++;
+}
+
+ssize_t _bio_sseek(bio_data_t *bd, long offset, int whence)
+{
+    const bufseg_t *seg = bd->opaque.data;
+    return _bio_seek_bounded(bd, seg->size, offset, whence);
+}
+
+int _bio_ssize_hint(const bio_data_t *bd, size_t *sz)
+{
+    const bufseg_t *seg = bd->opaque.data;
+    *sz = seg->size - bd->offset;
+    return BIO_HINT_EXACT;
+}
+
+void _bio_sdfree(bio_data_t *bd)
+{
+    bseg_free(bd->opaque.data);
+    buf_free(&bd->opaque);
+    buf_free(&bd->buf);
+}
+
+void bio_wrap_seg(bufferedio_t *bio, bufseg_t *seg)
+{
+    bufseg_t empty = {0};
+    buf_init(&bio->data.buf, 0);
+    if (buf_init(&bio->data.opaque, sizeof(bufseg_t)))
+    {
+        bseg_move(bio->data.opaque.data, seg ? seg : &empty);
+        buf_resize(&bio->data.opaque, sizeof(bufseg_t));
+    }
+    bio->data.offset = 0;
+    bio->status = &_bio_sstatus;
+    bio->status_str = &_bio_sstatus_str;
+    bio->read = &_bio_sread;
+    bio->peek = &_bio_speek;
+    bio->consume = &_bio_wconsume;
+    bio->write = &_bio_swrite;
+    bio->flush = &_bio_sflush;
+    bio->seek = &_bio_sseek;
+    bio->size_hint = &_bio_ssize_hint;
+    bio->dfree = &_bio_sdfree;
+}
+
 int bio_status(const bufferedio_t *bio)
 {
     return bio->status ? bio->status(&bio->data) : BIO_STATUS_INIT;
@@ -145,9 +294,57 @@ char *bio_status_str(bufferedio_t *bio, char *str, size_t n)
     {
         strncpy(str, "(bio status_str unsupported)", n);
     }
+    const bio_stats_t *stats = &bio->data.stats;
+    const size_t len = strnlen(str, n);
+    if ((stats->rbytes || stats->wbytes || stats->nsyscall) && len + 1 < n)
+    {
+        str[len] = ' ';
+        bio_stats_str(stats, str + len + 1, n - len - 1);
+    }
     return str;
 }
 
+const bio_stats_t *bio_stats(const bufferedio_t *bio)
+{
+    return &bio->data.stats;
+}
+
+char *bio_stats_str(const bio_stats_t *stats, char *str, size_t n)
+{
+    const char *fmt = "{read: %zu, written: %zu, syscalls: %zu, short r/w: %zu/%zu, refills: %zu, flushes: %zu, blocked: %.3fms}";
+    if (snprintf(str, n, fmt, stats->rbytes, stats->wbytes, stats->nsyscall, stats->nshort_r, stats->nshort_w,
+                 stats->nrefill, stats->nflush, (double)stats->blocked_ns / 1e6) < 0)
+    {
+        strncpy(str, "(failed to write stats)", n);
+    }
+    return str;
+}
+
+uint64_t bio_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void bio_stats_sysio(bio_stats_t *stats, int write, size_t sz, ssize_t rv, uint64_t start_ns)
+{
+    /* relaxed atomics, only totals matter (positional I/O may count from several threads) */
+    __atomic_add_fetch(&stats->blocked_ns, bio_clock_ns() - start_ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->nsyscall, 1, __ATOMIC_RELAXED);
+    const size_t osz = rv < 0 ? 0 : (size_t)rv;
+    if (write)
+    {
+        __atomic_add_fetch(&stats->wbytes, osz, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->nshort_w, osz < sz ? 1 : 0, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_add_fetch(&stats->rbytes, osz, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->nshort_r, osz < sz ? 1 : 0, __ATOMIC_RELAXED);
+    }
+}
+
 size_t bio_read(bufferedio_t *bio, void *data, size_t sz)
 {
     size_t osz = 0;
@@ -160,41 +357,64 @@ size_t bio_read(bufferedio_t *bio, void *data, size_t sz)
     return osz;
 }
 
-const buffer_t *bio_read_all(bufferedio_t *bio, buffer_t *buf)
+const void *bio_peek(bufferedio_t *bio, size_t *sz)
 {
-    const size_t insz = buf->size;
-    const buffer_t *rv = buf;
-    const ssize_t inpos = bio_seek(bio, 0, SEEK_CUR);
-    if (inpos < 0)
+    *sz = 0;
+    if (!bio->peek)
     {
-        goto seekfail;
+        errno = ENOTSUP;
+        return NULL;
     }
-    const ssize_t endpos = bio_seek(bio, 0, SEEK_END);
-    if (endpos < 0)
-    {
-        goto seekfail;
-    }
-    if (bio_seek(bio, inpos, SEEK_SET) != inpos)
-    {
-        /* uniquely failed to seek back to original position, will retry once */
-        goto error;
-    }
-    size_t rsz = (size_t)(endpos - inpos);
-    if (buf_resize(buf, insz + rsz) != insz + rsz)
+    errno = 0;
+    return bio->peek(&bio->data, sz);
+}
+
+void bio_consume(bufferedio_t *bio, size_t sz)
+{
+    if (bio->consume && sz)
     {
-        goto error;
+        bio->consume(&bio->data, sz);
     }
-    /* allow for potentially reading less bytes than expected from seeking */
-    rsz = bio_read(bio, (char *)buf->data + insz, rsz);
-    if (bio_status(bio) < BIO_STATUS_INIT)
+}
+
+int bio_size_hint(const bufferedio_t *bio, size_t *sz)
+{
+    *sz = 0;
+    return bio->size_hint ? bio->size_hint(&bio->data, sz) : BIO_HINT_NONE;
+}
+
+int _bio_wait_more(bufferedio_t *bio)
+{
+    /* read returned 0 without EOF, sleep until more bytes are available */
+    return bio_status(bio) == BIO_STATUS_WOULDBLOCK && bio_wait(bio, BIO_WAIT_READ, -1) > 0;
+}
+
+const buffer_t *bio_read_all(bufferedio_t *bio, buffer_t *buf)
+{
+    const size_t insz = buf->size;
+    size_t rsz;
+    const int hint = bio_size_hint(bio, &rsz);
+    if (hint != BIO_HINT_NONE && rsz)
     {
-        goto error;
+        /* single allocation of known size */
+        if (buf_resize(buf, insz + rsz) != insz + rsz)
+        {
+            goto error;
+        }
+        /* allow for potentially reading less bytes than hinted */
+        rsz = bio_read(bio, (char *)buf->data + insz, rsz);
+        buf_resize(buf, insz + rsz); /* never allocating */
+        if (bio_status(bio) < BIO_STATUS_INIT)
+        {
+            goto error;
+        }
+        if (hint == BIO_HINT_EXACT)
+        {
+            goto end;
+        }
     }
-    buf_resize(buf, insz + rsz); /* never allocating */
-    goto end;
-seekfail:
     /* read incrementally */
-    const size_t minrsz = insz < sizeof(size_t) ? sizeof(size_t) : insz;
+    const size_t minrsz = buf->size < sizeof(size_t) ? sizeof(size_t) : buf->size;
     do
     {
         const size_t prevsz = buf->size;
@@ -206,22 +426,66 @@ seekfail:
         }
         rsz = bio_read(bio, (char *)buf->data + prevsz, rsz);
         buf_resize(buf, prevsz + rsz); /* never allocating */
-    } while (rsz);
+    } while (rsz || _bio_wait_more(bio));
     if (bio_status(bio) < BIO_STATUS_INIT)
     {
         goto error;
     }
-    goto end;
+end:
+    return buf;
 error:
-    rv = NULL;
-    /* attempt to reset position and buffer */
+    /* bytes already read cannot be un-read, only restore buffer */
     buf_resize(buf, insz);
-    if (inpos >= 0)
+    return NULL;
+}
+
+const bufseg_t *bio_read_all_seg(bufferedio_t *bio, bufseg_t *seg)
+{
+    const size_t insz = seg->size;
+    size_t rsz;
+    do
     {
-        bio_seek(bio, inpos, SEEK_SET);
+        /* read directly into free bytes of last chunk, never moving existing bytes */
+        size_t tsz;
+        void *tail = bseg_tail(seg, &tsz);
+        if (!tail)
+        {
+            goto error;
+        }
+        rsz = bio_read(bio, tail, tsz);
+        bseg_commit(seg, rsz);
+    } while (rsz || _bio_wait_more(bio));
+    if (bio_status(bio) < BIO_STATUS_INIT)
+    {
+        goto error;
     }
-end:
-    return rv;
+    return seg;
+error:
+    /* bytes already read cannot be un-read, only restore size */
+    seg->size = insz;
+    return NULL;
+}
+
+size_t bio_hole(bufferedio_t *bio, size_t max)
+{
+    return bio->hole ? bio->hole(&bio->data, max) : 0;
+}
+
+ssize_t bio_pread(bufferedio_t *bio, void *data, size_t sz, off_t offset)
+{
+    size_t osz = 0;
+    ssize_t rsz = 0;
+    if (!bio->pread)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    do
+    {
+        rsz = bio->pread(&bio->data, (char *)data + osz, sz - osz, offset + (off_t)osz);
+        osz += rsz > 0 ? (size_t)rsz : 0;
+    } while (osz < sz && rsz > 0);
+    return osz || rsz >= 0 ? (ssize_t)osz : -1;
 }
 
 size_t bio_write(bufferedio_t *bio, const void *data, size_t sz)
@@ -241,6 +505,28 @@ void bio_flush(bufferedio_t *bio)
     bio->flush(&bio->data);
 }
 
+int bio_wait(bufferedio_t *bio, int events, int timeout)
+{
+    return bio->wait ? bio->wait(&bio->data, events, timeout) : events;
+}
+
+ssize_t bio_pwrite(bufferedio_t *bio, const void *data, size_t sz, off_t offset)
+{
+    size_t osz = 0;
+    ssize_t wsz = 0;
+    if (!bio->pwrite)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    do
+    {
+        wsz = bio->pwrite(&bio->data, (const char *)data + osz, sz - osz, offset + (off_t)osz);
+        osz += wsz > 0 ? (size_t)wsz : 0;
+    } while (osz < sz && wsz > 0);
+    return osz || wsz >= 0 ? (ssize_t)osz : -1;
+}
+
 ssize_t bio_seek(bufferedio_t *bio, long offset, int whence)
 {
     return bio->seek(&bio->data, offset, whence);
@@ -7,7 +7,9 @@
 #define BUFFEREDIO_H
 
 #include "buffer.h"
+#include "bufseg.h"
 
+#include <stdint.h>
 #include <sys/types.h>
 
 /**
@@ -16,6 +18,59 @@
  */
 #define BIO_STATUS_INIT 0
 
+/**
+ * @def BIO_STATUS_WOULDBLOCK
+ * @brief status of usable buffered I/O context whose last operation stopped short because it would block (not EOF)
+ */
+#define BIO_STATUS_WOULDBLOCK (BIO_STATUS_INIT + 2)
+
+/**
+ * @def BIO_WAIT_READ
+ * @brief @ref bio_wait event for bytes available to read (or EOF)
+ */
+#define BIO_WAIT_READ 1
+
+/**
+ * @def BIO_WAIT_WRITE
+ * @brief @ref bio_wait event for room available to write
+ */
+#define BIO_WAIT_WRITE 2
+
+/**
+ * @def BIO_HINT_NONE
+ * @brief size hint unavailable, number of bytes until EOF unknown
+ */
+#define BIO_HINT_NONE 0
+
+/**
+ * @def BIO_HINT_MIN
+ * @brief size hint is a lower bound on the number of bytes available before EOF
+ */
+#define BIO_HINT_MIN 1
+
+/**
+ * @def BIO_HINT_EXACT
+ * @brief size hint is the exact number of bytes available before EOF
+ */
+#define BIO_HINT_EXACT 2
+
+/**
+ * @struct bio_stats
+ * @brief counters of underlying I/O performed by a buffered I/O context
+ * @typedef bio_stats_t
+ */
+typedef struct bio_stats
+{
+    size_t rbytes;       /** bytes read from underlying source */
+    size_t wbytes;       /** bytes written to underlying destination */
+    size_t nsyscall;     /** number of underlying system calls */
+    size_t nshort_r;     /** number of underlying reads returning less than requested */
+    size_t nshort_w;     /** number of underlying writes accepting less than requested */
+    size_t nrefill;      /** number of times buffer was refilled by reading */
+    size_t nflush;       /** number of times buffered bytes were flushed by writing */
+    uint64_t blocked_ns; /** nanoseconds spent in underlying system calls */
+} bio_stats_t;
+
 /**
  * @struct bio_data
  * @brief data manipulated by buffered I/O API
@@ -26,6 +81,7 @@ typedef struct bio_data
     buffer_t buf;    /** buffer used to store bytes for I/O */
     size_t offset;   /** offset into buffered bytes */
     buffer_t opaque; /** buffer to store arbitrary data in */
+    bio_stats_t stats; /** I/O counters maintained by implementations */
 } bio_data_t;
 
 /**
@@ -46,12 +102,26 @@ typedef struct bufferedio
     void (*status_str)(const bio_data_t *, char *, size_t);
     /** read function pointer invoked by @ref bio_read */
     size_t (*read)(bio_data_t *, void *, size_t);
+    /** buffered span function pointer invoked by @ref bio_peek (optional) */
+    const void *(*peek)(bio_data_t *, size_t *);
+    /** span release function pointer invoked by @ref bio_consume (optional, required with peek) */
+    void (*consume)(bio_data_t *, size_t);
     /** write function pointer invoked by @ref bio_write */
     size_t (*write)(bio_data_t *, const void *, size_t);
     /** flush function pointer invoked by @ref bio_flush */
     void (*flush)(bio_data_t *);
     /** seek function pointer invoked by @ref bio_seek */
     ssize_t (*seek)(bio_data_t *, long, int);
+    /** size hint function pointer invoked by @ref bio_size_hint (optional) */
+    int (*size_hint)(const bio_data_t *, size_t *);
+    /** hole skipping function pointer invoked by @ref bio_hole (optional) */
+    size_t (*hole)(bio_data_t *, size_t);
+    /** positional read function pointer invoked by @ref bio_pread (optional) */
+    ssize_t (*pread)(bio_data_t *, void *, size_t, off_t);
+    /** positional write function pointer invoked by @ref bio_pwrite (optional) */
+    ssize_t (*pwrite)(bio_data_t *, const void *, size_t, off_t);
+    /** readiness waiting function pointer invoked by @ref bio_wait (optional) */
+    int (*wait)(bio_data_t *, int, int);
     /** data free function pointer invoked by @ref bio_dfree */
     void (*dfree)(bio_data_t *);
 } bufferedio_t;
@@ -70,12 +140,29 @@ typedef struct bufferedio
  */
 void bio_wrap(bufferedio_t *bio, buffer_t *buf);
 
+/**
+ * @brief wrap direct access to a segmented memory buffer using the buffered I/O API
+ *
+ * Any segmented buffer wrapped in a buffered I/O context is moved (owned) by the context using @ref bseg_move.
+ * The segmented buffer is stored in @ref bio_data::opaque and can be iterated with @ref bseg_chunk.
+ * Writing will push to the segmented buffer without moving previously written bytes.
+ * Reading retrieves bytes in a FIFO order.
+ * Flushing clears the segmented buffer.
+ * Seeking will change where reads start from.
+ *
+ * @param[inout] bio buffered I/O context
+ * @param[inout] seg the segmented buffer to wrap (NULL to wrap an empty uninitialized segmented buffer)
+ */
+void bio_wrap_seg(bufferedio_t *bio, bufseg_t *seg);
+
 /**
  * @brief get status integer of buffered I/O context
  *
  * Invokes @ref bufferedio::status (must be set).
  * Status < @ref BIO_STATUS_INIT indicates I/O error.
  * Status > @ref BIO_STATUS_INIT indicates usability and expected operation.
+ * Status @ref BIO_STATUS_WOULDBLOCK indicates the last read or write stopped short without EOF or error,
+ * use @ref bio_wait before retrying.
  *
  * @param[inout] bio buffered I/O context
  * @return status integer of buffered I/O context
@@ -87,6 +174,7 @@ int bio_status(const bufferedio_t *bio);
  *
  * Invokes @ref bufferedio::status_str if available.
  * Will set default string if no implementation provided in buffered I/O context.
+ * Appends @ref bio_stats_str once any I/O has been counted.
  *
  * @param[inout] bio buffered I/O context
  * @param[out] str buffer to populate with status string
@@ -95,6 +183,45 @@ int bio_status(const bufferedio_t *bio);
  */
 char *bio_status_str(bufferedio_t *bio, char *str, size_t n);
 
+/**
+ * @brief get I/O counters of buffered I/O context
+ *
+ * @param bio buffered I/O context
+ * @return I/O counters maintained by the context implementation
+ */
+const bio_stats_t *bio_stats(const bufferedio_t *bio);
+
+/**
+ * @brief get string of I/O counters
+ *
+ * @param stats I/O counters
+ * @param[out] str buffer to populate with counters string
+ * @param n number of bytes available in buffer to populate
+ * @return pointer to string buffer input str
+ */
+char *bio_stats_str(const bio_stats_t *stats, char *str, size_t n);
+
+/**
+ * @brief get monotonic clock time for timing underlying I/O
+ *
+ * @return nanoseconds from arbitrary fixed point
+ */
+uint64_t bio_clock_ns(void);
+
+/**
+ * @brief count an underlying system call read or write in I/O counters
+ *
+ * Intended for use in buffered I/O implementations only.
+ * Counters are updated atomically, so positional I/O may count from several threads.
+ *
+ * @param[inout] stats I/O counters
+ * @param write nonzero if system call was a write, 0 if a read
+ * @param sz number of bytes requested
+ * @param rv return value of system call
+ * @param start_ns @ref bio_clock_ns before system call
+ */
+void bio_stats_sysio(bio_stats_t *stats, int write, size_t sz, ssize_t rv, uint64_t start_ns);
+
 /**
  * @brief read bytes using buffered I/O context
  *
@@ -110,11 +237,49 @@ char *bio_status_str(bufferedio_t *bio, char *str, size_t n);
  */
 size_t bio_read(bufferedio_t *bio, void *data, size_t sz);
 
+/**
+ * @brief get bytes at current position in place, without copying them out of the context
+ *
+ * Invokes @ref bufferedio::peek if available.
+ * Returns buffered bytes, filling the buffer with at most one underlying read if none are buffered.
+ * The position does not change until @ref bio_consume, the span stays valid until then (or the next operation).
+ * NULL is returned when no bytes are available (EOF, error, or would block, use @ref bio_status),
+ * or errno is set to ENOTSUP if the context cannot provide spans (e.g. unbuffered), use @ref bio_read instead.
+ *
+ * @param[inout] bio buffered I/O context
+ * @param[out] sz number of contiguous bytes available at the returned address (0 if NULL)
+ * @return first byte at current position, NULL if none available or unsupported
+ */
+const void *bio_peek(bufferedio_t *bio, size_t *sz);
+
+/**
+ * @brief advance current position past bytes obtained with @ref bio_peek (as if read)
+ *
+ * Invokes @ref bufferedio::consume if available.
+ * Must not exceed the number of bytes made available by the last @ref bio_peek.
+ *
+ * @param[inout] bio buffered I/O context
+ * @param sz number of bytes to consume
+ */
+void bio_consume(bufferedio_t *bio, size_t sz);
+
+/**
+ * @brief get number of bytes available to read from current position without reading
+ *
+ * Invokes @ref bufferedio::size_hint if available.
+ * Never changes the position or buffered bytes of the buffered I/O context.
+ *
+ * @param bio buffered I/O context
+ * @param[out] sz number of bytes available (0 if @ref BIO_HINT_NONE)
+ * @return @ref BIO_HINT_EXACT, @ref BIO_HINT_MIN, or @ref BIO_HINT_NONE
+ */
+int bio_size_hint(const bufferedio_t *bio, size_t *sz);
+
 /**
  * @brief read all available bytes from current position using buffered I/O context (until EOF or failure)
  *
- * If @ref bufferedio::seek using SEEK_END is supported, will invoke @ref bufferedio::read once.
- * If FIFO input or seeking to the end is not supported, will repeatedly invoke @ref bufferedio::read while pushing to buffer.
+ * Uses @ref bio_size_hint to allocate memory once for all bytes and invoke @ref bufferedio::read once.
+ * If the size hint is not exact, will repeatedly invoke @ref bufferedio::read while pushing to buffer.
  * Returns NULL upon error, @ref bio_status and @ref bio_status_str provide I/O error insight.
  * @ref buffer::size provides memory allocation error insight.
  *
@@ -124,6 +289,47 @@ size_t bio_read(bufferedio_t *bio, void *data, size_t sz);
  */
 const buffer_t *bio_read_all(bufferedio_t *bio, buffer_t *buf);
 
+/**
+ * @brief read all available bytes from current position into segmented buffer (until EOF or failure)
+ *
+ * Repeatedly invokes @ref bufferedio::read directly into the free bytes of the last chunk.
+ * Previously read bytes are never moved or copied, so memory use stays proportional to bytes read.
+ * Returns NULL upon error, @ref bio_status and @ref bio_status_str provide I/O error insight.
+ *
+ * @param[inout] bio buffered I/O context
+ * @param[inout] seg the initialized segmented buffer to populate (pushing)
+ * @return populated segmented buffer (NULL if error)
+ */
+const bufseg_t *bio_read_all_seg(bufferedio_t *bio, bufseg_t *seg);
+
+/**
+ * @brief skip bytes at current position known to read as zeros (e.g. sparse file holes) without reading them
+ *
+ * Invokes @ref bufferedio::hole if available.
+ * Skipped bytes are consumed as if read, the caller must treat them as zeros.
+ * Returns 0 when the next bytes must be read normally (not in a hole, buffered, or unsupported).
+ *
+ * @param[inout] bio buffered I/O context
+ * @param max maximum number of bytes to skip
+ * @return number of zero bytes skipped
+ */
+size_t bio_hole(bufferedio_t *bio, size_t max);
+
+/**
+ * @brief read bytes at absolute offset without using or changing buffered bytes or current position
+ *
+ * Invokes @ref bufferedio::pread (optional) until sz bytes are read or EOF or error occurs.
+ * Safe to invoke from several threads on the same context (status is not updated, errno is set instead).
+ * Pending buffered writes are not seen, use @ref bio_flush beforehand.
+ *
+ * @param bio buffered I/O context
+ * @param[out] data output buffer to populate with bytes
+ * @param sz number of bytes to read into output data buffer
+ * @param offset absolute offset of first byte to read
+ * @return number of bytes read, -1 if failed before any bytes were read (ENOTSUP if unsupported)
+ */
+ssize_t bio_pread(bufferedio_t *bio, void *data, size_t sz, off_t offset);
+
 /**
  * @brief write bytes using buffered I/O context
  *
@@ -150,6 +356,34 @@ size_t bio_write(bufferedio_t *bio, const void *data, size_t sz);
  */
 void bio_flush(bufferedio_t *bio);
 
+/**
+ * @brief sleep until buffered I/O context is ready to read or write without blocking
+ *
+ * Invokes @ref bufferedio::wait if available, otherwise always ready (never blocks, e.g. memory).
+ * Ready immediately if buffered bytes can satisfy the events.
+ *
+ * @param bio buffered I/O context
+ * @param events @ref BIO_WAIT_READ and/or @ref BIO_WAIT_WRITE
+ * @param timeout milliseconds to wait at most (-1 for no limit)
+ * @return ready events (0 if timed out), -1 if failed (errno set)
+ */
+int bio_wait(bufferedio_t *bio, int events, int timeout);
+
+/**
+ * @brief write bytes at absolute offset without using or changing buffered bytes or current position
+ *
+ * Invokes @ref bufferedio::pwrite (optional) until sz bytes are written or error occurs.
+ * Safe to invoke from several threads on the same context (status is not updated, errno is set instead).
+ * Buffered bytes overlapping the written range are not updated.
+ *
+ * @param bio buffered I/O context
+ * @param data bytes to write
+ * @param sz number of bytes to write
+ * @param offset absolute offset of first byte to write
+ * @return number of bytes written, -1 if failed before any bytes were written (ENOTSUP if unsupported)
+ */
+ssize_t bio_pwrite(bufferedio_t *bio, const void *data, size_t sz, off_t offset);
+
 /**
  * @brief seek into new byte position in buffered I/O context
  *
@@ -0,0 +1,174 @@
+/**
+ * @file bufring.c
+ * @author Rob Griffith
+ */
+
+#define _GNU_SOURCE /* memfd_create */
+
+#include "bufring.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+void _bring_wake(bufring_t *ring)
+{
+    /* position changed, wake sleepers (no system call unless someone sleeps) */
+    __atomic_add_fetch(&ring->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->nwait, __ATOMIC_SEQ_CST))
+    {
+        syscall(SYS_futex, &ring->seq, FUTEX_WAKE_PRIVATE, __INT32_MAX__, NULL, NULL, 0);
+    }
+}
+
+int _bring_ready(const bufring_t *ring, int read, int write)
+{
+    const size_t size = bring_size(ring);
+    return (read && (size || bring_closed(ring))) || (write && size < ring->capacity);
+}
+
+size_t bring_init(bufring_t *ring, size_t cap)
+{
+    const size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t sz = ((cap ? cap : 1) + pagesz - 1) / pagesz * pagesz;
+    char *map = MAP_FAILED;
+    int err = 0;
+    bring_free(ring);
+    const int fd = memfd_create("bufring", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, (off_t)sz) < 0)
+    {
+        goto error;
+    }
+    /* reserve address range for both halves, then map the same pages over each */
+    map = mmap(NULL, 2 * sz, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED ||
+        mmap(map, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(map + sz, sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        goto error;
+    }
+    /* mappings keep memory alive */
+    close(fd);
+    ring->data = map;
+    ring->capacity = sz;
+    return sz;
+error:
+    err = errno;
+    if (map != MAP_FAILED)
+    {
+        munmap(map, 2 * sz);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    errno = err;
+    return 0;
+}
+
+void bring_free(bufring_t *ring)
+{
+    if (ring->data)
+    {
+        munmap(ring->data, 2 * ring->capacity);
+    }
+    memset(ring, 0, sizeof(bufring_t));
+}
+
+size_t bring_size(const bufring_t *ring)
+{
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+const void *bring_head(const bufring_t *ring, size_t *sz)
+{
+    /* committed bytes published by release of tail */
+    const size_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    *sz = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - head;
+    return ring->data + (ring->capacity ? head % ring->capacity : 0);
+}
+
+void bring_consume(bufring_t *ring, size_t sz)
+{
+    if (sz)
+    {
+        __atomic_add_fetch(&ring->head, sz, __ATOMIC_RELEASE);
+        _bring_wake(ring);
+    }
+}
+
+void *bring_tail(const bufring_t *ring, size_t *sz)
+{
+    /* consumed bytes released by release of head */
+    const size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    *sz = ring->capacity - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+    return ring->data + (ring->capacity ? tail % ring->capacity : 0);
+}
+
+void bring_commit(bufring_t *ring, size_t sz)
+{
+    if (sz)
+    {
+        __atomic_add_fetch(&ring->tail, sz, __ATOMIC_RELEASE);
+        _bring_wake(ring);
+    }
+}
+
+void bring_close(bufring_t *ring)
+{
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+    _bring_wake(ring);
+}
+
+int bring_closed(const bufring_t *ring)
+{
+    return __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+}
+
+int bring_wait(bufring_t *ring, int read, int write, int timeout)
+{
+    struct timespec now, end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += timeout / 1000;
+    end.tv_nsec += (long)(timeout % 1000) * 1000000L;
+    if (end.tv_nsec >= 1000000000L)
+    {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000L;
+    }
+    int ready;
+    __atomic_add_fetch(&ring->nwait, 1, __ATOMIC_SEQ_CST);
+    for (;;)
+    {
+        /* sequence read before checking, so a change after the check fails the futex wait */
+        const unsigned int seq = __atomic_load_n(&ring->seq, __ATOMIC_SEQ_CST);
+        ready = _bring_ready(ring, read, write);
+        if (ready || !timeout)
+        {
+            break;
+        }
+        struct timespec rel = {0, 0};
+        if (timeout > 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            rel.tv_sec = end.tv_sec - now.tv_sec;
+            rel.tv_nsec = end.tv_nsec - now.tv_nsec;
+            if (rel.tv_nsec < 0)
+            {
+                rel.tv_sec--;
+                rel.tv_nsec += 1000000000L;
+            }
+            if (rel.tv_sec < 0)
+            {
+                break;
+            }
+        }
+        syscall(SYS_futex, &ring->seq, FUTEX_WAIT_PRIVATE, seq, timeout > 0 ? &rel : NULL, NULL, 0);
+    }
+    __atomic_sub_fetch(&ring->nwait, 1, __ATOMIC_SEQ_CST);
+    return ready;
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+/**
+ * @file bufring.h
+ * @author Rob Griffith
+ */
+
+#ifndef BUFRING_H
+#define BUFRING_H
+
+#include <stddef.h>
+
+/**
+ * @struct bufring
+ * @brief ring buffer whose memory is mapped twice back to back, so every span of bytes is contiguous
+ * @typedef bufring_t
+ *
+ * The same pages (memfd_create(2)) are mapped at data and data + capacity,
+ * bytes wrapping around the end of the ring are readable and writable without splitting copies.
+ * One producer thread and one consumer thread may use the ring concurrently (positions are atomic).
+ * Generally, ring buffers should be zero-initialized.
+ */
+typedef struct bufring
+{
+    char *data;         /** first byte of the mapping (2 * capacity bytes mapped) */
+    size_t capacity;    /** number of bytes in the ring (multiple of page size) */
+    size_t head;        /** total bytes consumed (read position) */
+    size_t tail;        /** total bytes committed (write position) */
+    int closed;         /** producer closed the ring, no more bytes will be committed */
+    unsigned int seq;   /** futex word changed whenever positions change */
+    unsigned int nwait; /** number of threads sleeping in @ref bring_wait */
+} bufring_t;
+
+/**
+ * @brief initialize ring buffer with at least the specified capacity (rounded up to page size)
+ *
+ * Any previously mapped ring is unmapped.
+ *
+ * @param[inout] ring the ring buffer to initialize
+ * @param cap minimum number of bytes the ring must hold
+ * @return the capacity (0 if failed, errno set)
+ */
+size_t bring_init(bufring_t *ring, size_t cap);
+
+/**
+ * @brief unmap the memory of the ring buffer
+ *
+ * the ring buffer will be cleared and set to all 0
+ *
+ * @param[inout] ring the ring buffer to free
+ */
+void bring_free(bufring_t *ring);
+
+/**
+ * @brief get number of committed bytes not yet consumed
+ *
+ * @param ring the ring buffer
+ * @return the number of readable bytes
+ */
+size_t bring_size(const bufring_t *ring);
+
+/**
+ * @brief get readable bytes at head of ring buffer (consumer only)
+ *
+ * Bytes are not released until @ref bring_consume is invoked.
+ *
+ * @param ring the ring buffer
+ * @param[out] sz the number of contiguous readable bytes (all committed bytes)
+ * @return the first readable byte
+ */
+const void *bring_head(const bufring_t *ring, size_t *sz);
+
+/**
+ * @brief release bytes read at head of ring buffer (consumer only)
+ *
+ * Must not exceed the number of bytes made available by @ref bring_head.
+ *
+ * @param[inout] ring the ring buffer
+ * @param sz the number of bytes to release
+ */
+void bring_consume(bufring_t *ring, size_t sz);
+
+/**
+ * @brief get writable bytes at tail of ring buffer (producer only)
+ *
+ * Bytes are not readable until @ref bring_commit is invoked.
+ *
+ * @param ring the ring buffer
+ * @param[out] sz the number of contiguous writable bytes (all free bytes)
+ * @return the first writable byte
+ */
+void *bring_tail(const bufring_t *ring, size_t *sz);
+
+/**
+ * @brief make bytes written at tail of ring buffer readable (producer only)
+ *
+ * Must not exceed the number of bytes made available by @ref bring_tail.
+ *
+ * @param[inout] ring the ring buffer
+ * @param sz the number of bytes to commit
+ */
+void bring_commit(bufring_t *ring, size_t sz);
+
+/**
+ * @brief mark ring buffer as closed by producer, consumer reads EOF once drained
+ *
+ * @param[inout] ring the ring buffer
+ */
+void bring_close(bufring_t *ring);
+
+/**
+ * @brief check whether ring buffer was closed by producer
+ *
+ * @param ring the ring buffer
+ * @return nonzero if closed
+ */
+int bring_closed(const bufring_t *ring);
+
+/**
+ * @brief sleep until ring buffer has readable bytes (or is closed) and/or free bytes (futex(2))
+ *
+ * @param[inout] ring the ring buffer
+ * @param read nonzero to wait for readable bytes or close
+ * @param write nonzero to wait for free bytes
+ * @param timeout milliseconds to wait at most (-1 for no limit)
+ * @return nonzero if ready, 0 if timed out
+ */
+int bring_wait(bufring_t *ring, int read, int write, int timeout);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,143 @@
+/**
+ * @file bufseg.c
+ * @author Rob Griffith
+ */
+
+#include "bufseg.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+void *_bseg_alloc(const bufseg_t *seg)
+{
+    if (seg->flags & BSEG_MMAP)
+    {
+        void *chunk = mmap(NULL, seg->chunksz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return chunk == MAP_FAILED ? NULL : chunk;
+    }
+    return malloc(seg->chunksz);
+}
+
+void _bseg_dealloc(const bufseg_t *seg, void *chunk)
+{
+    if (seg->flags & BSEG_MMAP)
+    {
+        munmap(chunk, seg->chunksz);
+    }
+    else
+    {
+        free(chunk);
+    }
+}
+
+size_t bseg_init(bufseg_t *seg, size_t chunksz, int flags)
+{
+    bseg_free(seg);
+    seg->chunksz = chunksz;
+    seg->flags = flags;
+    return seg->chunksz;
+}
+
+void bseg_move(bufseg_t *seg, bufseg_t *src)
+{
+    buf_move(&seg->chunks, &src->chunks);
+    seg->chunksz = src->chunksz;
+    seg->size = src->size;
+    seg->flags = src->flags;
+    /* clear source */
+    memset(src, 0, sizeof(*src));
+}
+
+void bseg_free(bufseg_t *seg)
+{
+    if (seg)
+    {
+        void **chunks = seg->chunks.data;
+        const size_t n = seg->chunks.size / sizeof(void *);
+        size_t i;
+        for (i = 0; i < n; i++)
+        {
+            _bseg_dealloc(seg, chunks[i]);
+        }
+        buf_free(&seg->chunks);
+        memset(seg, 0, sizeof(*seg));
+    }
+}
+
+void bseg_clear(bufseg_t *seg)
+{
+    seg->size = 0;
+}
+
+void *bseg_tail(bufseg_t *seg, size_t *sz)
+{
+    *sz = 0;
+    if (!seg->chunksz)
+    {
+        return NULL;
+    }
+    const size_t idx = seg->size / seg->chunksz;
+    const size_t off = seg->size % seg->chunksz;
+    if (idx >= seg->chunks.size / sizeof(void *))
+    {
+        /* chunks are reused after clearing, only allocate past the last one */
+        void *chunk = _bseg_alloc(seg);
+        if (!chunk)
+        {
+            return NULL;
+        }
+        if (!buf_push(&seg->chunks, &chunk, sizeof(chunk)))
+        {
+            _bseg_dealloc(seg, chunk);
+            return NULL;
+        }
+    }
+    *sz = seg->chunksz - off;
+    return (char *)((void **)seg->chunks.data)[idx] + off;
+}
+
+size_t bseg_commit(bufseg_t *seg, size_t sz)
+{
+    seg->size += sz;
+    return seg->size;
+}
+
+size_t bseg_push(bufseg_t *seg, const void *src, size_t sz)
+{
+    size_t osz = 0;
+    while (osz < sz)
+    {
+        size_t tsz;
+        char *tail = bseg_tail(seg, &tsz);
+        if (!tail)
+        {
+            break;
+        }
+        tsz = tsz < sz - osz ? tsz : sz - osz;
+        if (src)
+        {
+            memcpy(tail, (const char *)src + osz, tsz);
+        }
+        else
+        {
+            /* zero */
+            memset(tail, 0, tsz);
+        }
+        bseg_commit(seg, tsz);
+        osz += tsz;
+    }
+    return osz;
+}
+
+const void *bseg_chunk(const bufseg_t *seg, size_t idx, size_t *sz)
+{
+    *sz = 0;
+    if (!seg->chunksz || idx >= (seg->size + seg->chunksz - 1) / seg->chunksz)
+    {
+        return NULL;
+    }
+    const size_t start = idx * seg->chunksz;
+    const size_t rsz = seg->size - start;
+    *sz = rsz < seg->chunksz ? rsz : seg->chunksz;
+    return ((void *const *)seg->chunks.data)[idx];
+}
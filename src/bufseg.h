@@ -0,0 +1,113 @@
+/**
+ * @file bufseg.h
+ * @author Rob Griffith
+ */
+
+#ifndef BUFSEG_H
+#define BUFSEG_H
+
+#include "buffer.h"
+
+/**
+ * @def BSEG_MMAP
+ * @brief segmented buffer flag for allocating chunks using anonymous mmap(2)
+ */
+#define BSEG_MMAP 1
+
+/**
+ * @struct bufseg
+ * @brief control over a sequence of fixed-size dynamically allocated chunks of memory
+ * @typedef bufseg_t
+ *
+ * Chunks are never reallocated, so growing never moves or copies existing bytes.
+ * Generally, segmented buffers should be zero-initialized.
+ */
+typedef struct bufseg
+{
+    buffer_t chunks; /** array of pointers to the allocated chunks */
+    size_t chunksz;  /** the number of bytes allocated in each chunk */
+    size_t size;     /** the number of bytes considered used (across all chunks) */
+    int flags;       /** flags controlling allocation of chunks */
+} bufseg_t;
+
+/**
+ * @brief initialize segmented buffer with specified chunk size (no chunks allocated)
+ *
+ * Any previously allocated chunks are freed.
+ *
+ * @param[inout] seg the segmented buffer to initialize
+ * @param chunksz the number of bytes to allocate in each chunk
+ * @param flags flags controlling allocation of chunks (e.g. @ref BSEG_MMAP)
+ * @return the chunk size (chunksz if successful, 0 if failed)
+ */
+size_t bseg_init(bufseg_t *seg, size_t chunksz, int flags);
+
+/**
+ * @brief move segmented buffer ownership from one segmented buffer to another
+ *
+ * the source segmented buffer will be cleared and set to all 0
+ *
+ * @param[inout] seg the segmented buffer to own the chunks
+ * @param[inout] src the segmented buffer currently owning the chunks
+ */
+void bseg_move(bufseg_t *seg, bufseg_t *src);
+
+/**
+ * @brief free the chunks owned by the segmented buffer
+ *
+ * the segmented buffer will be cleared and set to all 0
+ *
+ * @param[inout] seg the segmented buffer to free chunks from
+ */
+void bseg_free(bufseg_t *seg);
+
+/**
+ * @brief clear segmented buffer without freeing underlying allocated chunks
+ *
+ * @param[inout] seg the segmented buffer to clear (size will become 0)
+ */
+void bseg_clear(bufseg_t *seg);
+
+/**
+ * @brief get writable bytes at end of segmented buffer, allocating a chunk as needed
+ *
+ * Bytes are not considered used until @ref bseg_commit is invoked.
+ *
+ * @param[inout] seg the segmented buffer
+ * @param[out] sz the number of writable bytes available (0 if failed allocation)
+ * @return the first writable byte, NULL if failed allocation
+ */
+void *bseg_tail(bufseg_t *seg, size_t *sz);
+
+/**
+ * @brief mark bytes written at end of segmented buffer as used
+ *
+ * Must not exceed the number of bytes made available by @ref bseg_tail.
+ *
+ * @param[inout] seg the segmented buffer
+ * @param sz the number of bytes to mark as used
+ * @return the new size of the segmented buffer
+ */
+size_t bseg_commit(bufseg_t *seg, size_t sz);
+
+/**
+ * @brief push bytes to end of segmented buffer, allocating chunks as needed
+ *
+ * @param[inout] seg the segmented buffer to push to
+ * @param src the bytes to push (NULL to push zeros)
+ * @param sz the number of bytes to push
+ * @return the number of bytes pushed (sz if successful, less if failed allocation)
+ */
+size_t bseg_push(bufseg_t *seg, const void *src, size_t sz);
+
+/**
+ * @brief get used bytes of a single chunk for zero-copy iteration
+ *
+ * @param seg the segmented buffer
+ * @param idx the index of the chunk
+ * @param[out] sz the number of used bytes in the chunk
+ * @return the first byte of the chunk, NULL if no used bytes in chunk at idx
+ */
+const void *bseg_chunk(const bufseg_t *seg, size_t idx, size_t *sz);
+
+#endif
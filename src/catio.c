@@ -0,0 +1,304 @@
+/**
+ * @file catio.c
+ * @author Rob Griffith
+ */
+
+#include "catio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct _catio_file
+{
+    size_t start;   /* global offset of first byte of file */
+    size_t pathoff; /* offset of null-terminated path in paths buffer */
+} _catio_file_t;
+
+typedef struct _catio_opqd
+{
+    int err;
+    int fd;          /* descriptor of file at index cur, -1 if not open */
+    size_t cur;      /* index of open file */
+    size_t pos;      /* global offset of next byte read from files (end of buffered bytes) */
+    size_t nfiles;   /* number of files */
+    buffer_t files;  /* nfiles + 1 entries of _catio_file_t, last start is total size */
+    buffer_t paths;  /* concatenated null-terminated paths */
+} _catio_opqd_t;
+
+const _catio_file_t *_catio_file(const _catio_opqd_t *opqd, size_t idx)
+{
+    return (const _catio_file_t *)opqd->files.data + idx;
+}
+
+size_t _catio_find(const _catio_opqd_t *opqd, size_t pos)
+{
+    /* binary search for last file starting at or before pos (empty files skipped) */
+    size_t lo = 0;
+    size_t hi = opqd->nfiles;
+    while (hi - lo > 1)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (_catio_file(opqd, mid)->start <= pos)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int _catio_status(const bio_data_t *bd)
+{
+    const _catio_opqd_t *opqd = bd->opaque.data;
+    if (opqd && opqd->err)
+    {
+        return BIO_STATUS_INIT - opqd->err;
+    }
+    return BIO_STATUS_INIT + ((bd->buf.data && opqd) ? 1 : 0);
+}
+
+void _catio_status_str(const bio_data_t *bd, char *str, size_t n)
+{
+    const _catio_opqd_t *opqd = bd->opaque.data;
+    int rv;
+    if (!opqd)
+    {
+        strncpy(str, "uninitialized, no files", n);
+        return;
+    }
+    const size_t total = _catio_file(opqd, opqd->nfiles)->start;
+    if (opqd->err)
+    {
+        rv = snprintf(str, n, "{files: %zu, size: %zu, bufsz: %zu}, error: %s", opqd->nfiles, total, bd->buf.capacity, strerror(opqd->err));
+    }
+    else
+    {
+        rv = snprintf(str, n, "{files: %zu, size: %zu, bufsz: %zu}", opqd->nfiles, total, bd->buf.capacity);
+    }
+    if (rv < 0)
+    {
+        strncpy(str, "(catio status_str failed to format string)", n);
+    }
+}
+
+size_t _catio_sysread(bio_data_t *bd, void *data, size_t sz)
+{
+    /* single underlying read from file containing pos, never crossing into next file */
+    _catio_opqd_t *opqd = bd->opaque.data;
+    const size_t total = _catio_file(opqd, opqd->nfiles)->start;
+    if (opqd->pos >= total)
+    {
+        return 0;
+    }
+    const size_t idx = _catio_find(opqd, opqd->pos);
+    const _catio_file_t *file = _catio_file(opqd, idx);
+    if (opqd->fd < 0 || opqd->cur != idx)
+    {
+        /* lazily open file, closing previous */
+        if (opqd->fd >= 0)
+        {
+            close(opqd->fd);
+        }
+        opqd->cur = idx;
+        opqd->fd = open((const char *)opqd->paths.data + file->pathoff, O_RDONLY);
+        bd->stats.nsyscall++;
+        if (opqd->fd < 0 || (opqd->pos > file->start && lseek(opqd->fd, (off_t)(opqd->pos - file->start), SEEK_SET) < 0))
+        {
+            opqd->err = errno;
+            return 0;
+        }
+    }
+    const size_t fsz = (file + 1)->start - opqd->pos;
+    sz = fsz < sz ? fsz : sz;
+    const uint64_t t = bio_clock_ns();
+    const ssize_t rv = read(opqd->fd, data, sz);
+    bio_stats_sysio(&bd->stats, 0, sz, rv, t);
+    opqd->err = rv < 0 ? errno : (rv == 0 && sz ? EIO : 0); /* file shrank since indexed */
+    opqd->pos += rv < 0 ? 0 : (size_t)rv;
+    return rv < 0 ? 0 : (size_t)rv;
+}
+
+size_t _catio_read(bio_data_t *bd, void *data, size_t sz)
+{
+    /*
+    get bytes from internal buffer when possible
+    refill buffer as needed (only once)
+    relies on bio_read re-trying until complete or 0
+    */
+    size_t rsz = bd->buf.size - bd->offset;
+    size_t osz;
+    if (sz > rsz + bd->buf.capacity)
+    {
+        /* drain buffer and read directly */
+        memcpy(data, (const char *)bd->buf.data + bd->offset, rsz);
+        bd->offset = 0;
+        buf_clear(&bd->buf);
+        osz = rsz + _catio_sysread(bd, (char *)data + rsz, sz - rsz);
+    }
+    else
+    {
+        if (!rsz)
+        {
+            /* refill buffer */
+            bd->offset = 0;
+            bd->stats.nrefill++;
+            rsz = buf_resize(&bd->buf, _catio_sysread(bd, bd->buf.data, bd->buf.capacity));
+        }
+        osz = rsz < sz ? rsz : sz;
+        memcpy(data, (const char *)bd->buf.data + bd->offset, osz);
+        bd->offset += osz;
+    }
+    return osz;
+}
+
+size_t _catio_write(bio_data_t *bd, const void *data, size_t sz)
+{
+    _catio_opqd_t *opqd = bd->opaque.data;
+    opqd->err = EBADF;
+    return 0;
+}
+
+void _catio_flush(bio_data_t *bd)
+{
+    /* nothing ever buffered for writing */
+}
+
+ssize_t _catio_seek(bio_data_t *bd, long offset, int whence)
+{
+    _catio_opqd_t *opqd = bd->opaque.data;
+    const size_t total = _catio_file(opqd, opqd->nfiles)->start;
+    const ssize_t cur = (ssize_t)(opqd->pos - (bd->buf.size - bd->offset));
+    ssize_t pos;
+    switch (whence)
+    {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = cur + offset;
+        break;
+    case SEEK_END:
+        pos = (ssize_t)total + offset;
+        break;
+    default:
+        pos = -1;
+    }
+    if (pos < 0 || (size_t)pos > total)
+    {
+        opqd->err = EINVAL;
+        return -1;
+    }
+    opqd->err = 0;
+    buf_clear(&bd->buf);
+    bd->offset = 0;
+    if (opqd->fd >= 0 && opqd->cur == _catio_find(opqd, (size_t)pos) && (size_t)pos < total)
+    {
+        /* same file stays open */
+        if (lseek(opqd->fd, (off_t)((size_t)pos - _catio_file(opqd, opqd->cur)->start), SEEK_SET) < 0)
+        {
+            opqd->err = errno;
+            return -1;
+        }
+        bd->stats.nsyscall++;
+    }
+    else if (opqd->fd >= 0)
+    {
+        /* reopened lazily by next read */
+        close(opqd->fd);
+        opqd->fd = -1;
+    }
+    opqd->pos = (size_t)pos;
+    return pos;
+}
+
+int _catio_size_hint(const bio_data_t *bd, size_t *sz)
+{
+    /* indexed sizes known without any system calls */
+    const _catio_opqd_t *opqd = bd->opaque.data;
+    const size_t total = _catio_file(opqd, opqd->nfiles)->start;
+    *sz = (bd->buf.size - bd->offset) + (total > opqd->pos ? total - opqd->pos : 0);
+    return BIO_HINT_EXACT;
+}
+
+void _catio_dfree(bio_data_t *bd)
+{
+    _catio_opqd_t *opqd = bd->opaque.data;
+    if (opqd)
+    {
+        if (opqd->fd >= 0)
+        {
+            close(opqd->fd);
+        }
+        buf_free(&opqd->files);
+        buf_free(&opqd->paths);
+    }
+    buf_free(&bd->opaque);
+    buf_free(&bd->buf);
+}
+
+void catio_wrap(bufferedio_t *bio, const char *const *paths, size_t npaths, size_t bufsz)
+{
+    _catio_opqd_t opqd = {0, -1, 0, 0, 0, {0}, {0}};
+    _catio_file_t file = {0, 0};
+    buffer_t files = {0};
+    buffer_t strs = {0};
+    size_t i;
+    /* entries reserved up front, so the terminating entry always fits (inline if reserving failed) */
+    if (buf_init(&files, (npaths + 1) * sizeof(file)) < (npaths + 1) * sizeof(file))
+    {
+        opqd.err = ENOMEM;
+    }
+    for (i = 0; i < npaths && !opqd.err; i++)
+    {
+        struct stat st;
+        file.pathoff = strs.size;
+        if (stat(paths[i], &st) < 0)
+        {
+            opqd.err = errno;
+            break;
+        }
+        if (!S_ISREG(st.st_mode))
+        {
+            opqd.err = EISDIR;
+            break;
+        }
+        if (!buf_push(&strs, paths[i], strlen(paths[i]) + 1))
+        {
+            opqd.err = ENOMEM;
+            break;
+        }
+        buf_push(&files, &file, sizeof(file));
+        file.start += (size_t)st.st_size;
+    }
+    /* terminating entry holds total size */
+    file.pathoff = strs.size;
+    buf_push(&files, &file, sizeof(file));
+    opqd.nfiles = files.size / sizeof(file) - 1;
+    bio->data.buf.alloc = &buf_pool;
+    buf_init(&bio->data.buf, bufsz);
+    bio->data.offset = 0;
+    if (buf_copy(&bio->data.opaque, &opqd, sizeof(_catio_opqd_t)))
+    {
+        /* buffers moved in place, never copied bitwise */
+        _catio_opqd_t *copqd = bio->data.opaque.data;
+        buf_move(&copqd->files, &files);
+        buf_move(&copqd->paths, &strs);
+    }
+    buf_free(&files);
+    buf_free(&strs);
+    bio->status = &_catio_status;
+    bio->status_str = &_catio_status_str;
+    bio->read = &_catio_read;
+    bio->write = &_catio_write;
+    bio->flush = &_catio_flush;
+    bio->seek = &_catio_seek;
+    bio->size_hint = &_catio_size_hint;
+    bio->dfree = &_catio_dfree;
+}
\ No newline at end of file
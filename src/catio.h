@@ -0,0 +1,28 @@
+/**
+ * @file catio.h
+ * @author Rob Griffith
+ */
+
+#ifndef CATIO_H
+#define CATIO_H
+
+#include "bufferedio.h"
+
+/**
+ * @brief initialize read-only buffered I/O context presenting an ordered list of files as one stream
+ *
+ * File sizes are indexed once (stat(2), no files opened) so seeking is O(log n) in the number of files.
+ * Files are opened lazily, only one file descriptor is open at a time.
+ * Paths are copied, the provided strings need not outlive the context.
+ * Writing is not supported and sets an error status.
+ * The buffer is drawn from (and returned to) @ref buf_pool.
+ * Use @ref bio_status to check for sucessful initialization.
+ *
+ * @param[inout] bio buffered I/O context to use
+ * @param paths paths of the files to concatenate, in order
+ * @param npaths number of paths
+ * @param bufsz buffer size to use
+ */
+void catio_wrap(bufferedio_t *bio, const char *const *paths, size_t npaths, size_t bufsz);
+
+#endif
\ No newline at end of file
@@ -259,15 +259,29 @@ const cli_t *cli_parse(size_t argc, char *const *argv, cli_t *cli)
     return cli;
 }
 
+size_t _cli_push_token(buffer_t *buf, const tkz_slice_t *tok)
+{
+    /* null-terminate token in buf (copying it first if in place), return its offset */
+    const size_t offset = tok->owned ? (size_t)(tok->data - (const char *)buf->data) : buf->size;
+    if (!tok->owned)
+    {
+        buf_push(buf, tok->data, tok->size);
+    }
+    buf_push(buf, "", sizeof(char));
+    return offset;
+}
+
 int cli_parse_line(bufferedio_t *bio, buffer_t *buf, cli_t *cli)
 {
     char end = 0;
+    tkz_slice_t tok;
     if (!cli->cmd)
     {
         /* cmd token not parsed already, parse from line */
         cli->cmd = tkz_parse_str_token(bio, buf, &end);
     }
-    buffer_t argvbuf = {0}; /* store first as relative offsets to buf->data */
+    buffer_t argvbuf = {0}; /* store first as relative offsets to buf->data (inline for few arguments) */
+    argvbuf.alloc = buf->alloc; /* per-line scratch from same allocator as tokens (e.g. arena) */
     size_t offset;
     if (cli->cmd)
     {
@@ -277,12 +291,12 @@ int cli_parse_line(bufferedio_t *bio, buffer_t *buf, cli_t *cli)
     }
     while (!(end == '\n' || end == EOF))
     {
-        const char *tok = tkz_parse_str_token(bio, buf, &end);
-        if (!tok || *tok == '\0')
+        /* tokens in place copied once with null byte, rewritten tokens only terminated */
+        if (!tkz_parse_slice(bio, buf, &tok, &end) || !tok.size)
         {
             break;
         }
-        offset = tok - (const char *)buf->data;
+        offset = _cli_push_token(buf, &tok);
         buf_push(&argvbuf, &offset, sizeof(offset));
     }
     size_t argc = argvbuf.size / sizeof(char *);
@@ -303,4 +317,16 @@ int cli_parse_line(bufferedio_t *bio, buffer_t *buf, cli_t *cli)
     }
     buf_free(&argvbuf);
     return rv;
+}
+
+int cli_feed_line(tkz_dfa_t *dfa, bufferedio_t *bio, cli_t *cli)
+{
+    const int rv = tkz_feed_bio(dfa, bio);
+    char **argv;
+    if (rv != TKZ_LINE)
+    {
+        return rv;
+    }
+    const size_t argc = tkz_argv(dfa, &argv);
+    return argc && cli_parse(argc, argv, cli) ? TKZ_LINE : TKZ_ERROR;
 }
\ No newline at end of file
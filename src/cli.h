@@ -7,6 +7,7 @@
 #define CLI_H
 
 #include "bufferedio.h"
+#include "tokenize.h"
 
 #include <stddef.h>
 
@@ -101,6 +102,8 @@ const cli_t *cli_parse(size_t argc, char *const *argv, cli_t *cli);
  * If @def cli::cmd is not set, value is parsed from first token.
  * Generally, the first token should be parsed separately and used to select the relevant CLI context.
  * Tokenized strings are saved into separate provided buffer.
+ * Temporary allocations use the allocator of that buffer, so an arena (@ref buf_arena_t) reset per line
+ * makes parsing a line free of heap allocations once warmed up.
  * @def cli_parse used to parse tokens.
  * If error, buffered I/O context status should be checked to determine if I/O error or invalid input.
  *
@@ -111,4 +114,19 @@ const cli_t *cli_parse(size_t argc, char *const *argv, cli_t *cli);
  */
 int cli_parse_line(bufferedio_t *bio, buffer_t *buf, cli_t *cli);
 
+/**
+ * @brief parse command line from buffered I/O context given CLI context, resumable without waiting
+ *
+ * Feeds bytes to a parser (@ref tkz_feed_bio) and parses its tokens with @ref cli_parse once a line completes,
+ * the first token being the command.
+ * Stops with @ref TKZ_MORE when the context would block, the partial line is kept by the parser.
+ * Tokens (and parsed values) stay valid until the parser is fed again.
+ *
+ * @param[inout] dfa parser keeping the state of the partial line
+ * @param[inout] bio buffered I/O context
+ * @param[inout] cli command line input context to use and populate
+ * @return @ref TKZ_LINE if parsed, @ref TKZ_MORE if would block, @ref TKZ_EOF, or @ref TKZ_ERROR (I/O or invalid input)
+ */
+int cli_feed_line(tkz_dfa_t *dfa, bufferedio_t *bio, cli_t *cli);
+
 #endif
\ No newline at end of file
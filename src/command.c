@@ -0,0 +1,299 @@
+/**
+ * @file command.c
+ * @author Rob Griffith
+ */
+
+#include "command.h"
+#include "bstring.h"
+#include "cypher.h"
+#include "fdio.h"
+#include "tokenize.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CMD_OUT_FLAG (O_WRONLY | O_CREAT | O_TRUNC)
+#define CMD_OUT_MODE (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
+#define CMD_ARENASZ 4096
+
+void _cmd_lock(cmd_cache_t *cache)
+{
+    while (__atomic_test_and_set(&cache->lock, __ATOMIC_ACQUIRE))
+    {
+        /* held only for a lookup or a swap, spin read-only until released */
+        while (__atomic_load_n(&cache->lock, __ATOMIC_RELAXED))
+        {
+#ifdef __SSE2__
+            _mm_pause();
+#endif
+        }
+    }
+}
+
+void _cmd_unlock(cmd_cache_t *cache)
+{
+    __atomic_clear(&cache->lock, __ATOMIC_RELEASE);
+}
+
+void _cmd_key(cmd_ctx_t *ctx, const char *key, sha256hash_t *hash)
+{
+    /* cached with null byte, so used slots are never empty */
+    const size_t sz = strlen(key) + 1;
+    uint64_t h = 14695981039346656037ULL; /* FNV-1a */
+    size_t i;
+    for (i = 0; i < sz; i++)
+    {
+        h = (h ^ (uint8_t)key[i]) * 1099511628211ULL;
+    }
+    cmd_key_t *slot = ctx->cache ? ctx->cache->keys + (h & (CMD_KEYS - 1)) : NULL;
+    int hit = 0;
+    if (slot)
+    {
+        _cmd_lock(ctx->cache);
+        if (slot->key.size == sz && memcmp(slot->key.data, key, sz) == 0)
+        {
+            *hash = slot->hash;
+            hit = 1;
+        }
+        _cmd_unlock(ctx->cache);
+    }
+    if (hit)
+    {
+        ctx->nhits++;
+        return;
+    }
+    /* hashed without holding the lock, key bytes copied to command scratch */
+    bufferedio_t bio = {0};
+    buffer_t kbuf = {0};
+    kbuf.alloc = &ctx->arena.alloc;
+    buf_copy(&kbuf, key, sz - 1);
+    bio_wrap(&bio, &kbuf);
+    sha256(&bio, hash);
+    bio_dfree(&bio);
+    /* key copied before locking, replaced key freed after, so the lock is never held across allocation */
+    buffer_t copy = {0};
+    buffer_t old = {0};
+    if (slot && buf_copy(&copy, key, sz) == sz)
+    {
+        _cmd_lock(ctx->cache);
+        buf_move(&old, &slot->key);
+        buf_move(&slot->key, &copy);
+        slot->hash = *hash;
+        _cmd_unlock(ctx->cache);
+    }
+    buf_free(&old);
+    buf_free(&copy);
+}
+
+bufferedio_t *_cmd_open(cmd_ctx_t *ctx, bufferedio_t *bio, const char *arg, int out, const int *fds, size_t nfds, size_t *nused)
+{
+    if (strcmp(arg, "-") == 0)
+    {
+        /* received file descriptor, owned by caller */
+        errno = *nused < nfds ? errno : EBADF;
+        fdio_wrap(bio, *nused < nfds ? fds[*nused] : -1, ctx->bufsz, ctx->cflags);
+        (*nused)++;
+    }
+    else if (out)
+    {
+        fdio_wrap(bio, open(arg, CMD_OUT_FLAG, CMD_OUT_MODE), ctx->bufsz, FDIO_CLOSE | ctx->cflags);
+    }
+    else
+    {
+        fdio_wrap(bio, open(arg, O_RDONLY), ctx->bufsz, FDIO_CLOSE | FDIO_SPARSE | ctx->cflags);
+    }
+    return bio_status(bio) > BIO_STATUS_INIT ? bio : NULL;
+}
+
+const char *_cmd_encrypt(cmd_ctx_t *ctx, size_t argc, char **argv, const int *fds, size_t nfds)
+{
+    bufferedio_t in = {0};
+    bufferedio_t out = {0};
+    const char *rv = NULL;
+    char sstr[256];
+    size_t nused = 0;
+    sha256hash_t hash;
+    if (argc < 3 || argc > 4 || (argc == 3 && !ctx->defkey))
+    {
+        rv = bstr_printf(&ctx->res, "error usage: %s <in> <out>%s\n", argv[0], ctx->defkey ? " [key]" : " <key>");
+        goto end;
+    }
+    if (!_cmd_open(ctx, &in, argv[1], 0, fds, nfds, &nused))
+    {
+        rv = bstr_printf(&ctx->res, "error input \"%s\": %s\n", argv[1], bio_status_str(&in, sstr, sizeof(sstr)));
+        goto end;
+    }
+    if (!_cmd_open(ctx, &out, argv[2], 1, fds, nfds, &nused))
+    {
+        rv = bstr_printf(&ctx->res, "error output \"%s\": %s\n", argv[2], bio_status_str(&out, sstr, sizeof(sstr)));
+        goto end;
+    }
+    if (argc == 4)
+    {
+        _cmd_key(ctx, argv[3], &hash);
+    }
+    else
+    {
+        hash = *ctx->defkey;
+    }
+    const size_t csz = cypher_xor(&in, &hash, &out);
+    bio_flush(&out);
+    if (bio_status(&in) < BIO_STATUS_INIT || bio_status(&out) < BIO_STATUS_INIT)
+    {
+        bufferedio_t *bad = bio_status(&in) < BIO_STATUS_INIT ? &in : &out;
+        rv = bstr_printf(&ctx->res, "error %s: %s\n", argv[bad == &in ? 1 : 2], bio_status_str(bad, sstr, sizeof(sstr)));
+        goto end;
+    }
+    rv = bstr_printf(&ctx->res, "ok %zu\n", csz);
+end:
+    bio_dfree(&out);
+    bio_dfree(&in);
+    return rv;
+}
+
+const char *_cmd_digest(cmd_ctx_t *ctx, size_t argc, char **argv, const int *fds, size_t nfds)
+{
+    bufferedio_t in = {0};
+    const char *rv = NULL;
+    char sstr[256];
+    size_t nused = 0;
+    sha256hash_t hash;
+    sha256hex_t hex;
+    if (argc != 2)
+    {
+        rv = bstr_printf(&ctx->res, "error usage: %s <in>\n", argv[0]);
+        goto end;
+    }
+    if (!_cmd_open(ctx, &in, argv[1], 0, fds, nfds, &nused))
+    {
+        rv = bstr_printf(&ctx->res, "error input \"%s\": %s\n", argv[1], bio_status_str(&in, sstr, sizeof(sstr)));
+        goto end;
+    }
+    sha256(&in, &hash);
+    if (bio_status(&in) < BIO_STATUS_INIT)
+    {
+        rv = bstr_printf(&ctx->res, "error %s: %s\n", argv[1], bio_status_str(&in, sstr, sizeof(sstr)));
+        goto end;
+    }
+    rv = bstr_printf(&ctx->res, "ok %s\n", sha256_hexstr(&hash, &hex));
+end:
+    bio_dfree(&in);
+    return rv;
+}
+
+const char *_cmd_sha256(cmd_ctx_t *ctx, size_t argc, char **argv)
+{
+    if (argc != 2)
+    {
+        return bstr_printf(&ctx->res, "error usage: %s <key>\n", argv[0]);
+    }
+    sha256hash_t hash;
+    sha256hex_t hex;
+    _cmd_key(ctx, argv[1], &hash);
+    return bstr_printf(&ctx->res, "ok %s\n", sha256_hexstr(&hash, &hex));
+}
+
+const char *cmd_exec(cmd_ctx_t *ctx, size_t argc, char **argv, const int *fds, size_t nfds, size_t *sz)
+{
+    const char *rv;
+    if (!ctx->arena.alloc.realloc)
+    {
+        /* blocks allocated on demand if this fails */
+        buf_arena_init(&ctx->arena, CMD_ARENASZ);
+    }
+    /* scratch and result line of the previous command released at once */
+    buf_arena_reset(&ctx->arena);
+    memset(&ctx->res, 0, sizeof(buffer_t));
+    ctx->res.alloc = &ctx->arena.alloc;
+    if (argc && (strcmp(argv[0], "encrypt") == 0 || strcmp(argv[0], "decrypt") == 0))
+    {
+        /* XOR is its own inverse */
+        rv = _cmd_encrypt(ctx, argc, argv, fds, nfds);
+    }
+    else if (argc && strcmp(argv[0], "digest") == 0)
+    {
+        rv = _cmd_digest(ctx, argc, argv, fds, nfds);
+    }
+    else if (argc && strcmp(argv[0], "sha256") == 0)
+    {
+        rv = _cmd_sha256(ctx, argc, argv);
+    }
+    else
+    {
+        rv = bstr_printf(&ctx->res, "error unknown command \"%s\"\n", argc ? argv[0] : "");
+    }
+    ctx->ncmds++;
+    ctx->nfailed += !rv || strncmp(rv, "ok", 2) != 0;
+    *sz = rv ? strlen(rv) : 0;
+    if (ctx->log)
+    {
+        log_printfl(ctx->log, LOG_DEBUG, "command \"%s\": %s", argc ? argv[0] : "", rv ? rv : "failed allocation\n");
+    }
+    return rv;
+}
+
+size_t cmd_serve(cmd_ctx_t *ctx, bufferedio_t *in, bufferedio_t *out)
+{
+    tkz_dfa_t dfa = {0};
+    char **argv;
+    size_t sz, rv = 0;
+    int status;
+    while ((status = tkz_feed_bio(&dfa, in)) != TKZ_EOF && status != TKZ_ERROR)
+    {
+        if (status == TKZ_MORE)
+        {
+            /* nonblocking input, results go out before sleeping */
+            bio_flush(out);
+            if (bio_wait(in, BIO_WAIT_READ, -1) < 0 && errno != EINTR)
+            {
+                break;
+            }
+            continue;
+        }
+        const size_t argc = tkz_argv(&dfa, &argv);
+        const char *res = cmd_exec(ctx, argc, argv, NULL, 0, &sz);
+        rv++;
+        if (!res || bio_write(out, res, sz) != sz)
+        {
+            break;
+        }
+        if (bio_wait(in, BIO_WAIT_READ, 0) <= 0)
+        {
+            /* controller waits for results before sending more commands */
+            bio_flush(out);
+        }
+    }
+    if (status == TKZ_ERROR && errno == EINVAL && bio_status(in) > BIO_STATUS_INIT)
+    {
+        /* input ended inside quotes or after a backslash, the partial command is never run */
+        const char *res = "error unterminated quote or escape at end of input\n";
+        bio_write(out, res, strlen(res));
+    }
+    tkz_dfa_free(&dfa);
+    return rv;
+}
+
+void cmd_ctx_free(cmd_ctx_t *ctx)
+{
+    buf_free(&ctx->res);
+    buf_arena_free(&ctx->arena);
+    ctx->ncmds = 0;
+    ctx->nfailed = 0;
+    ctx->nhits = 0;
+}
+
+void cmd_cache_free(cmd_cache_t *cache)
+{
+    size_t i;
+    for (i = 0; i < CMD_KEYS; i++)
+    {
+        buf_free(&cache->keys[i].key);
+    }
+    memset(cache, 0, sizeof(cmd_cache_t));
+}
\ No newline at end of file
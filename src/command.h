@@ -0,0 +1,122 @@
+/**
+ * @file command.h
+ * @author Rob Griffith
+ */
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "log.h"
+#include "sha256.h"
+
+/**
+ * @def CMD_KEYS
+ * @brief number of key hashes cached by a command context (power of 2)
+ */
+#define CMD_KEYS 64
+
+/**
+ * @struct cmd_key
+ * @brief key bytes and their SHA256 hash cached between commands
+ * @typedef cmd_key_t
+ */
+typedef struct cmd_key
+{
+    buffer_t key;       /** key bytes (empty if slot unused) */
+    sha256hash_t hash;  /** SHA256 hash of key bytes */
+} cmd_key_t;
+
+/**
+ * @struct cmd_cache
+ * @brief key hashes cached between commands, direct mapped by key bytes (thread-safe)
+ * @typedef cmd_cache_t
+ *
+ * One cache may be shared by the command contexts of many threads, so each key is hashed once per process.
+ * Caches hold buffers, so they must not be copied once used.
+ * Generally, caches should be zero-initialized.
+ */
+typedef struct cmd_cache
+{
+    cmd_key_t keys[CMD_KEYS]; /** cached key hashes */
+    int lock;                 /** spin lock held while a slot is looked up or swapped (never across allocation) */
+} cmd_cache_t;
+
+/**
+ * @struct cmd_ctx
+ * @brief state kept warm between commands of a command stream
+ * @typedef cmd_ctx_t
+ *
+ * Commands are lines of tokens (see @ref tkz_dfa_t), one result line each:
+ *
+ *     encrypt <in> <out> [key]   XOR file in into file out   -> ok <bytes>
+ *     decrypt <in> <out> [key]   same as encrypt             -> ok <bytes>
+ *     digest <in>                hash bytes of file in       -> ok <hex>
+ *     sha256 <key>               hash key                    -> ok <hex>
+ *
+ * A file argument of "-" is the next file descriptor received with the command (see @ref cmd_exec).
+ * Failed commands result in "error <reason>", later commands still run.
+ * File buffers come from @ref buf_pool, so they stay warm between commands of any thread,
+ * other allocations of a command come from the arena of its context, released at once by the next command.
+ * Contexts hold buffers, so they must not be copied once used (one context per thread).
+ * Generally, command contexts should be zero-initialized before setting the configuration fields.
+ */
+typedef struct cmd_ctx
+{
+    log_t *log;                 /** logging context (NULL for none) */
+    const sha256hash_t *defkey; /** hash of key for commands without key argument (NULL to require one) */
+    cmd_cache_t *cache;         /** key hash cache, may be shared between threads (NULL for none) */
+    size_t bufsz;               /** buffer size of files opened by commands */
+    int cflags;                 /** extra fdio flags of files opened by commands (e.g. FDIO_AUTO) */
+    buf_arena_t arena;          /** scratch memory of the last command (e.g. result line), reset by the next */
+    buffer_t res;               /** result line of the last command */
+    size_t ncmds;               /** number of commands run */
+    size_t nfailed;             /** number of commands resulting in error */
+    size_t nhits;               /** number of key hashes found in cache */
+} cmd_ctx_t;
+
+/**
+ * @brief run one command
+ *
+ * @param[inout] ctx command context
+ * @param argc number of tokens (command name first)
+ * @param argv null-terminated tokens
+ * @param fds file descriptors for "-" arguments, in order (never closed)
+ * @param nfds number of file descriptors
+ * @param[out] sz length of the result line (including newline)
+ * @return result line (owned by context, valid until the next command), NULL if failed allocation
+ */
+const char *cmd_exec(cmd_ctx_t *ctx, size_t argc, char **argv, const int *fds, size_t nfds, size_t *sz);
+
+/**
+ * @brief run command lines of input until EOF, writing one result line per command to output
+ *
+ * Results are flushed whenever no more input is ready, so batches of pipelined commands share writes.
+ * Input ending inside quotes or after a backslash results in a last error line instead of a command.
+ * Nonblocking input is waited upon with @ref bio_wait.
+ *
+ * @param[inout] ctx command context
+ * @param[inout] in command stream
+ * @param[inout] out result stream
+ * @return number of commands run (check status of streams for error)
+ */
+size_t cmd_serve(cmd_ctx_t *ctx, bufferedio_t *in, bufferedio_t *out);
+
+/**
+ * @brief free memory of command context
+ *
+ * the result line, arena and counters will be cleared, configuration fields are kept
+ *
+ * @param[inout] ctx command context
+ */
+void cmd_ctx_free(cmd_ctx_t *ctx);
+
+/**
+ * @brief free memory of key hash cache
+ *
+ * the cache will be cleared and set to all 0
+ *
+ * @param[inout] cache key hash cache (no longer used by any thread)
+ */
+void cmd_cache_free(cmd_cache_t *cache);
+
+#endif
\ No newline at end of file
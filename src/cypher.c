@@ -5,19 +5,85 @@
 
 #include "cypher.h"
 
+#include <errno.h>
 #include <stdio.h>
 
+#define KEYSTREAM_WORDS 1024 /* multiple of 8 (keystream period in words) */
+
+size_t _read_wait(bufferedio_t *bio, void *data, size_t sz)
+{
+    /* nonblocking input, sleep until readable instead of taking short read as EOF */
+    size_t rsz = bio_read(bio, data, sz);
+    while (rsz < sz && bio_status(bio) == BIO_STATUS_WOULDBLOCK &&
+           (bio_wait(bio, BIO_WAIT_READ, -1) >= 0 || errno == EINTR))
+    {
+        rsz += bio_read(bio, (char *)data + rsz, sz - rsz);
+    }
+    return rsz;
+}
+
+size_t _write_wait(bufferedio_t *bio, const void *data, size_t sz)
+{
+    /* nonblocking output, sleep until writable instead of taking short write as failure */
+    size_t wsz = bio_write(bio, data, sz);
+    while (wsz < sz && bio_status(bio) == BIO_STATUS_WOULDBLOCK &&
+           (bio_wait(bio, BIO_WAIT_WRITE, -1) >= 0 || errno == EINTR))
+    {
+        wsz += bio_write(bio, (const char *)data + wsz, sz - wsz);
+    }
+    return wsz;
+}
+
+size_t _xor_zeros(bufferedio_t *bio_out, sha256hash_t *hash, size_t *i, size_t nwords)
+{
+    /* XOR of zero words is only the keystream, write it without any input */
+    uint32_t block[KEYSTREAM_WORDS];
+    size_t k;
+    for (k = 0; k < KEYSTREAM_WORDS; k++)
+    {
+        block[k] = hash->words[(*i + 1 + k) % 8];
+    }
+    size_t rv = 0;
+    while (nwords)
+    {
+        const size_t n = nwords < KEYSTREAM_WORDS ? nwords : KEYSTREAM_WORDS;
+        const size_t wsz = _write_wait(bio_out, block, n * sizeof(uint32_t));
+        rv += wsz;
+        if (wsz != n * sizeof(uint32_t))
+        {
+            break;
+        }
+        nwords -= n;
+    }
+    *i = (*i + rv / sizeof(uint32_t)) % 8;
+    return rv;
+}
+
 size_t cypher_xor(bufferedio_t *bio_in, sha256hash_t *hash, bufferedio_t *bio_out)
 {
     size_t rv = 0;
     size_t i = 0;
     while (1)
     {
-        uint32_t word;
-        const size_t rsz = bio_read(bio_in, &word, sizeof(word));
+        uint32_t word = 0;
+        size_t rsz = 0;
+        const size_t hsz = bio_hole(bio_in, ~(size_t)0);
+        if (hsz)
+        {
+            /* skip holes in input, only trailing bytes of partial word are read */
+            const size_t ksz = (hsz / sizeof(word)) * sizeof(word);
+            const size_t wsz = _xor_zeros(bio_out, hash, &i, hsz / sizeof(word));
+            rv += wsz;
+            if (wsz != ksz)
+            {
+                break;
+            }
+            rsz = hsz - ksz;
+        }
+        rsz += _read_wait(bio_in, (char *)&word + rsz, sizeof(word) - rsz);
         i = (i + 1) % 8;
         word ^= hash->words[i];
-        const size_t wsz = rsz ? bio_write(bio_out, &word, rsz) : 0;
+        const size_t wsz = rsz ? _write_wait(bio_out, &word, rsz) : 0;
         rv += wsz;
         if (!(wsz && wsz == rsz))
         {
@@ -0,0 +1,376 @@
+/**
+ * @file daemon.c
+ * @author Rob Griffith
+ */
+
+#define _GNU_SOURCE /* accept4, MSG_CMSG_CLOEXEC */
+
+#include "daemon.h"
+#include "tokenize.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define DAEMON_BACKLOG 128
+
+typedef struct _daemon
+{
+    int lfd;        /* listening socket */
+    int epfd;       /* epoll instance shared by all workers */
+    int sfd;        /* signalfd of SIGINT and SIGTERM */
+    int stop;       /* set once signaled, workers exit */
+    buffer_t conns; /* file descriptors of open connections */
+    int lock;       /* spin lock held while conns changes */
+} _daemon_t;
+
+typedef struct _daemon_worker
+{
+    cmd_ctx_t ctx;    /* configuration copy, result line and counters of this worker */
+    tkz_dfa_t dfa;    /* parser of request messages */
+    _daemon_t *d;
+    pthread_t thread;
+    int started;
+} _daemon_worker_t;
+
+void _daemon_lock(_daemon_t *d)
+{
+    while (__atomic_test_and_set(&d->lock, __ATOMIC_ACQUIRE))
+    {
+        /* held only for a push or a removal */
+    }
+}
+
+void _daemon_unlock(_daemon_t *d)
+{
+    __atomic_clear(&d->lock, __ATOMIC_RELEASE);
+}
+
+int _daemon_arm(_daemon_t *d, int fd, int op)
+{
+    /* one shot, so only one worker at a time handles a connection */
+    struct epoll_event ev = {EPOLLIN | EPOLLONESHOT, {0}};
+    ev.data.fd = fd;
+    return epoll_ctl(d->epfd, op, fd, &ev);
+}
+
+void _daemon_close(_daemon_t *d, int fd)
+{
+    _daemon_lock(d);
+    int *conns = d->conns.data;
+    const size_t n = d->conns.size / sizeof(int);
+    size_t i;
+    for (i = 0; i < n; i++)
+    {
+        if (conns[i] == fd)
+        {
+            conns[i] = conns[n - 1];
+            d->conns.size -= sizeof(int);
+            break;
+        }
+    }
+    _daemon_unlock(d);
+    close(fd);
+}
+
+void _daemon_accept(_daemon_t *d)
+{
+    int fd;
+    while ((fd = accept4(d->lfd, NULL, NULL, SOCK_CLOEXEC)) >= 0)
+    {
+        _daemon_lock(d);
+        const size_t pushed = buf_push(&d->conns, &fd, sizeof(int));
+        _daemon_unlock(d);
+        if (!pushed)
+        {
+            close(fd);
+        }
+        else if (_daemon_arm(d, fd, EPOLL_CTL_ADD) < 0)
+        {
+            _daemon_close(d, fd);
+        }
+    }
+    _daemon_arm(d, d->lfd, EPOLL_CTL_MOD);
+}
+
+int _daemon_blank(const char *p, size_t sz)
+{
+    /* only whitespace (e.g. blank lines after the command) */
+    size_t i;
+    for (i = 0; i < sz; i++)
+    {
+        if (p[i] != ' ' && (unsigned char)(p[i] - '\t') > '\r' - '\t')
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int _daemon_request(_daemon_worker_t *w, int fd)
+{
+    /* one command per message, with the file descriptors it uses */
+    char data[DAEMON_MSGSZ];
+    union
+    {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(DAEMON_MAXFDS * sizeof(int))];
+    } ctl;
+    struct iovec iov = {data, sizeof(data)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    int fds[DAEMON_MAXFDS];
+    size_t nfds = 0;
+    size_t i, sz, used;
+    const ssize_t n = recvmsg(fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (n <= 0)
+    {
+        /* closed by client or failed, spurious wakeups keep connection */
+        return n < 0 && (errno == EAGAIN || errno == EINTR);
+    }
+    struct cmsghdr *c;
+    for (c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+    {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+        {
+            const size_t k = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (i = 0; i < k && nfds < DAEMON_MAXFDS; i++)
+            {
+                memcpy(fds + nfds++, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            }
+        }
+    }
+    const char *res = NULL;
+    int rejected = 1; /* answered without running the command */
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+    {
+        res = "error request too large\n";
+        sz = strlen(res);
+    }
+    else
+    {
+        int status = tkz_feed(&w->dfa, data, (size_t)n, &used);
+        status = status == TKZ_MORE ? tkz_feed_eof(&w->dfa) : status;
+        char **argv = NULL;
+        const size_t argc = status == TKZ_LINE ? tkz_argv(&w->dfa, &argv) : 0;
+        if (status == TKZ_LINE && used < (size_t)n && !_daemon_blank(data + used, (size_t)n - used))
+        {
+            /* never run only part of a request */
+            res = "error more than one command in request\n";
+            sz = strlen(res);
+        }
+        else if (status == TKZ_ERROR)
+        {
+            res = errno == EINVAL ? "error unterminated quote or escape\n" : "error failed allocation\n";
+            sz = strlen(res);
+            /* parser state of a failed request never carries over to the next one */
+            tkz_dfa_free(&w->dfa);
+        }
+        else
+        {
+            res = cmd_exec(&w->ctx, argc, argv, fds, nfds, &sz);
+            rejected = 0;
+        }
+    }
+    if (rejected)
+    {
+        /* rejected without running, still a failed command of the exit summary */
+        w->ctx.ncmds++;
+        w->ctx.nfailed++;
+    }
+    for (i = 0; i < nfds; i++)
+    {
+        close(fds[i]);
+    }
+    if (!res)
+    {
+        res = "error failed allocation\n";
+        sz = strlen(res);
+    }
+    /* clients not reading their results are dropped instead of stalling a worker */
+    return send(fd, res, sz, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)sz;
+}
+
+void *_daemon_work(void *arg)
+{
+    _daemon_worker_t *w = arg;
+    _daemon_t *d = w->d;
+    struct epoll_event ev;
+    while (!__atomic_load_n(&d->stop, __ATOMIC_ACQUIRE))
+    {
+        const int n = epoll_wait(d->epfd, &ev, 1, -1);
+        if (n < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (n <= 0)
+        {
+            continue;
+        }
+        if (ev.data.fd == d->sfd)
+        {
+            /* level triggered, wakes every worker */
+            __atomic_store_n(&d->stop, 1, __ATOMIC_RELEASE);
+        }
+        else if (ev.data.fd == d->lfd)
+        {
+            _daemon_accept(d);
+        }
+        else if (_daemon_request(w, ev.data.fd))
+        {
+            _daemon_arm(d, ev.data.fd, EPOLL_CTL_MOD);
+        }
+        else
+        {
+            _daemon_close(d, ev.data.fd);
+        }
+    }
+    return NULL;
+}
+
+int _daemon_bind(int fd, const struct sockaddr_un *addr)
+{
+    if (bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0)
+    {
+        return 1;
+    }
+    if (errno != EADDRINUSE)
+    {
+        return 0;
+    }
+    /* replace socket file only if no daemon accepts on it */
+    const int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    const int stale = probe >= 0 && connect(probe, (const struct sockaddr *)addr, sizeof(*addr)) < 0 &&
+                      errno == ECONNREFUSED;
+    if (probe >= 0)
+    {
+        close(probe);
+    }
+    if (!stale)
+    {
+        errno = EADDRINUSE;
+        return 0;
+    }
+    unlink(addr->sun_path);
+    return bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+}
+
+int daemon_serve(const char *path, size_t nworkers, cmd_ctx_t *conf)
+{
+    _daemon_t d = {-1, -1, -1, 0, {0}, 0};
+    _daemon_worker_t *workers = NULL;
+    struct sockaddr_un addr = {0};
+    struct sigaction ign = {0}, oldpipe;
+    sigset_t mask, oldmask;
+    int rv = 0, bound = 0, err = 0;
+    size_t i, nstarted = 0;
+    /* signals read from signalfd by workers, inherited mask of threads created below */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+    ign.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ign, &oldpipe);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        goto error;
+    }
+    strcpy(addr.sun_path, path);
+    d.lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (d.lfd < 0 || !(bound = _daemon_bind(d.lfd, &addr)) || listen(d.lfd, DAEMON_BACKLOG) < 0)
+    {
+        goto error;
+    }
+    d.epfd = epoll_create1(EPOLL_CLOEXEC);
+    d.sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    struct epoll_event ev = {EPOLLIN, {0}};
+    ev.data.fd = d.sfd;
+    if (d.epfd < 0 || d.sfd < 0 || epoll_ctl(d.epfd, EPOLL_CTL_ADD, d.sfd, &ev) < 0 ||
+        _daemon_arm(&d, d.lfd, EPOLL_CTL_ADD) < 0)
+    {
+        goto error;
+    }
+    workers = calloc(nworkers ? nworkers : 1, sizeof(_daemon_worker_t));
+    if (!workers)
+    {
+        goto error;
+    }
+    for (i = 0; i < nworkers; i++)
+    {
+        /* configuration only, buffers of every worker filled in place */
+        workers[i].ctx.log = conf->log;
+        workers[i].ctx.defkey = conf->defkey;
+        workers[i].ctx.cache = conf->cache;
+        workers[i].ctx.bufsz = conf->bufsz;
+        workers[i].ctx.cflags = conf->cflags;
+        workers[i].d = &d;
+        workers[i].started = pthread_create(&workers[i].thread, NULL, &_daemon_work, workers + i) == 0;
+        nstarted += workers[i].started;
+    }
+    if (!nstarted)
+    {
+        errno = EAGAIN;
+        goto error;
+    }
+    for (i = 0; i < nworkers; i++)
+    {
+        if (workers[i].started)
+        {
+            pthread_join(workers[i].thread, NULL);
+        }
+        conf->ncmds += workers[i].ctx.ncmds;
+        conf->nfailed += workers[i].ctx.nfailed;
+        conf->nhits += workers[i].ctx.nhits;
+        cmd_ctx_free(&workers[i].ctx);
+        tkz_dfa_free(&workers[i].dfa);
+    }
+    rv = 1;
+    goto end;
+error:
+    err = errno;
+end:
+    free(workers);
+    for (i = 0; i < d.conns.size / sizeof(int); i++)
+    {
+        close(((int *)d.conns.data)[i]);
+    }
+    buf_free(&d.conns);
+    if (d.sfd >= 0)
+    {
+        /* consume the stopping signal, so it is not delivered once unblocked */
+        struct signalfd_siginfo si;
+        while (read(d.sfd, &si, sizeof(si)) > 0)
+        {
+            /* drained */
+        }
+        close(d.sfd);
+    }
+    if (d.epfd >= 0)
+    {
+        close(d.epfd);
+    }
+    if (d.lfd >= 0)
+    {
+        close(d.lfd);
+    }
+    if (bound)
+    {
+        unlink(path);
+    }
+    sigaction(SIGPIPE, &oldpipe, NULL);
+    pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+    errno = err;
+    return rv;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+/**
+ * @file daemon.h
+ * @author Rob Griffith
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "command.h"
+
+/**
+ * @def DAEMON_MSGSZ
+ * @brief largest request message (one command line) accepted by @ref daemon_serve
+ */
+#define DAEMON_MSGSZ 4096
+
+/**
+ * @def DAEMON_MAXFDS
+ * @brief most file descriptors received with one request message
+ */
+#define DAEMON_MAXFDS 8
+
+/**
+ * @brief serve commands of clients connected to Unix domain socket until SIGINT or SIGTERM
+ *
+ * The socket is SOCK_SEQPACKET, each request message is one command line (see @ref cmd_ctx_t)
+ * and is answered by one result line message, requests of one connection are run in order.
+ * Requests holding more than one command line are answered with an error instead of being run.
+ * File descriptors sent with a request (SCM_RIGHTS) stand in for its "-" file arguments, in order,
+ * and are closed once the command completes (the client keeps its own copies).
+ * A pool of worker threads waits on all connections at once (epoll(7)), any idle worker runs the next request,
+ * sharing the key hash cache of the configuration and buffers of @ref buf_pool.
+ * A stale socket file (no daemon accepting) is replaced, the socket file is removed upon return.
+ * SIGINT and SIGTERM are handled while serving (signalfd(2)), SIGPIPE is ignored.
+ * Signals must be blocked in other threads of the process (e.g. the background log thread does).
+ *
+ * @param path socket file path
+ * @param nworkers number of worker threads
+ * @param[inout] conf configuration copied by every worker, counters of all workers are added to it
+ * @return 1 if served until signaled, 0 if failed to start (errno set)
+ */
+int daemon_serve(const char *path, size_t nworkers, cmd_ctx_t *conf);
+
+#endif
\ No newline at end of file
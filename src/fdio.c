@@ -3,23 +3,52 @@
  * @author Rob Griffith
  */
 
+#define _GNU_SOURCE /* O_TMPFILE */
+
 #include "fdio.h"
+#include "bstring.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#define FDIO_AUTO_MIN 4096      /* smallest automatically chosen buffer size */
+#define FDIO_AUTO_MAX (4 << 20) /* largest automatically chosen buffer size */
+#define FDIO_AUTO_WINDOW 8      /* number of full buffer system calls measured per size */
+#define FDIO_ALIGN 64           /* alignment of buffers smaller than a page (cache line) */
+
 typedef struct _fdio_opqd
 {
     int fd;
     int err;
     int clfags;
+    int wbuf;         /* buffer holds pending writes, otherwise bytes read ending at pos */
+    off_t pos;        /* file offset of fd (-1 if unseekable) */
+    off_t data;       /* start of data region following pos (pos < data is a hole) if FDIO_SPARSE */
+    off_t hole;       /* start of hole region following data if FDIO_SPARSE */
+    size_t tune_cap;    /* capacity to apply once buffer is empty (0 if none) if FDIO_AUTO */
+    size_t tune_n;      /* number of full buffer system calls measured in window if FDIO_AUTO */
+    size_t tune_bytes;  /* bytes transferred in window if FDIO_AUTO */
+    uint64_t tune_ns;   /* nanoseconds blocked in window if FDIO_AUTO */
+    uint64_t tune_prev; /* throughput (bytes per ms) of previous window if FDIO_AUTO */
+    buffer_t path;    /* destination path if FDIO_ATOMIC */
+    buffer_t tmppath; /* named temporary file if FDIO_ATOMIC without O_TMPFILE */
 } _fdio_opqd_t;
 
 int _fdio_status(const bio_data_t *bd)
 {
     const _fdio_opqd_t *opqd = bd->opaque.data;
+    if (opqd && (opqd->err == EAGAIN || opqd->err == EWOULDBLOCK))
+    {
+        /* nonblocking descriptor not ready, not an error */
+        return BIO_STATUS_WOULDBLOCK;
+    }
     if (opqd && opqd->err)
     {
         return BIO_STATUS_INIT - opqd->err;
@@ -37,13 +66,23 @@ void _fdio_status_str(const bio_data_t *bd, char *str, size_t n)
         strncpy(str, "uninitialized, no file descriptor", n);
         return;
     }
-    int rv = snprintf(str, n, "{fd: %d, bufsz: %zu}", opqd->fd, bd->buf.capacity);
+    int rv = snprintf(str, n, "{fd: %d, bufsz: %zu%s}", opqd->fd, bd->buf.capacity, (opqd->clfags & FDIO_AUTO) ? " (auto)" : "");
     if (rv < 0)
     {
         goto end;
     }
     n -= (size_t)rv;
     str += (size_t)rv;
+    if (opqd->clfags & FDIO_ATOMIC)
+    {
+        rv = snprintf(str, n, ", uncommitted");
+        if (rv < 0)
+        {
+            goto end;
+        }
+        n -= (size_t)rv < n ? (size_t)rv : n;
+        str += (size_t)rv;
+    }
     if (opqd->err)
     {
         rv = snprintf(str, n, ", error: %s", strerror(opqd->err));
@@ -56,6 +95,225 @@ end:
     }
 }
 
+int _fdio_sparse_locate(bio_data_t *bd)
+{
+    /* find hole [pos, data) and data [data, hole) regions, querying only when pos leaves them */
+    _fdio_opqd_t *opqd = bd->opaque.data;
+    if (opqd->pos < opqd->hole)
+    {
+        return 1;
+    }
+    const uint64_t t = bio_clock_ns();
+    off_t data = lseek(opqd->fd, opqd->pos, SEEK_DATA);
+    off_t hole = data;
+    if (data < 0 && errno == ENXIO)
+    {
+        /* no data after pos, hole extends to EOF */
+        struct stat st;
+        data = fstat(opqd->fd, &st) < 0 ? -1 : (st.st_size > opqd->pos ? st.st_size : opqd->pos);
+        hole = data;
+    }
+    else if (data >= 0)
+    {
+        hole = lseek(opqd->fd, data, SEEK_HOLE);
+    }
+    /* restore file offset moved by SEEK_DATA and SEEK_HOLE */
+    const off_t pos = lseek(opqd->fd, opqd->pos, SEEK_SET);
+    bd->stats.nsyscall += 3;
+    bd->stats.blocked_ns += bio_clock_ns() - t;
+    if (pos < 0 || data < 0 || hole < 0)
+    {
+        /* holes unsupported, treat as dense file */
+        opqd->clfags &= ~FDIO_SPARSE;
+        return 0;
+    }
+    opqd->data = data;
+    opqd->hole = hole;
+    return 1;
+}
+
+size_t _fdio_sysread(bio_data_t *bd, void *data, size_t sz)
+{
+    /* single underlying read, synthesizing holes of sparse files without reading them */
+    _fdio_opqd_t *opqd = bd->opaque.data;
+    if ((opqd->clfags & FDIO_SPARSE) && _fdio_sparse_locate(bd))
+    {
+        if (opqd->pos < opqd->data)
+        {
+            const size_t hsz = (size_t)(opqd->data - opqd->pos);
+            const size_t osz = hsz < sz ? hsz : sz;
+            const off_t rv = lseek(opqd->fd, opqd->pos + (off_t)osz, SEEK_SET);
+            bd->stats.nsyscall++;
+            opqd->err = rv < 0 ? errno : 0;
+            if (rv < 0)
+            {
+                return 0;
+            }
+            memset(data, 0, osz);
+            opqd->pos = rv;
+            return osz;
+        }
+        /* never read past start of next hole */
+        const size_t dsz = (size_t)(opqd->hole - opqd->pos);
+        sz = dsz < sz ? dsz : sz;
+    }
+    const uint64_t t = bio_clock_ns();
+    ssize_t rv;
+    do
+    {
+        /* interrupted before any bytes were read, retry */
+        rv = read(opqd->fd, data, sz);
+    } while (rv < 0 && errno == EINTR);
+    opqd->err = rv < 0 ? errno : 0;
+    bio_stats_sysio(&bd->stats, 0, sz, rv, t);
+    opqd->pos += rv < 0 || opqd->pos < 0 ? 0 : (off_t)rv;
+    return rv < 0 ? 0 : (size_t)rv;
+}
+
+size_t _fdio_syswrite(bio_data_t *bd, const void *data, size_t sz)
+{
+    /* single underlying write */
+    _fdio_opqd_t *opqd = bd->opaque.data;
+    const uint64_t t = bio_clock_ns();
+    ssize_t rv;
+    do
+    {
+        /* interrupted before any bytes were written, retry */
+        rv = write(opqd->fd, data, sz);
+    } while (rv < 0 && errno == EINTR);
+    opqd->err = rv < 0 ? errno : 0;
+    bio_stats_sysio(&bd->stats, 1, sz, rv, t);
+    opqd->pos += rv < 0 || opqd->pos < 0 ? 0 : (off_t)rv;
+    return rv < 0 ? 0 : (size_t)rv;
+}
+
+off_t _fdio_syslseek(bio_data_t *bd, off_t offset, int whence)
+{
+    /* move file offset, forgetting located sparse regions (only valid moving forward) */
+    _fdio_opqd_t *opqd = bd->opaque.data;
+    const off_t rv = lseek(opqd->fd, offset, whence);
+    bd->stats.nsyscall++;
+    opqd->err = rv < 0 ? errno : 0;
+    if (rv >= 0)
+    {
+        opqd->pos = rv;
+        opqd->data = rv;
+        opqd->hole = rv;
+    }
+    return rv;
+}
+
+int _fdio_unread(bio_data_t *bd)
+{
+    /* drop read bytes from buffer, moving file offset back over unconsumed ones */
+    _fdio_opqd_t *opqd = bd->opaque.data;
+    const size_t rsz = bd->buf.size - bd->offset;
+    if (rsz && _fdio_syslseek(bd, opqd->pos - (off_t)rsz, SEEK_SET) < 0)
+    {
+        return 0;
+    }
+    buf_clear(&bd->buf);
+    bd->offset = 0;
+    return 1;
+}
+
+void _fdio_tune_apply(bio_data_t *bd)
+{
+    /* only resize empty buffer, never moving buffered bytes */
+    _fdio_opqd_t *opqd = bd->opaque.data;
+    const size_t cap = bd->buf.capacity;
+    if (opqd->tune_cap && opqd->tune_cap != cap && bd->buf.size == 0)
+    {
+        if (!buf_init(&bd->buf, opqd->tune_cap))
+        {
+            buf_init(&bd->buf, cap);
+        }
+    }
+    opqd->tune_cap = 0;
+}
+
+void _fdio_tune_sample(bio_data_t *bd, size_t sz, size_t osz, uint64_t ns)
+{
+    /* adjust capacity by throughput of full buffer system calls, settling once it stops improving */
+    _fdio_opqd_t *opqd = bd->opaque.data;
+    const size_t cap = bd->buf.capacity;
+    if (!(opqd->clfags & FDIO_AUTO) || !sz)
+    {
+        return;
+    }
+    if (osz < sz)
+    {
+        /* source or destination moves less per call than buffered, larger buffer would not help */
+        opqd->clfags &= ~FDIO_AUTO;
+        return;
+    }
+    opqd->tune_bytes += osz;
+    opqd->tune_ns += ns;
+    if (++opqd->tune_n < FDIO_AUTO_WINDOW)
+    {
+        return;
+    }
+    const uint64_t tput = (uint64_t)opqd->tune_bytes * 1000000 / (opqd->tune_ns ? opqd->tune_ns : 1);
+    if (!opqd->tune_prev || tput > opqd->tune_prev + opqd->tune_prev / 10)
+    {
+        /* still improving, try doubling */
+        opqd->tune_prev = tput;
+        if (cap * 2 <= FDIO_AUTO_MAX)
+        {
+            opqd->tune_cap = cap * 2;
+        }
+        else
+        {
+            opqd->clfags &= ~FDIO_AUTO;
+        }
+    }
+    else
+    {
+        /* no better than previous size, revert if worse and stop adjusting */
+        opqd->tune_cap = tput < opqd->tune_prev - opqd->tune_prev / 10 ? cap / 2 : 0;
+        opqd->clfags &= ~FDIO_AUTO;
+    }
+    opqd->tune_n = 0;
+    opqd->tune_bytes = 0;
+    opqd->tune_ns = 0;
+}
+
+void _fdio_flush(bio_data_t *bd)
+{
+    /* write pending bytes, read bytes stay buffered (nothing to flush) */
+    _fdio_opqd_t *opqd = bd->opaque.data;
+    if (!opqd->wbuf)
+    {
+        return;
+    }
+    if (bd->offset < bd->buf.size)
+    {
+        bd->stats.nflush++;
+        bd->offset += _fdio_syswrite(bd, (const char *)bd->buf.data + bd->offset, bd->buf.size - bd->offset);
+    }
+    if (bd->offset < bd->buf.size)
+    {
+        /* keep unwritten bytes pending */
+        return;
+    }
+    buf_clear(&bd->buf);
+    bd->offset = 0;
+    opqd->wbuf = 0;
+}
+
+size_t _fdio_refill(bio_data_t *bd)
+{
+    /* replace drained read buffer with bytes of one underlying read */
+    bd->offset = 0;
+    bd->stats.nrefill++;
+    buf_clear(&bd->buf);
+    _fdio_tune_apply(bd);
+    const uint64_t ns = bd->stats.blocked_ns;
+    const size_t rsz = buf_resize(&bd->buf, _fdio_sysread(bd, bd->buf.data, bd->buf.capacity));
+    _fdio_tune_sample(bd, bd->buf.capacity, rsz, bd->stats.blocked_ns - ns);
+    return rsz;
+}
+
 size_t _fdio_read(bio_data_t *bd, void *data, size_t sz)
 {
     /*
@@ -65,6 +323,15 @@ size_t _fdio_read(bio_data_t *bd, void *data, size_t sz)
     up to caller of bio_read to check errno
     */
     _fdio_opqd_t *opqd = bd->opaque.data;
+    if (opqd->wbuf)
+    {
+        /* switching from writing, pending writes land before reading */
+        _fdio_flush(bd);
+        if (opqd->wbuf)
+        {
+            return 0;
+        }
+    }
     size_t rsz = bd->buf.size - bd->offset;
     size_t osz;
     if (sz > rsz + bd->buf.capacity)
@@ -73,19 +340,13 @@ size_t _fdio_read(bio_data_t *bd, void *data, size_t sz)
         memcpy(data, (const char *)bd->buf.data + bd->offset, rsz);
         bd->offset = 0;
         buf_clear(&bd->buf);
-        const ssize_t rv = read(opqd->fd, (char *)data + rsz, sz - rsz);
-        opqd->err = rv < 0 ? errno : 0;
-        osz = rsz + (rv < 0 ? 0 : (size_t)rv);
+        osz = rsz + _fdio_sysread(bd, (char *)data + rsz, sz - rsz);
     }
     else
     {
         if (!rsz)
         {
-            /* refill buffer */
-            bd->offset = 0;
-            const ssize_t rv = read(opqd->fd, bd->buf.data, bd->buf.capacity);
-            opqd->err = rv < 0 ? errno : 0;
-            rsz = buf_resize(&bd->buf, rv < 0 ? 0 : (size_t)rv);
+            rsz = _fdio_refill(bd);
         }
         osz = rsz < sz ? rsz : sz;
         memcpy(data, (const char *)bd->buf.data + bd->offset, osz);
@@ -94,6 +355,36 @@ size_t _fdio_read(bio_data_t *bd, void *data, size_t sz)
     return osz;
 }
 
+const void *_fdio_peek(bio_data_t *bd, size_t *sz)
+{
+    /* buffered bytes in place, refilled once when drained (unbuffered contexts cannot peek) */
+    _fdio_opqd_t *opqd = bd->opaque.data;
+    if (opqd->wbuf)
+    {
+        _fdio_flush(bd);
+        if (opqd->wbuf)
+        {
+            return NULL;
+        }
+    }
+    if (!bd->buf.capacity)
+    {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    *sz = bd->buf.size - bd->offset;
+    if (!*sz)
+    {
+        *sz = _fdio_refill(bd);
+    }
+    return *sz ? (const char *)bd->buf.data + bd->offset : NULL;
+}
+
+void _fdio_consume(bio_data_t *bd, size_t sz)
+{
+    bd->offset += sz;
+}
+
 size_t _fdio_write(bio_data_t *bd, const void *data, size_t sz)
 {
     /*
@@ -103,15 +394,30 @@ size_t _fdio_write(bio_data_t *bd, const void *data, size_t sz)
     up to caller of bio_read to check errno
     */
     _fdio_opqd_t *opqd = bd->opaque.data;
+    if (!opqd->wbuf)
+    {
+        /* switching from reading, write where reading left off */
+        if (!_fdio_unread(bd))
+        {
+            return 0;
+        }
+        opqd->wbuf = 1;
+    }
     const size_t cap = bd->buf.capacity;
     size_t wsz = cap - bd->buf.size;
     size_t osz;
     if (!wsz || sz > wsz + cap)
     {
         /* flush buffer */
-        ssize_t rv = write(opqd->fd, (const char *)bd->buf.data + bd->offset, bd->buf.size - bd->offset);
-        opqd->err = rv < 0 ? errno : 0;
-        bd->offset += rv < 0 ? 0 : (size_t)rv;
+        if (bd->offset < bd->buf.size)
+        {
+            const size_t fsz = bd->buf.size - bd->offset;
+            const uint64_t ns = bd->stats.blocked_ns;
+            bd->stats.nflush++;
+            const size_t fosz = _fdio_syswrite(bd, (const char *)bd->buf.data + bd->offset, fsz);
+            bd->offset += fosz;
+            _fdio_tune_sample(bd, fsz, fosz, bd->stats.blocked_ns - ns);
+        }
         if (bd->offset < bd->buf.size)
         {
             /* failed to write entire buffer */
@@ -120,15 +426,14 @@ size_t _fdio_write(bio_data_t *bd, const void *data, size_t sz)
         }
         buf_clear(&bd->buf);
         bd->offset = 0;
+        _fdio_tune_apply(bd);
         if (sz > wsz + cap)
         {
             /* write directly */
-            rv = write(opqd->fd, data, sz);
-            opqd->err = rv < 0 ? errno : 0;
-            osz = rv < 0 ? 0 : (size_t)rv;
+            osz = _fdio_syswrite(bd, data, sz);
             goto end;
         }
-        wsz = cap;
+        wsz = bd->buf.capacity;
     }
     /* push to buffer, never increasing capacity */
     osz = buf_push(&bd->buf, data, wsz < sz ? wsz : sz);
@@ -136,25 +441,152 @@ end:
     return osz;
 }
 
-void _fdio_flush(bio_data_t *bd)
+ssize_t _fdio_seek(bio_data_t *bd, long offset, int whence)
 {
-    /* flush buffer (should be invoked before seek) */
     _fdio_opqd_t *opqd = bd->opaque.data;
-    const ssize_t rv = write(opqd->fd, (const char *)bd->buf.data + bd->offset, bd->buf.size - bd->offset);
-    opqd->err = rv < 0 ? errno : 0;
-    buf_clear(&bd->buf);
-    bd->offset = 0;
+    _fdio_flush(bd);
+    if (opqd->wbuf)
+    {
+        /* never drop pending writes */
+        return -1;
+    }
+    /* read bytes buffered are the file bytes [pos - size, pos), current position is offset into them */
+    const off_t start = opqd->pos - (off_t)bd->buf.size;
+    const off_t cur = start + (off_t)bd->offset;
+    if (opqd->pos >= 0 && whence != SEEK_END)
+    {
+        const off_t target = whence == SEEK_CUR ? cur + offset : offset;
+        if (target >= start && target <= opqd->pos)
+        {
+            /* within buffered window, no system call */
+            bd->offset = (size_t)(target - start);
+            opqd->err = 0;
+            return (ssize_t)target;
+        }
+        /* relative to consumed bytes, not to file offset past buffered bytes */
+        offset = whence == SEEK_CUR ? cur + offset : offset;
+        whence = SEEK_SET;
+    }
+    const off_t rv = _fdio_syslseek(bd, offset, whence);
+    if (rv >= 0)
+    {
+        buf_clear(&bd->buf);
+        bd->offset = 0;
+    }
+    return (ssize_t)rv;
 }
 
-ssize_t _fdio_seek(bio_data_t *bd, long offset, int whence)
+int _fdio_wait(bio_data_t *bd, int events, int timeout)
 {
-    /* not much choice, drop buffer on the floor */
-    buf_clear(&bd->buf);
-    bd->offset = 0;
+    /* buffered bytes ready without polling, otherwise sleep in poll(2) */
+    const _fdio_opqd_t *opqd = bd->opaque.data;
+    int ready = 0;
+    if ((events & BIO_WAIT_READ) && !opqd->wbuf && bd->offset < bd->buf.size)
+    {
+        ready |= BIO_WAIT_READ;
+    }
+    if ((events & BIO_WAIT_WRITE) && (!opqd->wbuf || bd->buf.size < bd->buf.capacity))
+    {
+        /* room in buffer (pending read bytes are dropped when writing) */
+        ready |= bd->buf.capacity ? BIO_WAIT_WRITE : 0;
+    }
+    if (ready)
+    {
+        return ready;
+    }
+    struct pollfd pfd = {opqd->fd, 0, 0};
+    pfd.events |= (events & BIO_WAIT_READ) ? POLLIN : 0;
+    pfd.events |= (events & BIO_WAIT_WRITE) ? POLLOUT : 0;
+    const uint64_t t = bio_clock_ns();
+    const int rv = poll(&pfd, 1, timeout);
+    bd->stats.nsyscall++;
+    bd->stats.blocked_ns += bio_clock_ns() - t;
+    if (rv <= 0)
+    {
+        return rv;
+    }
+    /* hangup and errors are ready, the next read or write reports them */
+    ready |= (pfd.revents & (POLLIN | POLLHUP | POLLERR)) && (events & BIO_WAIT_READ) ? BIO_WAIT_READ : 0;
+    ready |= (pfd.revents & (POLLOUT | POLLHUP | POLLERR)) && (events & BIO_WAIT_WRITE) ? BIO_WAIT_WRITE : 0;
+    return ready;
+}
+
+ssize_t _fdio_pread(bio_data_t *bd, void *data, size_t sz, off_t offset)
+{
+    /* shared state untouched except atomic counters, safe from several threads */
+    const _fdio_opqd_t *opqd = bd->opaque.data;
+    const uint64_t t = bio_clock_ns();
+    const ssize_t rv = pread(opqd->fd, data, sz, offset);
+    bio_stats_sysio(&bd->stats, 0, sz, rv, t);
+    return rv;
+}
+
+ssize_t _fdio_pwrite(bio_data_t *bd, const void *data, size_t sz, off_t offset)
+{
+    /* shared state untouched except atomic counters, safe from several threads */
+    const _fdio_opqd_t *opqd = bd->opaque.data;
+    const uint64_t t = bio_clock_ns();
+    const ssize_t rv = pwrite(opqd->fd, data, sz, offset);
+    bio_stats_sysio(&bd->stats, 1, sz, rv, t);
+    return rv;
+}
+
+int _fdio_size_hint(const bio_data_t *bd, size_t *sz)
+{
+    /* never drops buffered bytes, only queries the file descriptor */
+    const _fdio_opqd_t *opqd = bd->opaque.data;
+    if (!opqd)
+    {
+        *sz = 0;
+        return BIO_HINT_NONE;
+    }
+    /* pending writes are not readable, reading starts after them */
+    const size_t bsz = opqd->wbuf ? 0 : bd->buf.size - bd->offset;
+    struct stat st;
+    if (fstat(opqd->fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        const off_t pos = opqd->pos + (off_t)(opqd->wbuf ? bd->buf.size - bd->offset : 0);
+        if (opqd->pos >= 0)
+        {
+            *sz = bsz + (st.st_size > pos ? (size_t)(st.st_size - pos) : 0);
+            return BIO_HINT_EXACT;
+        }
+    }
+    int avail = 0;
+    if (ioctl(opqd->fd, FIONREAD, &avail) == 0 && avail > 0)
+    {
+        /* pipes and sockets, bytes ready now but more may follow */
+        *sz = bsz + (size_t)avail;
+        return BIO_HINT_MIN;
+    }
+    *sz = bsz;
+    return bsz ? BIO_HINT_MIN : BIO_HINT_NONE;
+}
+
+size_t _fdio_hole(bio_data_t *bd, size_t max)
+{
+    /* only skip holes once buffered bytes are consumed */
     _fdio_opqd_t *opqd = bd->opaque.data;
-    off_t rv = lseek(opqd->fd, offset, whence);
-    opqd->err = rv == (long)-1 ? errno : 0;
-    return (ssize_t)rv;
+    if (!(opqd && (opqd->clfags & FDIO_SPARSE)) || bd->offset < bd->buf.size || !_fdio_sparse_locate(bd))
+    {
+        return 0;
+    }
+    if (opqd->pos >= opqd->data)
+    {
+        /* in data region */
+        return 0;
+    }
+    const size_t hsz = (size_t)(opqd->data - opqd->pos);
+    const size_t osz = hsz < max ? hsz : max;
+    const off_t rv = lseek(opqd->fd, opqd->pos + (off_t)osz, SEEK_SET);
+    bd->stats.nsyscall++;
+    opqd->err = rv < 0 ? errno : 0;
+    if (rv < 0)
+    {
+        return 0;
+    }
+    opqd->pos = rv;
+    return osz;
 }
 
 void _fdio_dfree(bio_data_t *bd)
@@ -170,22 +602,176 @@ void _fdio_dfree(bio_data_t *bd)
         {
             close(opqd->fd);
         }
+        if ((opqd->clfags & FDIO_ATOMIC) && opqd->tmppath.size)
+        {
+            /* never committed, discard named temporary file (O_TMPFILE vanishes on close) */
+            unlink(opqd->tmppath.data);
+        }
+        buf_free(&opqd->path);
+        buf_free(&opqd->tmppath);
     }
     buf_free(&bd->opaque);
     buf_free(&bd->buf);
 }
 
+size_t fdio_auto_bufsz(int fd)
+{
+    size_t sz = FDIO_AUTO_MIN;
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        return sz;
+    }
+    /* device preferred block size */
+    sz = (size_t)st.st_blksize > sz ? (size_t)st.st_blksize : sz;
+    if (S_ISFIFO(st.st_mode))
+    {
+        /* entire pipe capacity moved per call */
+        const int pipesz = fcntl(fd, F_GETPIPE_SZ);
+        sz = pipesz > 0 && (size_t)pipesz > sz ? (size_t)pipesz : sz;
+    }
+    else if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        /* no larger than file (rounded to block size), small files need not be buffered more */
+        const size_t blksz = st.st_blksize > 0 ? (size_t)st.st_blksize : FDIO_AUTO_MIN;
+        const size_t fsz = ((size_t)st.st_size + blksz - 1) / blksz * blksz;
+        sz = fsz < sz ? fsz : sz;
+    }
+    return sz < FDIO_AUTO_MAX ? sz : FDIO_AUTO_MAX;
+}
+
 void fdio_wrap(bufferedio_t *bio, int fd, size_t bufsz, int cflags)
 {
-    buf_init(&bio->data.buf, bufsz);
+    const int err = fd < 0 ? errno : 0;
+    /* page aligned (usable with O_DIRECT) once a page or larger, otherwise cache line aligned for copying */
+    const size_t sz = (cflags & FDIO_AUTO) ? fdio_auto_bufsz(fd) : bufsz;
+    const size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+    /* recycled through pool, whose blocks satisfy both alignments */
+    bio->data.buf.alloc = &buf_pool;
+    buf_init_aligned(&bio->data.buf, sz, sz >= pagesz ? pagesz : FDIO_ALIGN, BUF_HUGEPAGE);
     bio->data.offset = 0;
-    _fdio_opqd_t opqd = {fd, fd < 0 ? errno : 0, cflags};
+    _fdio_opqd_t opqd = {fd, err, cflags, 0, 0, 0, 0, 0, 0, 0, 0, 0, {0}, {0}};
+    /* file offset tracked from here on, seeking within buffer and locating holes rely on it */
+    opqd.pos = fd < 0 ? -1 : lseek(fd, 0, SEEK_CUR);
+    opqd.clfags &= opqd.pos < 0 ? ~FDIO_SPARSE : ~0;
+    opqd.data = opqd.pos;
+    opqd.hole = opqd.pos;
     buf_copy(&bio->data.opaque, &opqd, sizeof(_fdio_opqd_t));
     bio->status = &_fdio_status;
     bio->status_str = &_fdio_status_str;
     bio->read = &_fdio_read;
+    bio->peek = &_fdio_peek;
+    bio->consume = &_fdio_consume;
     bio->write = &_fdio_write;
     bio->flush = &_fdio_flush;
     bio->seek = &_fdio_seek;
+    bio->size_hint = &_fdio_size_hint;
+    bio->hole = &_fdio_hole;
+    bio->pread = &_fdio_pread;
+    bio->pwrite = &_fdio_pwrite;
+    bio->wait = &_fdio_wait;
     bio->dfree = &_fdio_dfree;
+}
+
+int _fdio_open_tmp(const char *path, int mode, buffer_t *tmppath)
+{
+    /* unnamed temporary file in same directory (same filesystem as destination) */
+    const char *slash = strrchr(path, '/');
+    buffer_t dir = {0};
+    if (slash)
+    {
+        buf_copy(&dir, path, (size_t)(slash - path) + 1);
+        bstr_concat(&dir, "");
+    }
+    int fd = open(slash ? (const char *)dir.data : ".", O_TMPFILE | O_WRONLY, mode);
+    buf_free(&dir);
+    if (fd < 0 && bstr_concat(tmppath, path) && bstr_concat(tmppath, ".XXXXXX"))
+    {
+        /* O_TMPFILE unsupported by filesystem, fall back to named temporary file */
+        fd = mkstemp(tmppath->data);
+        if (fd >= 0)
+        {
+            const mode_t mask = umask(0);
+            umask(mask);
+            fchmod(fd, mode & ~mask);
+        }
+    }
+    return fd;
+}
+
+void fdio_wrap_atomic(bufferedio_t *bio, const char *path, int mode, size_t bufsz, int cflags)
+{
+    buffer_t tmppath = {0};
+    const int fd = _fdio_open_tmp(path, mode, &tmppath);
+    fdio_wrap(bio, fd, bufsz, cflags | FDIO_CLOSE | FDIO_ATOMIC);
+    _fdio_opqd_t *opqd = bio->data.opaque.data;
+    if (opqd)
+    {
+        bstr_concat(&opqd->path, path);
+        buf_move(&opqd->tmppath, &tmppath);
+    }
+    buf_free(&tmppath);
+}
+
+int fdio_commit(bufferedio_t *bio)
+{
+    if (bio->write != &_fdio_write)
+    {
+        /* opaque data of other backends is not fdio's */
+        errno = EINVAL;
+        return 0;
+    }
+    _fdio_opqd_t *opqd = bio->data.opaque.data;
+    if (!opqd || opqd->fd < 0)
+    {
+        return 0;
+    }
+    _fdio_flush(&bio->data);
+    opqd->err = opqd->wbuf && !opqd->err ? EIO : opqd->err;
+    if (opqd->err || !(opqd->clfags & FDIO_ATOMIC))
+    {
+        return !opqd->err;
+    }
+    const char *path = opqd->path.data;
+    int rv;
+    if (opqd->tmppath.size)
+    {
+        rv = rename(opqd->tmppath.data, path);
+    }
+    else
+    {
+        /* link unnamed file to unique name, then atomically replace destination */
+        char procpath[64];
+        buffer_t linkpath = {0};
+        snprintf(procpath, sizeof(procpath), "/proc/self/fd/%d", opqd->fd);
+        unsigned int i = 0;
+        do
+        {
+            buf_clear(&linkpath);
+            if (!bstr_printf(&linkpath, "%s.%d.%u", path, (int)getpid(), i++))
+            {
+                errno = ENOMEM;
+                rv = -1;
+                break;
+            }
+            rv = linkat(AT_FDCWD, procpath, AT_FDCWD, linkpath.data, AT_SYMLINK_FOLLOW);
+        } while (rv < 0 && errno == EEXIST);
+        if (rv == 0)
+        {
+            rv = rename(linkpath.data, path);
+            if (rv < 0)
+            {
+                const int err = errno;
+                unlink(linkpath.data);
+                errno = err;
+            }
+        }
+        buf_free(&linkpath);
+    }
+    opqd->err = rv < 0 ? errno : 0;
+    if (!opqd->err)
+    {
+        opqd->clfags &= ~FDIO_ATOMIC;
+    }
+    return !opqd->err;
 }
\ No newline at end of file
@@ -14,9 +14,46 @@
  */
 #define FDIO_CLOSE 1
 
+/**
+ * @def FDIO_ATOMIC
+ * @brief file descriptor buffered I/O flag for an uncommitted temporary file (see @ref fdio_wrap_atomic)
+ */
+#define FDIO_ATOMIC 2
+
+/**
+ * @def FDIO_SPARSE
+ * @brief file descriptor buffered I/O flag for never reading holes of sparse files (SEEK_DATA/SEEK_HOLE)
+ *
+ * Holes are read as zeros synthesized in memory, or skipped entirely with @ref bio_hole.
+ * Ignored if fd is not seekable, only intended for reading.
+ */
+#define FDIO_SPARSE 4
+
+/**
+ * @def FDIO_AUTO
+ * @brief file descriptor buffered I/O flag for automatically sized buffer (see @ref fdio_auto_bufsz)
+ *
+ * The buffer size argument is ignored, the initial size is chosen by @ref fdio_auto_bufsz.
+ * While full buffers keep being read or written, the size is doubled as long as measured throughput per
+ * system call improves, then settles (reverting the last doubling if it made throughput worse).
+ */
+#define FDIO_AUTO 8
+
+/**
+ * @brief choose initial buffer size for file descriptor
+ *
+ * Starts from the preferred block size (st_blksize), raised to the capacity of pipes,
+ * and limited to the size of regular files rounded up to the block size.
+ *
+ * @param fd file descriptor
+ * @return buffer size in bytes
+ */
+size_t fdio_auto_bufsz(int fd);
+
 /**
  * @brief initialize buffered I/O context to wrap a given file descriptor
  *
+ * The buffer is drawn from (and returned to) @ref buf_pool.
  * Use @ref bio_status to check for sucessful initialization.
  *
  * @param[inout] bio buffered I/O context to use
@@ -26,4 +63,33 @@
  */
 void fdio_wrap(bufferedio_t *bio, int fd, size_t bufsz, int cflags);
 
+/**
+ * @brief initialize buffered I/O context to write a file atomically
+ *
+ * Bytes are written (with normal buffering) to an unnamed O_TMPFILE in the directory of path.
+ * If O_TMPFILE is unsupported, a uniquely named temporary file next to path is used instead.
+ * The file at path is left untouched until @ref fdio_commit succeeds.
+ * Freeing the context without committing discards all written bytes.
+ * Use @ref bio_status to check for sucessful initialization.
+ *
+ * @param[inout] bio buffered I/O context to use
+ * @param path the path of the file to (eventually) replace
+ * @param mode the mode of the created file (same as open(2))
+ * @param bufsz buffer size to use
+ * @param cflags additional flags for controlling buffering (@ref FDIO_CLOSE and @ref FDIO_ATOMIC always set)
+ */
+void fdio_wrap_atomic(bufferedio_t *bio, const char *path, int mode, size_t bufsz, int cflags);
+
+/**
+ * @brief flush and move file written atomically into place
+ *
+ * Only applies to contexts initialized with @ref fdio_wrap_atomic, other fdio contexts are only flushed.
+ * Contexts of other backends (e.g. sockio) are rejected with errno EINVAL.
+ * Linking or renaming over the destination path is atomic, readers see all or none of the bytes.
+ *
+ * @param[inout] bio buffered I/O context to commit
+ * @return > 0 if successful, 0 if failed (use @ref bio_status to check error)
+ */
+int fdio_commit(bufferedio_t *bio);
+
 #endif
\ No newline at end of file
@@ -6,15 +6,118 @@
 #include "log.h"
 #include "bstring.h"
 
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
+
+#define LOG_REC_MSGSZ 200 /* message bytes stored in queue slot, longer messages are allocated */
+#define LOG_WAKE_RECS 64  /* records consumed between wakes of producers waiting for slots */
+#define LOG_BIN_MAGIC "CYLOGB1\n"
+#define LOG_BIN_MAGICSZ 8
+#define LOG_BIN_HDRSZ 5     /* record type byte and 32-bit payload length */
+#define LOG_BIN_NDEFS 1024  /* strings remembered as defined (power of 2), others are defined with each use */
+
+typedef struct _log_time
+{
+    struct timespec wall; /* wall clock (CLOCK_REALTIME) */
+    uint64_t mono;        /* monotonic clock nanoseconds (CLOCK_MONOTONIC) */
+} _log_time_t;
+
+typedef struct _log_tcache
+{
+    time_t sec;   /* wall clock second of cached date */
+    size_t len;   /* length of cached date (0 if none) */
+    char str[32]; /* cached date, known max length of ctime_r string */
+} _log_tcache_t;
+
+typedef struct _log_rec
+{
+    size_t seq;       /* position when free, position + 1 once published */
+    _log_time_t t;    /* time of logging (taken by caller) */
+    int flags;        /* log flags when queued */
+    const char *file; /* NULL for bytes without prefix */
+    int line;
+    log_lvl_t lvl;
+    size_t len;             /* message length */
+    char *heap;             /* message too long for slot */
+    char msg[LOG_REC_MSGSZ]; /* message (not null terminated) */
+} _log_rec_t;
+
+typedef struct _log_async
+{
+    bufferedio_t out;      /* original output, only used by background thread */
+    buffer_t fmt;          /* prefix formatting buffer of background thread */
+    _log_rec_t *recs;      /* queue slots (bounded multi-producer single-consumer queue) */
+    size_t mask;           /* number of slots - 1 */
+    size_t enq;            /* next position claimed by producers */
+    size_t deq;            /* next position consumed by background thread */
+    size_t done;           /* positions before this are written to output */
+    size_t flushreq;       /* flush requests made by bio_flush */
+    size_t flushed;        /* flush requests completed */
+    size_t dropped;        /* records dropped by full queue */
+    size_t reported;       /* dropped records already reported in log */
+    log_overflow_t policy; /* overflow policy of full queue */
+    int flags;             /* log flags when started */
+    int status;            /* status of output after last batch */
+    int stop;              /* background thread exits once queue is empty */
+    unsigned int seq;      /* futex word changed whenever positions change */
+    unsigned int nwait;    /* number of threads sleeping on seq */
+    pthread_t thread;
+} _log_async_t;
+
+typedef struct _log_spec
+{
+    const char *start; /* '%' */
+    const char *flags; /* end of flags, start of width */
+    const char *width; /* end of width, start of precision ('.') */
+    const char *prec;  /* end of precision, start of length modifier */
+    const char *end;   /* one past conversion */
+    char len[3];       /* length modifier */
+    char conv;         /* conversion character, '\0' if incomplete */
+} _log_spec_t;
+
+typedef struct _log_def
+{
+    uint64_t id;     /* address of string when logged */
+    const char *str; /* null terminated copy */
+} _log_def_t;
+
+typedef struct _log_reader
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    int err; /* read past end */
+} _log_reader_t;
+
+_Thread_local _log_tcache_t _log_tcache;
+
+typedef struct _log_aopqd
+{
+    _log_async_t *async;
+    int err;
+} _log_aopqd_t;
 
 const char *log_lvlstr(log_lvl_t lvl)
 {
     const char *rv;
     switch (lvl)
     {
+    case LOG_TRACE:
+        rv = "TRACE";
+        break;
+    case LOG_DEBUG:
+        rv = "DEBUG";
+        break;
     case LOG_INFO:
         rv = "INFO";
         break;
@@ -30,6 +133,968 @@ const char *log_lvlstr(log_lvl_t lvl)
     return rv;
 }
 
+int log_lvlparse(const char *str, log_lvl_t *lvl)
+{
+    for (log_lvl_t l = LOG_TRACE; l <= LOG_ERROR; l++)
+    {
+        if (strcasecmp(str, log_lvlstr(l)) == 0)
+        {
+            *lvl = l;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int log_overflowparse(const char *str, log_overflow_t *policy)
+{
+    const char *names[] = {"drop", "block"};
+    for (log_overflow_t p = LOG_DROP; p <= LOG_BLOCK; p++)
+    {
+        if (strcasecmp(str, names[p]) == 0)
+        {
+            *policy = p;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void _log_now(_log_time_t *t)
+{
+    struct timespec mono;
+    clock_gettime(CLOCK_REALTIME, &t->wall);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    t->mono = (uint64_t)mono.tv_sec * 1000000000u + (uint64_t)mono.tv_nsec;
+}
+
+size_t _log_u64(char *s, uint64_t v, size_t width)
+{
+    /* decimal digits, zero padded to width */
+    char tmp[20];
+    size_t n = 0;
+    size_t i;
+    do
+    {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n < width && n < sizeof(tmp))
+    {
+        tmp[n++] = '0';
+    }
+    for (i = 0; i < n; i++)
+    {
+        s[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+const char *_log_prefix(buffer_t *buf, int flags, const _log_time_t *t, const char *file, int line, log_lvl_t lvl)
+{
+    /* built by copying, calendar date formatted at most once per second per thread */
+    char ts[96];
+    size_t n = 0;
+    ts[n++] = '[';
+    if (flags & LOG_RAWTIME)
+    {
+        n += _log_u64(ts + n, (uint64_t)t->wall.tv_sec * 1000000000u + (uint64_t)t->wall.tv_nsec, 0);
+    }
+    else
+    {
+        _log_tcache_t *tc = &_log_tcache;
+        if (!tc->len || tc->sec != t->wall.tv_sec)
+        {
+            tc->sec = t->wall.tv_sec;
+            tc->len = ctime_r(&tc->sec, tc->str) ? strlen(tc->str) - 1 : 0; /* exclude newline */
+            if (!tc->len)
+            {
+                strcpy(tc->str, "TIME ERROR");
+                tc->len = strlen(tc->str);
+            }
+        }
+        memcpy(ts + n, tc->str, tc->len);
+        n += tc->len;
+    }
+    memcpy(ts + n, "] [", 3);
+    n += 3;
+    if (flags & LOG_RAWTIME)
+    {
+        n += _log_u64(ts + n, t->mono, 0);
+    }
+    else
+    {
+        n += _log_u64(ts + n, t->mono / 1000000000u, 0);
+        ts[n++] = '.';
+        n += _log_u64(ts + n, t->mono % 1000000000u, 9);
+    }
+    memcpy(ts + n, "] [", 3);
+    n += 3;
+    const size_t filesz = strlen(file);
+    const char *lvlstr = log_lvlstr(lvl);
+    const size_t lvlsz = strlen(lvlstr);
+    char ls[24];
+    size_t ln = 0;
+    ls[ln++] = ':';
+    ln += _log_u64(ls + ln, line < 0 ? 0 : (uint64_t)line, 0);
+    memcpy(ls + ln, "] [", 3);
+    ln += 3;
+    const size_t insz = buf->size;
+    if (!(buf_push(buf, ts, n) && buf_push(buf, file, filesz) && buf_push(buf, ls, ln) &&
+          buf_push(buf, lvlstr, lvlsz) && buf_push(buf, "] ", 3))) /* includes null byte */
+    {
+        return NULL;
+    }
+    return (const char *)buf->data + insz;
+}
+
+const char *_log_spec_next(const char *fmt, _log_spec_t *spec)
+{
+    /* next conversion specification (skipping "%%"), NULL if none */
+    const char *p = fmt;
+    while ((p = strchr(p, '%')) && p[1] == '%')
+    {
+        p += 2;
+    }
+    if (!p)
+    {
+        return NULL;
+    }
+    spec->start = p++;
+    p += strspn(p, "-+ #0'I");
+    spec->flags = p;
+    p += *p == '*' ? 1 : strspn(p, "0123456789");
+    spec->width = p;
+    if (*p == '.')
+    {
+        p++;
+        p += *p == '*' ? 1 : strspn(p, "0123456789");
+    }
+    spec->prec = p;
+    size_t n = strspn(p, "hlLqjzt");
+    n = n < 2 ? n : 2;
+    memcpy(spec->len, p, n);
+    spec->len[n] = '\0';
+    p += n;
+    spec->conv = *p;
+    spec->end = *p ? p + 1 : p;
+    return spec->start;
+}
+
+int _log_put(buffer_t *buf, const void *src, size_t sz)
+{
+    return !sz || buf_push(buf, src, sz) == sz;
+}
+
+int _log_put_u64(buffer_t *buf, uint64_t v)
+{
+    /* LEB128 varint */
+    unsigned char b[10];
+    size_t n = 0;
+    do
+    {
+        b[n] = v & 0x7f;
+        v >>= 7;
+        b[n++] |= v ? 0x80 : 0;
+    } while (v);
+    return _log_put(buf, b, n);
+}
+
+int _log_put_s64(buffer_t *buf, int64_t v)
+{
+    /* zigzag, small negative values stay small */
+    return _log_put_u64(buf, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+int _log_put_str(buffer_t *buf, const char *str, size_t len)
+{
+    return _log_put_u64(buf, len) && _log_put(buf, str, len);
+}
+
+size_t _log_bin_open(buffer_t *buf, char type)
+{
+    /* type and payload length placeholder, returns payload offset (0 if failed) */
+    const unsigned char hdr[LOG_BIN_HDRSZ] = {(unsigned char)type, 0, 0, 0, 0};
+    return _log_put(buf, hdr, sizeof(hdr)) ? buf->size : 0;
+}
+
+int _log_bin_close(buffer_t *buf, size_t off)
+{
+    /* payload length little endian */
+    const uint32_t len = (uint32_t)(buf->size - off);
+    unsigned char *hdr = (unsigned char *)buf->data + off - (LOG_BIN_HDRSZ - 1);
+    size_t i;
+    for (i = 0; i < LOG_BIN_HDRSZ - 1; i++)
+    {
+        hdr[i] = (unsigned char)(len >> (8 * i));
+    }
+    return 1;
+}
+
+int _log_bin_defined(buffer_t *defs, const char *str, int commit)
+{
+    /* address in set of defined addresses, inserted if commit (lock-free insert) */
+    if (!defs || !defs->data)
+    {
+        return 0;
+    }
+    const char **set = defs->data;
+    const size_t n = defs->size / sizeof(const char *);
+    size_t i = (size_t)(((uint64_t)(uintptr_t)str * 0x9E3779B97F4A7C15u) >> 32) & (n - 1);
+    size_t k;
+    for (k = 0; k < n; k++, i = (i + 1) & (n - 1))
+    {
+        const char *cur = __atomic_load_n(&set[i], __ATOMIC_ACQUIRE);
+        if (!cur && !commit)
+        {
+            return 0;
+        }
+        if (!cur && __atomic_compare_exchange_n(&set[i], &cur, str, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return 1;
+        }
+        if (cur == str)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int _log_bin_define(buffer_t *buf, buffer_t *defs, const char *str)
+{
+    /* string definition written unless already defined (committed by caller once written) */
+    if (_log_bin_defined(defs, str, 0))
+    {
+        return 1;
+    }
+    const size_t off = _log_bin_open(buf, 'S');
+    return off && _log_put_u64(buf, (uintptr_t)str) && _log_put(buf, str, strlen(str)) && _log_bin_close(buf, off);
+}
+
+int64_t _log_arg_s64(const char *len, va_list *ap)
+{
+    if (strcmp(len, "hh") == 0)
+    {
+        return (signed char)va_arg(*ap, int);
+    }
+    if (strcmp(len, "h") == 0)
+    {
+        return (short)va_arg(*ap, int);
+    }
+    if (strcmp(len, "l") == 0)
+    {
+        return va_arg(*ap, long);
+    }
+    if (strcmp(len, "ll") == 0 || strcmp(len, "q") == 0)
+    {
+        return va_arg(*ap, long long);
+    }
+    if (strcmp(len, "j") == 0)
+    {
+        return va_arg(*ap, intmax_t);
+    }
+    if (strcmp(len, "z") == 0)
+    {
+        return va_arg(*ap, ssize_t);
+    }
+    if (strcmp(len, "t") == 0)
+    {
+        return va_arg(*ap, ptrdiff_t);
+    }
+    return va_arg(*ap, int);
+}
+
+uint64_t _log_arg_u64(const char *len, va_list *ap)
+{
+    if (strcmp(len, "hh") == 0)
+    {
+        return (unsigned char)va_arg(*ap, unsigned int);
+    }
+    if (strcmp(len, "h") == 0)
+    {
+        return (unsigned short)va_arg(*ap, unsigned int);
+    }
+    if (strcmp(len, "l") == 0)
+    {
+        return va_arg(*ap, unsigned long);
+    }
+    if (strcmp(len, "ll") == 0 || strcmp(len, "q") == 0)
+    {
+        return va_arg(*ap, unsigned long long);
+    }
+    if (strcmp(len, "j") == 0)
+    {
+        return va_arg(*ap, uintmax_t);
+    }
+    if (strcmp(len, "z") == 0)
+    {
+        return va_arg(*ap, size_t);
+    }
+    if (strcmp(len, "t") == 0)
+    {
+        return (uint64_t)va_arg(*ap, ptrdiff_t);
+    }
+    return va_arg(*ap, unsigned int);
+}
+
+int _log_bin_vencode(buffer_t *buf, buffer_t *defs, const _log_time_t *t, const char *file, int line, log_lvl_t lvl,
+                     const char *fmt, va_list args)
+{
+    /* definitions first, then record with raw arguments in order of conversions (prefix if file) */
+    const int errnum = errno;
+    if (!(_log_bin_define(buf, defs, fmt) && (!file || _log_bin_define(buf, defs, file))))
+    {
+        return 0;
+    }
+    const size_t off = _log_bin_open(buf, file ? 'R' : 'M');
+    int ok = off && _log_put_u64(buf, (uintptr_t)fmt);
+    if (file)
+    {
+        ok = ok && _log_put_u64(buf, (uintptr_t)file) && _log_put_u64(buf, line < 0 ? 0 : (uint64_t)line) &&
+             _log_put_u64(buf, (uint64_t)lvl) &&
+             _log_put_u64(buf, (uint64_t)t->wall.tv_sec * 1000000000u + (uint64_t)t->wall.tv_nsec) &&
+             _log_put_u64(buf, t->mono);
+    }
+    va_list ap;
+    va_copy(ap, args);
+    _log_spec_t spec;
+    const char *p = fmt;
+    while (ok && p && (p = _log_spec_next(p, &spec)))
+    {
+        int prec = -1;
+        p = spec.end;
+        if (*spec.flags == '*')
+        {
+            ok = _log_put_s64(buf, va_arg(ap, int));
+        }
+        if (spec.width[0] == '.')
+        {
+            prec = spec.width[1] == '*' ? va_arg(ap, int) : atoi(spec.width + 1);
+            ok = ok && (spec.width[1] != '*' || _log_put_s64(buf, prec));
+        }
+        switch (spec.conv)
+        {
+        case 'd':
+        case 'i':
+            ok = ok && _log_put_s64(buf, _log_arg_s64(spec.len, &ap));
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            ok = ok && _log_put_u64(buf, _log_arg_u64(spec.len, &ap));
+            break;
+        case 'c':
+            ok = ok && _log_put_s64(buf, va_arg(ap, int));
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        {
+            const double d = spec.len[0] == 'L' ? (double)va_arg(ap, long double) : va_arg(ap, double);
+            ok = ok && _log_put(buf, &d, sizeof(d));
+            break;
+        }
+        case 's':
+        case 'm':
+        {
+            /* bytes beyond precision never read (need not be null terminated) */
+            const char *str = spec.conv == 'm' ? strerror(errnum) : va_arg(ap, const char *);
+            str = str ? str : "(null)";
+            ok = ok && _log_put_str(buf, str, prec < 0 ? strlen(str) : strnlen(str, (size_t)prec));
+            break;
+        }
+        case 'p':
+            ok = ok && _log_put_u64(buf, (uintptr_t)va_arg(ap, void *));
+            break;
+        case 'n':
+            va_arg(ap, void *);
+            break;
+        default:
+            /* unsupported, remaining conversions not encoded (nor rendered) */
+            p = NULL;
+        }
+    }
+    va_end(ap);
+    return ok && _log_bin_close(buf, off);
+}
+
+int _log_bin_printf(buffer_t *buf, buffer_t *defs, const _log_time_t *t, const char *file, int line, log_lvl_t lvl,
+                    const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    const int ok = _log_bin_vencode(buf, defs, t, file, line, lvl, fmt, args);
+    va_end(args);
+    return ok;
+}
+
+int _log_bin_begin(log_t *log)
+{
+    /* set of defined strings allocated once, header written ahead of first record */
+    if (log->defs.data)
+    {
+        return 1;
+    }
+    if (buf_resize(&log->defs, LOG_BIN_NDEFS * sizeof(const char *)) != LOG_BIN_NDEFS * sizeof(const char *))
+    {
+        buf_free(&log->defs);
+        return 0;
+    }
+    memset(log->defs.data, 0, log->defs.size);
+    return bio_write(&log->out, LOG_BIN_MAGIC, LOG_BIN_MAGICSZ) == LOG_BIN_MAGICSZ;
+}
+
+uint64_t _log_get_u64(_log_reader_t *r)
+{
+    uint64_t v = 0;
+    unsigned int shift = 0;
+    while (r->p < r->end && shift < 64)
+    {
+        const unsigned char b = *r->p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            return v;
+        }
+        shift += 7;
+    }
+    r->err = 1;
+    return 0;
+}
+
+int64_t _log_get_s64(_log_reader_t *r)
+{
+    const uint64_t v = _log_get_u64(r);
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+const unsigned char *_log_get(_log_reader_t *r, size_t sz)
+{
+    const unsigned char *p = r->p;
+    if ((size_t)(r->end - r->p) < sz)
+    {
+        r->err = 1;
+        return NULL;
+    }
+    r->p += sz;
+    return p;
+}
+
+int _log_bin_frame(const unsigned char *p, const unsigned char *end, _log_reader_t *r)
+{
+    /* payload of record at p, 0 if truncated */
+    const size_t len = (size_t)p[1] | (size_t)p[2] << 8 | (size_t)p[3] << 16 | (size_t)p[4] << 24;
+    r->p = p + LOG_BIN_HDRSZ;
+    r->end = r->p + ((size_t)(end - r->p) < len ? 0 : len);
+    r->err = 0;
+    return (size_t)(end - r->p) >= len;
+}
+
+int _log_def_cmp(const void *a, const void *b)
+{
+    const uint64_t ida = ((const _log_def_t *)a)->id;
+    const uint64_t idb = ((const _log_def_t *)b)->id;
+    return ida < idb ? -1 : (ida > idb ? 1 : 0);
+}
+
+const char *_log_def_find(const buffer_t *defs, uint64_t id)
+{
+    const _log_def_t key = {id, NULL};
+    const _log_def_t *def = bsearch(&key, defs->data, defs->size / sizeof(_log_def_t), sizeof(_log_def_t), &_log_def_cmp);
+    return def ? def->str : NULL;
+}
+
+int _log_bin_render_spec(buffer_t *line, const _log_spec_t *spec, _log_reader_t *r)
+{
+    /* rebuild conversion with decoded '*' values and length modifier of decoded type */
+    char sp[64];
+    size_t n = 0;
+    const size_t flagsz = (size_t)(spec->flags - spec->start);
+    size_t nw;
+    if (flagsz + 48 > sizeof(sp))
+    {
+        return 0;
+    }
+    memcpy(sp, spec->start, flagsz);
+    n += flagsz;
+    if (*spec->flags == '*')
+    {
+        n += (size_t)snprintf(sp + n, sizeof(sp) - n, "%d", (int)_log_get_s64(r));
+    }
+    else if ((size_t)(spec->width - spec->flags) < 16)
+    {
+        memcpy(sp + n, spec->flags, (size_t)(spec->width - spec->flags));
+        n += (size_t)(spec->width - spec->flags);
+    }
+    nw = n;
+    if (spec->width[0] == '.' && spec->width[1] == '*')
+    {
+        const int prec = (int)_log_get_s64(r);
+        n += prec < 0 ? 0 : (size_t)snprintf(sp + n, sizeof(sp) - n, ".%d", prec);
+    }
+    else if (spec->width[0] == '.' && (size_t)(spec->prec - spec->width) < 16)
+    {
+        memcpy(sp + n, spec->width, (size_t)(spec->prec - spec->width));
+        n += (size_t)(spec->prec - spec->width);
+    }
+    const char *rv = NULL;
+    switch (spec->conv)
+    {
+    case 'd':
+    case 'i':
+        snprintf(sp + n, sizeof(sp) - n, "ll%c", spec->conv);
+        rv = bstr_printf(line, sp, (long long)_log_get_s64(r));
+        break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        snprintf(sp + n, sizeof(sp) - n, "ll%c", spec->conv);
+        rv = bstr_printf(line, sp, (unsigned long long)_log_get_u64(r));
+        break;
+    case 'c':
+        snprintf(sp + n, sizeof(sp) - n, "c");
+        rv = bstr_printf(line, sp, (int)_log_get_s64(r));
+        break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+    {
+        double d = 0;
+        const unsigned char *p = _log_get(r, sizeof(d));
+        memcpy(&d, p ? p : (const unsigned char *)&d, sizeof(d));
+        snprintf(sp + n, sizeof(sp) - n, "%c", spec->conv);
+        rv = bstr_printf(line, sp, d);
+        break;
+    }
+    case 's':
+    case 'm':
+    {
+        /* stored bytes already limited by precision, not null terminated */
+        const size_t len = (size_t)_log_get_u64(r);
+        const unsigned char *p = _log_get(r, len);
+        n = nw;
+        snprintf(sp + n, sizeof(sp) - n, ".*s");
+        rv = bstr_printf(line, sp, (int)(p ? len : 0), p ? (const char *)p : "");
+        break;
+    }
+    case 'p':
+        snprintf(sp + n, sizeof(sp) - n, "p");
+        rv = bstr_printf(line, sp, (void *)(uintptr_t)_log_get_u64(r));
+        break;
+    case 'n':
+        rv = "";
+        break;
+    default:
+        rv = NULL;
+    }
+    return rv && !r->err;
+}
+
+int _log_put_lit(buffer_t *line, const char *p, const char *end)
+{
+    /* literal text of format, "%%" unescaped */
+    const char *q;
+    for (; (q = memchr(p, '%', (size_t)(end - p))); p = q + 2)
+    {
+        if (!bstr_printf(line, "%.*s%%", (int)(q - p), p))
+        {
+            return 0;
+        }
+    }
+    return bstr_printf(line, "%.*s", (int)(end - p), p) != NULL;
+}
+
+int _log_bin_render(buffer_t *line, const buffer_t *defs, int flags, char type, _log_reader_t *r)
+{
+    /* prefix and message formatted as when logged as text */
+    const char *fmt = _log_def_find(defs, _log_get_u64(r));
+    buf_clear(line);
+    if (type == 'R')
+    {
+        const char *file = _log_def_find(defs, _log_get_u64(r));
+        const int ln = (int)_log_get_u64(r);
+        const log_lvl_t lvl = (log_lvl_t)_log_get_u64(r);
+        const uint64_t wall = _log_get_u64(r);
+        _log_time_t t = {{(time_t)(wall / 1000000000u), (long)(wall % 1000000000u)}, _log_get_u64(r)};
+        if (r->err || !_log_prefix(line, flags, &t, file ? file : "?", ln, lvl))
+        {
+            return 0;
+        }
+    }
+    if (!fmt)
+    {
+        return bstr_printf(line, "(undefined log format)\n") != NULL;
+    }
+    _log_spec_t spec;
+    const char *p = fmt;
+    const char *q;
+    while ((q = _log_spec_next(p, &spec)))
+    {
+        if (!_log_put_lit(line, p, q))
+        {
+            return 0;
+        }
+        if (!_log_bin_render_spec(line, &spec, r))
+        {
+            /* unsupported or truncated, rest of format left as is */
+            return bstr_printf(line, "%s", q) != NULL;
+        }
+        p = spec.end;
+    }
+    return _log_put_lit(line, p, p + strlen(p));
+}
+
+void _log_wake(_log_async_t *async)
+{
+    /* positions changed, wake sleepers (no system call unless someone sleeps) */
+    __atomic_add_fetch(&async->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&async->nwait, __ATOMIC_SEQ_CST))
+    {
+        syscall(SYS_futex, &async->seq, FUTEX_WAKE_PRIVATE, __INT32_MAX__, NULL, NULL, 0);
+    }
+}
+
+void _log_sleep(_log_async_t *async, unsigned int seq)
+{
+    /* seq read before checking, so a change after the check fails the futex wait */
+    __atomic_add_fetch(&async->nwait, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &async->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+    __atomic_sub_fetch(&async->nwait, 1, __ATOMIC_SEQ_CST);
+}
+
+_log_rec_t *_log_claim(_log_async_t *async, size_t *pos)
+{
+    /* claim slot at enqueue position, applying overflow policy when slot not yet consumed */
+    size_t p = __atomic_load_n(&async->enq, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        const unsigned int seq = __atomic_load_n(&async->seq, __ATOMIC_SEQ_CST);
+        _log_rec_t *rec = &async->recs[p & async->mask];
+        const ptrdiff_t dif = (ptrdiff_t)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - p);
+        if (dif == 0)
+        {
+            if (__atomic_compare_exchange_n(&async->enq, &p, p + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *pos = p;
+                return rec;
+            }
+        }
+        else if (dif < 0)
+        {
+            /* full */
+            if (async->policy == LOG_DROP)
+            {
+                __atomic_add_fetch(&async->dropped, 1, __ATOMIC_RELAXED);
+                return NULL;
+            }
+            _log_sleep(async, seq);
+            p = __atomic_load_n(&async->enq, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            /* claimed by another producer */
+            p = __atomic_load_n(&async->enq, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void _log_publish(_log_async_t *async, _log_rec_t *rec, size_t pos)
+{
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+    _log_wake(async);
+}
+
+int _log_vqueue(_log_async_t *async, int flags, const char *file, int line, log_lvl_t lvl, const char *fmt, va_list args)
+{
+    /* message formatted by caller (arguments may not outlive call), prefix by background thread */
+    size_t pos;
+    _log_time_t t = {{0, 0}, 0};
+    if (file)
+    {
+        /* time of call, not of writing */
+        _log_now(&t);
+    }
+    _log_rec_t *rec = _log_claim(async, &pos);
+    if (!rec)
+    {
+        return 0;
+    }
+    va_list args_cpy;
+    va_copy(args_cpy, args);
+    const int len = vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+    rec->heap = NULL;
+    if (len >= (int)sizeof(rec->msg) && (rec->heap = malloc((size_t)len + 1)))
+    {
+        vsnprintf(rec->heap, (size_t)len + 1, fmt, args_cpy);
+    }
+    va_end(args_cpy);
+    /* truncated if allocation failed */
+    rec->len = len < 0 ? 0 : (rec->heap || len < (int)sizeof(rec->msg) ? (size_t)len : sizeof(rec->msg) - 1);
+    rec->t = t;
+    rec->flags = flags;
+    rec->file = file;
+    rec->line = line;
+    rec->lvl = lvl;
+    _log_publish(async, rec, pos);
+    return 1;
+}
+
+void _log_write_rec(_log_async_t *async, _log_rec_t *rec)
+{
+    if (rec->file)
+    {
+        buf_clear(&async->fmt);
+        if (_log_prefix(&async->fmt, rec->flags, &rec->t, rec->file, rec->line, rec->lvl))
+        {
+            bio_write(&async->out, async->fmt.data, async->fmt.size - 1); /* exclude null byte */
+        }
+    }
+    bio_write(&async->out, rec->heap ? rec->heap : rec->msg, rec->len);
+    free(rec->heap);
+    rec->heap = NULL;
+}
+
+void _log_report_dropped(_log_async_t *async)
+{
+    const size_t dropped = __atomic_load_n(&async->dropped, __ATOMIC_RELAXED);
+    if (dropped != async->reported)
+    {
+        const char *fmt = "log queue full, dropped %zu records\n";
+        _log_time_t t;
+        _log_now(&t);
+        buf_clear(&async->fmt);
+        if (async->flags & LOG_BINARY)
+        {
+            /* strings defined again, set of defined strings belongs to callers */
+            if (_log_bin_printf(&async->fmt, NULL, &t, __FILE__, __LINE__, LOG_WARNING, fmt, dropped - async->reported))
+            {
+                bio_write(&async->out, async->fmt.data, async->fmt.size);
+            }
+        }
+        else if (_log_prefix(&async->fmt, async->flags, &t, __FILE__, __LINE__, LOG_WARNING) &&
+                 bstr_printf(&async->fmt, fmt, dropped - async->reported))
+        {
+            bio_write(&async->out, async->fmt.data, async->fmt.size - 1);
+        }
+        async->reported = dropped;
+    }
+}
+
+void *_log_async_run(void *arg)
+{
+    /* background thread, writes records in batches and flushes once queue is empty */
+    _log_async_t *async = arg;
+    for (;;)
+    {
+        const unsigned int seq = __atomic_load_n(&async->seq, __ATOMIC_SEQ_CST);
+        size_t n = 0;
+        _log_rec_t *rec = &async->recs[async->deq & async->mask];
+        while (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == async->deq + 1)
+        {
+            _log_write_rec(async, rec);
+            /* slot free for position one lap later */
+            __atomic_store_n(&rec->seq, async->deq + async->mask + 1, __ATOMIC_RELEASE);
+            async->deq++;
+            if (++n % LOG_WAKE_RECS == 0)
+            {
+                _log_wake(async);
+            }
+            rec = &async->recs[async->deq & async->mask];
+        }
+        /* output only flushed on request, like synchronous logging (flushing memory outputs clears them) */
+        const size_t flushreq = __atomic_load_n(&async->flushreq, __ATOMIC_ACQUIRE);
+        if (n || flushreq != async->flushed)
+        {
+            _log_report_dropped(async);
+            if (flushreq != async->flushed)
+            {
+                bio_flush(&async->out);
+            }
+            __atomic_store_n(&async->status, bio_status(&async->out), __ATOMIC_RELAXED);
+            __atomic_store_n(&async->done, async->deq, __ATOMIC_RELEASE);
+            __atomic_store_n(&async->flushed, flushreq, __ATOMIC_RELEASE);
+            _log_wake(async);
+        }
+        else if (__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE))
+        {
+            /* stopped and drained */
+            break;
+        }
+        else
+        {
+            _log_sleep(async, seq);
+        }
+    }
+    _log_report_dropped(async);
+    return NULL;
+}
+
+void _log_async_join(_log_async_t *async)
+{
+    __atomic_store_n(&async->stop, 1, __ATOMIC_RELEASE);
+    _log_wake(async);
+    pthread_join(async->thread, NULL);
+}
+
+void _log_async_free(_log_async_t *async)
+{
+    buf_free(&async->fmt);
+    free(async->recs);
+    free(async);
+}
+
+void _log_bio_move(bufferedio_t *bio, bufferedio_t *src)
+{
+    /* buffers moved (inline bytes), never copied bitwise */
+    buffer_t buf = {0};
+    buffer_t opaque = {0};
+    buf_move(&buf, &src->data.buf);
+    buf_move(&opaque, &src->data.opaque);
+    *bio = *src;
+    buf_move(&bio->data.buf, &buf);
+    buf_move(&bio->data.opaque, &opaque);
+    memset(src, 0, sizeof(bufferedio_t));
+}
+
+int _log_astatus(const bio_data_t *bd)
+{
+    const _log_aopqd_t *opqd = bd->opaque.data;
+    if (!opqd)
+    {
+        return BIO_STATUS_INIT;
+    }
+    return opqd->err ? BIO_STATUS_INIT - opqd->err : __atomic_load_n(&opqd->async->status, __ATOMIC_RELAXED);
+}
+
+void _log_astatus_str(const bio_data_t *bd, char *str, size_t n)
+{
+    const _log_aopqd_t *opqd = bd->opaque.data;
+    if (!opqd)
+    {
+        strncpy(str, "uninitialized, no background log thread", n);
+        return;
+    }
+    const _log_async_t *async = opqd->async;
+    const size_t queued = __atomic_load_n(&async->enq, __ATOMIC_RELAXED) - __atomic_load_n(&async->done, __ATOMIC_RELAXED);
+    const char *policy = async->policy == LOG_BLOCK ? "block" : "drop";
+    const char *fmt = "{async log: %zu slots (%s), queued: %zu, dropped: %zu, output status: %d}";
+    if (snprintf(str, n, fmt, async->mask + 1, policy, queued, __atomic_load_n(&async->dropped, __ATOMIC_RELAXED),
+                 __atomic_load_n(&async->status, __ATOMIC_RELAXED)) < 0)
+    {
+        strncpy(str, "(async log status_str failed to format string)", n);
+    }
+}
+
+size_t _log_aread(bio_data_t *bd, void *data, size_t sz)
+{
+    _log_aopqd_t *opqd = bd->opaque.data;
+    opqd->err = EBADF;
+    return 0;
+}
+
+size_t _log_awrite(bio_data_t *bd, const void *data, size_t sz)
+{
+    /* bytes queued as a record without prefix */
+    _log_aopqd_t *opqd = bd->opaque.data;
+    size_t pos;
+    _log_rec_t *rec = sz ? _log_claim(opqd->async, &pos) : NULL;
+    if (!rec)
+    {
+        return 0;
+    }
+    rec->heap = sz > sizeof(rec->msg) ? malloc(sz) : NULL;
+    rec->len = rec->heap || sz <= sizeof(rec->msg) ? sz : sizeof(rec->msg);
+    memcpy(rec->heap ? rec->heap : rec->msg, data, rec->len);
+    rec->file = NULL;
+    _log_publish(opqd->async, rec, pos);
+    return rec->len;
+}
+
+void _log_aflush(bio_data_t *bd)
+{
+    /* wait until all records queued so far are written and output flushed by background thread */
+    _log_aopqd_t *opqd = bd->opaque.data;
+    _log_async_t *async = opqd->async;
+    const size_t target = __atomic_load_n(&async->enq, __ATOMIC_ACQUIRE);
+    const size_t ticket = __atomic_add_fetch(&async->flushreq, 1, __ATOMIC_RELEASE);
+    _log_wake(async);
+    for (;;)
+    {
+        const unsigned int seq = __atomic_load_n(&async->seq, __ATOMIC_SEQ_CST);
+        if ((ptrdiff_t)(__atomic_load_n(&async->done, __ATOMIC_ACQUIRE) - target) >= 0 &&
+            (ptrdiff_t)(__atomic_load_n(&async->flushed, __ATOMIC_ACQUIRE) - ticket) >= 0)
+        {
+            break;
+        }
+        _log_sleep(async, seq);
+    }
+}
+
+ssize_t _log_aseek(bio_data_t *bd, long offset, int whence)
+{
+    _log_aopqd_t *opqd = bd->opaque.data;
+    opqd->err = ESPIPE;
+    return -1;
+}
+
+void _log_adfree(bio_data_t *bd)
+{
+    /* queued records written before output is freed */
+    _log_aopqd_t *opqd = bd->opaque.data;
+    if (opqd)
+    {
+        _log_async_join(opqd->async);
+        bio_dfree(&opqd->async->out);
+        _log_async_free(opqd->async);
+    }
+    buf_free(&bd->buf);
+    buf_free(&bd->opaque);
+}
+
+_log_async_t *_log_async(const log_t *log)
+{
+    const _log_aopqd_t *opqd = log->out.data.opaque.data;
+    return log->out.write == &_log_awrite && opqd ? opqd->async : NULL;
+}
+
+int _log_bin_vwrite(log_t *log, const char *file, int line, log_lvl_t lvl, const char *fmt, va_list args)
+{
+    /* encoded by caller, log buffer only used when synchronous (never shared between threads) */
+    const int async = log->out.write == &_log_awrite;
+    buffer_t tmp = {0};
+    buffer_t *buf = async ? &tmp : &log->buf;
+    _log_time_t t;
+    tmp.alloc = &buf_pool;
+    _log_now(&t);
+    buf_clear(buf);
+    const int ok = (async || _log_bin_begin(log)) && _log_bin_vencode(buf, &log->defs, &t, file, line, lvl, fmt, args) &&
+                   bio_write(&log->out, buf->data, buf->size) == buf->size;
+    if (ok)
+    {
+        /* strings only defined once written, dropped or failed records define them again */
+        _log_bin_defined(&log->defs, fmt, 1);
+        if (file)
+        {
+            _log_bin_defined(&log->defs, file, 1);
+        }
+    }
+    buf_free(&tmp);
+    return ok;
+}
+
 const char *log_printf(log_t *log, const char *fmt, ...)
 {
     const char *str = NULL;
@@ -37,15 +1102,27 @@ const char *log_printf(log_t *log, const char *fmt, ...)
     {
         goto end;
     }
+    _log_async_t *async = _log_async(log);
     va_list args;
     va_start(args, fmt);
-    buf_clear(&log->buf);
-    str = bstr_printf(&log->buf, fmt, args);
-    va_end(args);
-    if (str)
+    if (log->flags & LOG_BINARY)
     {
-        bio_write(&log->out, str, log->buf.size);
+        str = _log_bin_vwrite(log, NULL, 0, LOG_INFO, fmt, args) ? fmt : NULL;
     }
+    else if (async)
+    {
+        str = _log_vqueue(async, log->flags, NULL, 0, LOG_INFO, fmt, args) ? fmt : NULL;
+    }
+    else
+    {
+        buf_clear(&log->buf);
+        str = bstr_vprintf(&log->buf, fmt, args);
+        if (str)
+        {
+            bio_write(&log->out, str, log->buf.size - 1); /* exclude null byte */
+        }
+    }
+    va_end(args);
 end:
     return str;
 }
@@ -53,28 +1130,29 @@ end:
 const char *log_printf_long(log_t *log, const char *file, int line, log_lvl_t lvl, const char *fmt, ...)
 {
     const char *str = NULL;
-    if (bio_status(&log->out) <= BIO_STATUS_INIT)
+    if (lvl < log->minlvl || bio_status(&log->out) <= BIO_STATUS_INIT)
     {
         goto end;
     }
-    buf_clear(&log->buf);
-    char tstr[32]; /* known max length of string */
-    time_t t;
-    time(&t);
-    const char *timestr;
-    if (ctime_r(&t, tstr))
+    _log_async_t *async = _log_async(log);
+    va_list args;
+    va_start(args, fmt);
+    if (log->flags & LOG_BINARY)
     {
-        tstr[strlen(tstr) - 1] = '\0'; /* overwrite newline */
-        timestr = tstr;
+        str = _log_bin_vwrite(log, file, line, lvl, fmt, args) ? fmt : NULL;
+        va_end(args);
+        goto end;
     }
-    else
+    if (async)
     {
-        timestr = "TIME ERROR";
+        str = _log_vqueue(async, log->flags, file, line, lvl, fmt, args) ? fmt : NULL;
+        va_end(args);
+        goto end;
     }
-    const char *lvlstr = log_lvlstr(lvl);
-    va_list args;
-    va_start(args, fmt);
-    const int valid = bstr_printf(&log->buf, "[%s] [%s:%d] [%s] ", timestr, file, line, lvlstr) && bstr_vprintf(&log->buf, fmt, args);
+    _log_time_t t;
+    _log_now(&t);
+    buf_clear(&log->buf);
+    const int valid = _log_prefix(&log->buf, log->flags, &t, file, line, lvl) && bstr_vprintf(&log->buf, fmt, args);
     va_end(args);
     if (!valid)
     {
@@ -84,4 +1162,144 @@ const char *log_printf_long(log_t *log, const char *file, int line, log_lvl_t lv
     bio_write(&log->out, str, log->buf.size - 1); /* exclude null byte */
 end:
     return str;
+}
+
+int log_async_start(log_t *log, size_t nrecs, log_overflow_t policy)
+{
+    size_t n = 1;
+    size_t i;
+    if (_log_async(log) || bio_status(&log->out) <= BIO_STATUS_INIT ||
+        ((log->flags & LOG_BINARY) && !_log_bin_begin(log)))
+    {
+        /* binary log set of defined strings shared by callers, allocated before */
+        return 0;
+    }
+    while (n < nrecs)
+    {
+        n <<= 1;
+    }
+    _log_async_t *async = calloc(1, sizeof(_log_async_t));
+    if (!async || !(async->recs = calloc(n, sizeof(_log_rec_t))))
+    {
+        goto error;
+    }
+    for (i = 0; i < n; i++)
+    {
+        async->recs[i].seq = i;
+    }
+    async->mask = n - 1;
+    async->policy = policy;
+    async->flags = log->flags;
+    async->status = bio_status(&log->out);
+    _log_bio_move(&async->out, &log->out);
+    /* background thread inherits a mask blocking all signals, so they reach the application's threads */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    const int err = pthread_create(&async->thread, NULL, &_log_async_run, async);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err)
+    {
+        _log_bio_move(&log->out, &async->out);
+        goto error;
+    }
+    const _log_aopqd_t opqd = {async, 0};
+    if (!buf_copy(&log->out.data.opaque, &opqd, sizeof(_log_aopqd_t)))
+    {
+        _log_async_join(async);
+        _log_bio_move(&log->out, &async->out);
+        goto error;
+    }
+    log->out.status = &_log_astatus;
+    log->out.status_str = &_log_astatus_str;
+    log->out.read = &_log_aread;
+    log->out.write = &_log_awrite;
+    log->out.flush = &_log_aflush;
+    log->out.seek = &_log_aseek;
+    log->out.dfree = &_log_adfree;
+    return 1;
+error:
+    if (async)
+    {
+        _log_async_free(async);
+    }
+    return 0;
+}
+
+void log_async_stop(log_t *log)
+{
+    _log_async_t *async = _log_async(log);
+    if (!async)
+    {
+        return;
+    }
+    _log_async_join(async);
+    buf_free(&log->out.data.buf);
+    buf_free(&log->out.data.opaque);
+    _log_bio_move(&log->out, &async->out);
+    _log_async_free(async);
+}
+ssize_t log_decode(bufferedio_t *in, bufferedio_t *out, int flags)
+{
+    /* all records read first, string definitions collected before rendering (may follow their use) */
+    buffer_t data = {0};
+    buffer_t strs = {0};
+    buffer_t defs = {0};
+    buffer_t line = {0};
+    ssize_t n = -1;
+    const unsigned char *p;
+    const unsigned char *end;
+    size_t i;
+    if (!bio_read_all(in, &data) || data.size < LOG_BIN_MAGICSZ || memcmp(data.data, LOG_BIN_MAGIC, LOG_BIN_MAGICSZ))
+    {
+        goto end;
+    }
+    end = (const unsigned char *)data.data + data.size;
+    for (p = (const unsigned char *)data.data + LOG_BIN_MAGICSZ; end - p >= LOG_BIN_HDRSZ;)
+    {
+        _log_reader_t r;
+        if (!_log_bin_frame(p, end, &r))
+        {
+            break;
+        }
+        if (*p == 'S')
+        {
+            /* string offset stored as pointer until strings stop moving */
+            _log_def_t def = {_log_get_u64(&r), (const char *)(uintptr_t)strs.size};
+            const size_t slen = (size_t)(r.end - r.p);
+            if (!(buf_push(&defs, &def, sizeof(def)) && _log_put(&strs, r.p, slen) && buf_push(&strs, "", 1)))
+            {
+                goto end;
+            }
+        }
+        p = r.end;
+    }
+    for (i = 0; i < defs.size / sizeof(_log_def_t); i++)
+    {
+        _log_def_t *def = (_log_def_t *)defs.data + i;
+        def->str = (const char *)strs.data + (uintptr_t)def->str;
+    }
+    qsort(defs.data, defs.size / sizeof(_log_def_t), sizeof(_log_def_t), &_log_def_cmp);
+    n = 0;
+    for (p = (const unsigned char *)data.data + LOG_BIN_MAGICSZ; end - p >= LOG_BIN_HDRSZ;)
+    {
+        _log_reader_t r;
+        if (!_log_bin_frame(p, end, &r))
+        {
+            break;
+        }
+        if ((*p == 'R' || *p == 'M') && _log_bin_render(&line, &defs, flags, (char)*p, &r) && line.size)
+        {
+            bio_write(out, line.data, line.size - 1); /* exclude null byte */
+            n++;
+        }
+        p = r.end;
+    }
+    n = p == end ? n : -1;
+end:
+    buf_free(&data);
+    buf_free(&strs);
+    buf_free(&defs);
+    buf_free(&line);
+    return n;
 }
\ No newline at end of file
@@ -8,6 +8,25 @@
 
 #include "bufferedio.h"
 
+/**
+ * @def LOG_RAWTIME
+ * @brief logging flag for raw numeric timestamps (wall clock and monotonic nanoseconds, no calendar date)
+ */
+#define LOG_RAWTIME 1
+
+/**
+ * @def LOG_BINARY
+ * @brief logging flag for binary records formatted later by @ref log_decode (e.g. tools/logdecode)
+ *
+ * Instead of formatting, a record stores ids of the format and file strings, line, level, timestamps,
+ * and the raw arguments (integers as varints, doubles in host byte order, strings copied).
+ * Each string is written once as a definition, keyed by its address, so only literals should be used as formats.
+ * Records are framed as a type byte and a 32-bit payload length after an 8-byte header ("CYLOGB1\n"):
+ * 'S' string definition (id, bytes), 'R' prefixed record, 'M' message record without prefix.
+ * Long doubles are stored as doubles, positional arguments ("%1$d") and wide strings are not supported.
+ */
+#define LOG_BINARY 2
+
 /**
  * @enum log_lvl
  * @brief logging level (applies standard prefix to log)
@@ -15,11 +34,39 @@
  */
 typedef enum log_lvl
 {
+    LOG_TRACE,   /** hot path tracing (compiled out unless below @ref LOG_FLOOR) */
+    LOG_DEBUG,   /** diagnostic detail for development */
     LOG_INFO,    /** general information */
     LOG_WARNING, /** deviation from normal operation */
     LOG_ERROR    /** significant fault prohibiting succesful operation */
 } log_lvl_t;
 
+/**
+ * @def LOG_FLOOR
+ * @brief lowest logging level compiled in, @ref log_printfl below it evaluates no arguments and makes no call
+ *
+ * Defaults to @ref LOG_INFO when NDEBUG is defined (make release), otherwise @ref LOG_TRACE (plain make).
+ * May be overriden at compile time (e.g. -DLOG_FLOOR=LOG_WARNING).
+ */
+#ifndef LOG_FLOOR
+#ifdef NDEBUG
+#define LOG_FLOOR LOG_INFO
+#else
+#define LOG_FLOOR LOG_TRACE
+#endif
+#endif
+
+/**
+ * @enum log_overflow
+ * @brief policy of asynchronous logging when the record queue is full
+ * @typedef log_overflow_t
+ */
+typedef enum log_overflow
+{
+    LOG_DROP, /** discard record and count it, callers never wait (count reported in log) */
+    LOG_BLOCK /** wait until background thread frees a queue slot, records never lost */
+} log_overflow_t;
+
 /**
  * @struct log
  * @brief logging context
@@ -29,6 +76,9 @@ typedef struct log
 {
     bufferedio_t out; /** buffered I/O context for log output destination */
     buffer_t buf;     /** buffer for formatting strings */
+    buffer_t defs;    /** addresses of strings already defined in binary log (see @ref LOG_BINARY) */
+    int flags;        /** flags controlling log format (e.g. @ref LOG_RAWTIME) */
+    log_lvl_t minlvl; /** records below this level are discarded (0 logs all levels) */
 } log_t;
 
 /**
@@ -39,6 +89,24 @@ typedef struct log
  */
 const char *log_lvlstr(log_lvl_t lvl);
 
+/**
+ * @brief parse logging level from its string representation (case insensitive)
+ *
+ * @param str string representation of logging level (e.g. "debug")
+ * @param[out] lvl logging level
+ * @return nonzero if parsed, 0 if not a logging level
+ */
+int log_lvlparse(const char *str, log_lvl_t *lvl);
+
+/**
+ * @brief parse queue overflow policy from its name (case insensitive)
+ *
+ * @param str name of policy ("drop" or "block")
+ * @param[out] policy queue overflow policy
+ * @return nonzero if parsed, 0 if not a policy
+ */
+int log_overflowparse(const char *str, log_overflow_t *policy);
+
 /**
  * @brief log formatted string directly
  *
@@ -47,7 +115,7 @@ const char *log_lvlstr(log_lvl_t lvl);
  * @param[inout] log logging context
  * @param fmt log string format
  * @param ... arguments for log string format
- * @return logged string stored in log context buffer, NULL if error
+ * @return logged string stored in log context buffer (fmt if queued asynchronously or binary), NULL if error or dropped
  */
 const char *log_printf(log_t *log, const char *fmt, ...);
 
@@ -56,6 +124,9 @@ const char *log_printf(log_t *log, const char *fmt, ...);
  *
  * Uses vsprintf for processing formatting.
  * Includes a timestamp, file, line number, and log level before the string.
+ * The timestamp is the wall clock date (formatted once per second and cached per thread)
+ * followed by the monotonic clock in seconds with nanosecond resolution (see @ref LOG_RAWTIME).
+ * When asynchronous, only the string is formatted by the caller, the background thread adds the prefix.
  *
  * @param[inout] log logging context
  * @param file filename (__FILE__)
@@ -63,21 +134,83 @@ const char *log_printf(log_t *log, const char *fmt, ...);
  * @param lvl logging level
  * @param fmt log string format
  * @param ... arguments for log string format
- * @return logged string stored in log context buffer, NULL if error
+ * @return logged string stored in log context buffer (fmt if queued asynchronously or binary),
+ * NULL if error, dropped, or below @ref log::minlvl
  */
 const char *log_printf_long(log_t *log, const char *file, int line, log_lvl_t lvl, const char *fmt, ...);
 
+/**
+ * @brief write log from a background thread, callers only queue records (lock-free, multi-producer)
+ *
+ * The log output is moved to the background thread, which formats and writes queued records in batches.
+ * @ref log::out becomes a buffered I/O context queueing its writes,
+ * @ref bio_flush waits until queued records are written and @ref bio_dfree writes all queued records first.
+ * Any number of threads may log concurrently (@ref log::buf is not used while asynchronous).
+ * The background thread blocks all signals, so asynchronous signals are only delivered to application threads.
+ *
+ * @param[inout] log logging context with usable output
+ * @param nrecs number of queue slots (rounded up to power of 2), each holding one record
+ * @param policy what callers do when the queue is full
+ * @return nonzero if started, 0 if failed (logging stays synchronous)
+ */
+int log_async_start(log_t *log, size_t nrecs, log_overflow_t policy);
+
+/**
+ * @brief write all queued records and return to synchronous logging
+ *
+ * The background thread is joined and @ref log::out is the original output again.
+ * Does nothing if logging is synchronous.
+ * Must not be invoked while other threads log.
+ *
+ * @param[inout] log logging context
+ */
+void log_async_stop(log_t *log);
+
+/**
+ * @brief render binary log records (see @ref LOG_BINARY) as text log lines
+ *
+ * All input is read first, so string definitions may appear after the records using them.
+ *
+ * @param[inout] in buffered I/O context holding a binary log
+ * @param[inout] out buffered I/O context to write text to
+ * @param flags flags controlling text format (e.g. @ref LOG_RAWTIME)
+ * @return number of records rendered, -1 if input is not a binary log or is truncated (rendered records are written)
+ */
+ssize_t log_decode(bufferedio_t *in, bufferedio_t *out, int flags);
+
+/**
+ * @def log_enabled
+ * @brief check whether records of a logging level are compiled in (@ref LOG_FLOOR) and not discarded (@ref log::minlvl)
+ *
+ * Constant folded to 0 for a constant level below @ref LOG_FLOOR.
+ *
+ * @param[in] log logging context
+ * @param lvl logging level
+ * @return nonzero if enabled
+ */
+#define log_enabled(log, lvl) ((lvl) >= LOG_FLOOR && (lvl) >= (log)->minlvl)
+
 /**
  * @def logfl
  * @brief alias of @ref logf_long auto-populating file and line inputs
  *
  * Uses vsprintf for processing formatting.
+ * Disabled levels (@ref log_enabled) are filtered before the format arguments are evaluated,
+ * levels below @ref LOG_FLOOR compile to nothing (statement expression, no unused value warnings).
  *
  * @param[inout] log logging context
  * @param lvl logging level
  * @param ... arguments for log string format, first argument must be log string format
- * @return logged string stored in log context buffer, NULL if error
+ * @return logged string stored in log context buffer, NULL if error or disabled
  */
-#define log_printfl(log, lvl, ...) log_printf_long(log, __FILE__, __LINE__, lvl, __VA_ARGS__)
+#define log_printfl(log, lvl, ...)                                                 \
+    ({                                                                             \
+        const char *_log_str = NULL;                                               \
+        if (log_enabled(log, lvl))                                                 \
+        {                                                                          \
+            _log_str = log_printf_long(log, __FILE__, __LINE__, lvl, __VA_ARGS__); \
+        }                                                                          \
+        _log_str;                                                                  \
+    })
 
 #endif
\ No newline at end of file
@@ -3,22 +3,44 @@
  * @author Rob Griffith
  */
 
+#include "catio.h"
 #include "cli.h"
+#include "command.h"
 #include "cypher.h"
+#include "daemon.h"
 #include "fdio.h"
 #include "log.h"
+#include "mmio.h"
+#include "ringio.h"
+#include "sockio.h"
 
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-#define DEF_BUFSZ "2056"
-#define DEF_STRSZ 128
+#define DEF_BUFSZ "auto"
+#define DEF_STRSZ 256
+#define DEF_SEGSZ (1 << 20)
+#define DEF_LOG_SEGSZ (1 << 16)
+#define DEF_LOG_RECS 1024 /* queue slots of --logqueue */
+#define DEF_LOG_RINGSZ "1048576" /* bytes of most recent log kept with negative --bufsize */
+#define DEF_SOCK_BUFSZ (1 << 16) /* buffer size for sockets with --bufsize auto */
+#define DEF_CATIO_BUFSZ (1 << 16) /* buffer size for --indir with --bufsize auto */
+#define DEF_CMD_BUFSZ (1 << 16) /* buffer size for files of --stdin-commands and --daemon with negative --bufsize */
+#define DEF_WORKERS "0" /* daemon worker threads, 0 for one per CPU */
 #define OUTFILE_FLAG (O_WRONLY | O_CREAT | O_TRUNC)
 #define OUTFILE_MODE (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH)
 
+bufring_t *_fatal_ring;   /* log ring dumped by fatal signal handler, NULL if none */
+const char *_fatal_path; /* log file path written by fatal signal handler */
+
 /**
  * @brief check stream health and print status if in bad state
  *
@@ -42,27 +64,113 @@ bufferedio_t *_check_stream_status(log_t *log, bufferedio_t *bio, const char *na
     return rv;
 }
 
-log_t *_init_log(cli_t *cli, int bufsz, log_t *log)
+/**
+ * @brief wrap entire regular file in memory mapping instead of reading it
+ *
+ * @param[inout] bio buffered I/O context, zeroed if file cannot be mapped
+ * @param fd file descriptor (closed once mapped if cflags has FDIO_CLOSE)
+ * @param cflags fdio flags for controlling manipulation of fd
+ * @return buffered I/O context, NULL if not mapped (fd left open)
+ */
+bufferedio_t *_map_all(bufferedio_t *bio, int fd, int cflags)
+{
+    mmio_wrap(bio, fd, cflags & FDIO_CLOSE ? MMIO_CLOSE : 0);
+    if (bio_status(bio) <= BIO_STATUS_INIT)
+    {
+        bio_dfree(bio);
+        memset(bio, 0, sizeof(*bio));
+        return NULL;
+    }
+    return bio;
+}
+
+/**
+ * @brief write log ring to log file upon fatal signal, then re-raise it (async-signal-safe)
+ *
+ * The mirrored ring holds the most recent lines as one contiguous span, no formatting or allocation needed.
+ *
+ * @param sig the signal number
+ */
+void _dump_fatal(int sig)
+{
+    static const char note[] = "(fatal signal, log ring dumped)\n";
+    const int fd = _fatal_ring ? open(_fatal_path, OUTFILE_FLAG, OUTFILE_MODE) : -1;
+    if (fd >= 0)
+    {
+        size_t sz;
+        const char *head = bring_head(_fatal_ring, &sz);
+        ssize_t wsz = 1;
+        while (sz && (wsz = write(fd, head, sz)) > 0)
+        {
+            head += wsz;
+            sz -= (size_t)wsz;
+        }
+        wsz = write(fd, note, sizeof(note) - 1);
+        close(fd);
+    }
+    /* default action restored (SA_RESETHAND) */
+    raise(sig);
+}
+
+/**
+ * @brief dump log ring to log file if the process is killed by a fatal signal
+ *
+ * @param ring log ring (NULL to stop dumping)
+ * @param path log file path
+ */
+void _dump_on_fatal(bufring_t *ring, const char *path)
+{
+    const int sigs[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM, SIGINT};
+    struct sigaction sa = {0};
+    sa.sa_handler = ring ? &_dump_fatal : SIG_DFL;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    _fatal_path = path;
+    _fatal_ring = ring;
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+    {
+        sigaction(sigs[i], &sa, NULL);
+    }
+}
+
+log_t *_init_log(cli_t *cli, int bufsz, int bflags, log_t *log, bufring_t *ring)
 {
     log_t *rv = log;
     const cli_opt_t *logopt = cli_get_opt(cli, "logfile");
     if (logopt && logopt->val)
     {
-        if (bufsz < 0)
+        const cli_opt_t *atopt = cli_get_opt(cli, "atomic");
+        if (atopt && atopt->val)
         {
-            /* infinite memory, storing string */
-            bio_wrap(&log->out, NULL);
+            /* bounded memory, file replaced only upon commit */
+            fdio_wrap_atomic(&log->out, logopt->val, OUTFILE_MODE, bufsz, bflags);
+        }
+        else if (bufsz < 0 && ring && !(log->flags & LOG_BINARY))
+        {
+            /* bounded memory, oldest lines dropped (binary records are not lines) */
+            const cli_opt_t *ringopt = cli_get_opt(cli, "logring");
+            const long ringsz = atol(ringopt && ringopt->val ? ringopt->val : DEF_LOG_RINGSZ);
+            bring_init(ring, ringsz > 0 ? (size_t)ringsz : 1);
+            ringio_wrap(&log->out, ring, RINGIO_OVERWRITE | RINGIO_FREE);
+            _dump_on_fatal(ring->data ? ring : NULL, logopt->val);
+        }
+        else if (bufsz < 0)
+        {
+            /* infinite memory, storing string in chunks */
+            bufseg_t seg = {0};
+            bseg_init(&seg, DEF_LOG_SEGSZ, 0);
+            bio_wrap_seg(&log->out, &seg);
         }
         else
         {
-            fdio_wrap(&log->out, open(logopt->val, OUTFILE_FLAG, OUTFILE_MODE), bufsz, FDIO_CLOSE);
+            fdio_wrap(&log->out, open(logopt->val, OUTFILE_FLAG, OUTFILE_MODE), bufsz, FDIO_CLOSE | bflags);
         }
         rv = _check_stream_status(log, &log->out, "log file") ? log : NULL;
     }
     return rv;
 }
 
-bufferedio_t *_init_key(cli_t *cli, int bufsz, log_t *log, bufferedio_t *bio)
+bufferedio_t *_init_key(cli_t *cli, int bufsz, int bflags, log_t *log, bufferedio_t *bio)
 {
     const cli_opt_t *kfopt = cli_get_opt(cli, "keyfile");
     const cli_arg_t *keyarg = cli_get_arg(cli, "key");
@@ -70,13 +178,19 @@ bufferedio_t *_init_key(cli_t *cli, int bufsz, log_t *log, bufferedio_t *bio)
     {
         /* keyfile */
         log_printfl(log, LOG_INFO, "using bytes in file \"%s\" as key\n", keyarg->val);
-        fdio_wrap(bio, open(keyarg->val, O_RDONLY), bufsz < 0 ? 0 : bufsz, FDIO_CLOSE);
-        buffer_t buf = {0};
-        if (bufsz < 0 && bio_read_all(bio, &buf))
+        const int fd = open(keyarg->val, O_RDONLY);
+        if (bufsz >= 0 || !_map_all(bio, fd, FDIO_CLOSE))
         {
-            bufferedio_t kfdb = *bio;
-            bio_wrap(bio, &buf);
-            bio_dfree(&kfdb);
+            fdio_wrap(bio, fd, bufsz < 0 ? 0 : bufsz, FDIO_CLOSE | bflags);
+            buffer_t buf = {0};
+            if (bufsz < 0 && bio_read_all(bio, &buf))
+            {
+                /* replace file stream in place, contexts are never copied bitwise */
+                bio_dfree(bio);
+                memset(bio, 0, sizeof(*bio));
+                bio_wrap(bio, &buf);
+            }
+            buf_free(&buf);
         }
     }
     else
@@ -87,44 +201,192 @@ bufferedio_t *_init_key(cli_t *cli, int bufsz, log_t *log, bufferedio_t *bio)
     return _check_stream_status(log, bio, "key");
 }
 
-bufferedio_t *_init_input(cli_t *cli, int bufsz, log_t *log, bufferedio_t *bio)
+/**
+ * @brief wrap file descriptor, using socket buffered I/O for stream sockets (other sockets use fdio)
+ *
+ * @param[inout] bio buffered I/O context
+ * @param fd file descriptor
+ * @param bufsz buffer size (ignored with FDIO_AUTO)
+ * @param cflags fdio flags for controlling manipulation of fd (FDIO_AUTO for automatic buffer size)
+ * @return buffered I/O context
+ */
+bufferedio_t *_wrap_fd(bufferedio_t *bio, int fd, int bufsz, int cflags)
+{
+    struct stat st;
+    int type = 0;
+    socklen_t len = sizeof(type);
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode) &&
+        getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 && type == SOCK_STREAM)
+    {
+        /* batched sends, zero-copy left off as every large write would wait on its completion */
+        const int sflags = (cflags & FDIO_CLOSE) ? SOCKIO_CLOSE : 0;
+        sockio_wrap(bio, fd, (cflags & FDIO_AUTO) ? DEF_SOCK_BUFSZ : bufsz, sflags);
+    }
+    else
+    {
+        fdio_wrap(bio, fd, bufsz, cflags);
+    }
+    return bio;
+}
+
+/**
+ * @brief list paths of regular files in directory, sorted by name
+ *
+ * @param dir directory path
+ * @param[out] strs buffer holding concatenated null-terminated paths
+ * @param[out] paths buffer holding array of pointers into strs
+ * @return number of paths listed, -1 if directory could not be scanned
+ */
+int _list_dir(const char *dir, buffer_t *strs, buffer_t *paths)
+{
+    struct dirent **ents = NULL;
+    const int n = scandir(dir, &ents, NULL, alphasort);
+    buffer_t offs = {0};
+    int rv = 0;
+    int i;
+    if (n < 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        struct stat st;
+        const size_t off = strs->size;
+        if (buf_push(strs, dir, strlen(dir)) && buf_push(strs, "/", 1) &&
+            buf_push(strs, ents[i]->d_name, strlen(ents[i]->d_name) + 1) &&
+            stat((const char *)strs->data + off, &st) == 0 && S_ISREG(st.st_mode) &&
+            buf_push(&offs, &off, sizeof(off)))
+        {
+            rv++;
+        }
+        else
+        {
+            /* skip non-regular files (including . and ..) */
+            buf_resize(strs, off);
+        }
+        free(ents[i]);
+    }
+    free(ents);
+    /* pointers built once strs is no longer reallocated */
+    for (i = 0; i < rv; i++)
+    {
+        const char *path = (const char *)strs->data + ((const size_t *)offs.data)[i];
+        if (!buf_push(paths, &path, sizeof(path)))
+        {
+            rv = i;
+            break;
+        }
+    }
+    buf_free(&offs);
+    return rv;
+}
+
+/**
+ * @brief replace stream with segmented buffer holding all of its bytes
+ *
+ * @param[inout] bio buffered I/O context, kept to report its status if reading failed
+ * @return buffered I/O context, NULL if not entirely read
+ */
+bufferedio_t *_read_all(bufferedio_t *bio)
+{
+    bufseg_t seg = {0};
+    if (bseg_init(&seg, DEF_SEGSZ, BSEG_MMAP) && bio_read_all_seg(bio, &seg))
+    {
+        bio_dfree(bio);
+        memset(bio, 0, sizeof(*bio));
+        bio_wrap_seg(bio, &seg);
+        return bio;
+    }
+    bseg_free(&seg);
+    return NULL;
+}
+
+bufferedio_t *_init_input(cli_t *cli, int bufsz, int bflags, log_t *log, bufferedio_t *bio)
 {
     const cli_opt_t *ifopt = cli_get_opt(cli, "infile");
+    const cli_opt_t *idopt = cli_get_opt(cli, "indir");
     int fd, cflags;
+    if (idopt && idopt->val)
+    {
+        /* input directory, files concatenated in name order */
+        buffer_t strs = {0};
+        buffer_t paths = {0};
+        const int n = _list_dir(idopt->val, &strs, &paths);
+        log_printfl(log, LOG_INFO, "using bytes in %d files of directory \"%s\" as input\n", n, idopt->val);
+        catio_wrap(bio, paths.data, n < 0 ? 0 : n, bufsz < 0 ? 0 : (bflags ? DEF_CATIO_BUFSZ : bufsz));
+        if (n < 0)
+        {
+            const char *fmt = "failed to scan input directory \"%s\"\n";
+            fprintf(stderr, fmt, idopt->val);
+            log_printfl(log, LOG_ERROR, fmt, idopt->val);
+            bio_dfree(bio);
+            memset(bio, 0, sizeof(*bio));
+        }
+        else if (bufsz < 0)
+        {
+            /* read entire input into memory chunks */
+            _read_all(bio);
+        }
+        buf_free(&paths);
+        buf_free(&strs);
+        return _check_stream_status(log, bio, "input");
+    }
     if (ifopt && ifopt->val)
     {
         /* input file */
         log_printfl(log, LOG_INFO, "using bytes in file \"%s\" as input\n", ifopt->val);
         fd = open(ifopt->val, O_RDONLY);
-        cflags = FDIO_CLOSE;
+        cflags = FDIO_CLOSE | FDIO_SPARSE;
     }
     else
     {
         fd = STDIN_FILENO;
         cflags = 0;
     }
-    fdio_wrap(bio, fd, bufsz < 0 ? 0 : bufsz, cflags);
-    buffer_t buf = {0};
-    if (bufsz < 0 && bio_read_all(bio, &buf))
+    if (bufsz < 0 && _map_all(bio, fd, cflags))
+    {
+        /* regular file mapped entirely, no reading or copying into memory */
+    }
+    else if (bufsz < 0)
+    {
+        /* read entire input into memory chunks, never moving bytes already read */
+        _wrap_fd(bio, fd, 0, cflags);
+        _read_all(bio);
+    }
+    else
     {
-        bufferedio_t ifdb = *bio;
-        bio_wrap(bio, &buf);
-        bio_dfree(&ifdb);
+        _wrap_fd(bio, fd, bufsz, cflags | bflags);
     }
     return _check_stream_status(log, bio, "input");
 }
 
-bufferedio_t *_init_output(cli_t *cli, int bufsz, log_t *log, bufferedio_t *bio)
+bufferedio_t *_init_output(cli_t *cli, int bufsz, int bflags, log_t *log, bufferedio_t *bio)
 {
     const cli_opt_t *ofopt = cli_get_opt(cli, "outfile");
+    const cli_opt_t *atopt = cli_get_opt(cli, "atomic");
     int fd, cflags;
-    if (bufsz < 0)
+    if (atopt && atopt->val && ofopt && ofopt->val)
+    {
+        /* bounded memory, file replaced only upon commit */
+        log_printfl(log, LOG_INFO, "writing program output atomically to file \"%s\"\n", ofopt->val);
+        fdio_wrap_atomic(bio, ofopt->val, OUTFILE_MODE, bufsz, bflags);
+    }
+    else if (bufsz < 0)
     {
         /* fully buffered */
-        bio_wrap(bio, NULL);
+        bufseg_t seg = {0};
+        bseg_init(&seg, DEF_SEGSZ, BSEG_MMAP);
+        bio_wrap_seg(bio, &seg);
     }
     else
     {
+        if (atopt && atopt->val)
+        {
+            /* only files are replaced, standard output streams as written */
+            const char *fmt = "atomic without output file, standard output is not written atomically\n";
+            fprintf(stderr, fmt);
+            log_printfl(log, LOG_WARNING, fmt);
+        }
         if (ofopt && ofopt->val)
         {
             /* output file */
@@ -137,24 +399,114 @@ bufferedio_t *_init_output(cli_t *cli, int bufsz, log_t *log, bufferedio_t *bio)
             fd = STDOUT_FILENO;
             cflags = 0;
         }
-        fdio_wrap(bio, fd, bufsz < 0 ? 0 : bufsz, cflags);
+        _wrap_fd(bio, fd, bufsz < 0 ? 0 : bufsz, cflags | bflags);
     }
     return _check_stream_status(log, bio, "output");
 }
 
-int _flush_bio_buffers(cli_t *cli, log_t *log, bufferedio_t *output)
+/**
+ * @brief write all bytes of segmented buffer without copying
+ *
+ * @param bio buffered I/O context to write to
+ * @param seg segmented buffer to write
+ * @return number of bytes written
+ */
+size_t _write_seg(bufferedio_t *bio, const bufseg_t *seg)
+{
+    size_t rv = 0;
+    size_t idx = 0;
+    size_t csz;
+    const void *chunk;
+    while ((chunk = bseg_chunk(seg, idx++, &csz)))
+    {
+        const size_t wsz = bio_write(bio, chunk, csz);
+        rv += wsz;
+        if (wsz != csz)
+        {
+            break;
+        }
+    }
+    return rv;
+}
+
+/**
+ * @brief write log kept in memory (segmented buffer or ring of most recent lines) to log file, then close it
+ *
+ * @param cli command line input context
+ * @param[inout] log logging context (output freed and zeroed)
+ * @param ring log ring, used if initialized
+ * @return nonzero if written (or no log file requested), 0 if error
+ */
+int _dump_log(cli_t *cli, log_t *log, const bufring_t *ring)
+{
+    int rv = 1; /* return 0 on error */
+    if (bio_status(&log->out) <= BIO_STATUS_INIT)
+    {
+        /* no log file requested */
+        return rv;
+    }
+    log_t logfinal = {0};
+    size_t size = 0;
+    size_t wsz = 0;
+    if (_init_log(cli, 0, 0, &logfinal, NULL))
+    {
+        if (ring && ring->data)
+        {
+            /* most recent lines are one contiguous span */
+            size_t lines;
+            const size_t dropped = ringio_dropped(&log->out, &lines);
+            if (dropped)
+            {
+                log_printf(&logfinal, "(log ring dropped oldest %zu bytes, %zu lines)\n", dropped, lines);
+            }
+            const void *head = bring_head(ring, &size);
+            wsz = bio_write(&logfinal.out, head, size);
+        }
+        else
+        {
+            const bufseg_t *logseg = log->out.data.opaque.data;
+            size = logseg->size;
+            wsz = _write_seg(&logfinal.out, logseg);
+        }
+        if (wsz != size)
+        {
+            const char *fmt = "only wrote %zu of %zu bytes in fully buffered log\n";
+            fprintf(stderr, fmt, wsz, size);
+        }
+    }
+    else
+    {
+        const char *fmt = "failed to initialize final stream for writing fully buffered log\n";
+        fprintf(stderr, fmt);
+        rv = 0;
+    }
+    bio_dfree(&logfinal.out);
+    buf_free(&logfinal.buf);
+    /* ring unmapped with log output, not dumped again */
+    _dump_on_fatal(NULL, NULL);
+    bio_dfree(&log->out);
+    memset(&log->out, 0, sizeof(log->out));
+    return rv;
+}
+
+int _flush_bio_buffers(cli_t *cli, log_t *log, bufring_t *ring, bufferedio_t *output)
 {
     int rv = 1; /* return 0 on error */
     /** write output entirely buffered in memory */
+    const bufseg_t *outseg = output ? output->data.opaque.data : NULL;
     bufferedio_t outfinal = {0};
-    if (_init_output(cli, 0, log, &outfinal))
+    if (!outseg)
+    {
+        /* output streamed, only log kept in memory */
+    }
+    else if (_init_output(cli, 0, 0, log, &outfinal))
     {
-        const size_t wsz = bio_write(&outfinal, output->data.buf.data, output->data.buf.size);
-        if (wsz != output->data.buf.size)
+        const size_t wsz = _write_seg(&outfinal, outseg);
+        if (wsz != outseg->size)
         {
             const char *fmt = "only wrote %zu of %zu bytes in fully buffered output\n";
-            log_printfl(log, LOG_WARNING, fmt, wsz, output->data.buf.size);
-            fprintf(stderr, fmt, wsz, output->data.buf.size);
+            log_printfl(log, LOG_WARNING, fmt, wsz, outseg->size);
+            fprintf(stderr, fmt, wsz, outseg->size);
         }
     }
     else
@@ -165,24 +517,153 @@ int _flush_bio_buffers(cli_t *cli, log_t *log, bufferedio_t *output)
         rv = 0;
     }
     bio_dfree(&outfinal);
-    /** write log entirely buffered in memory */
-    log_t logfinal = {0};
-    if (_init_log(cli, 0, &logfinal))
+    return _dump_log(cli, log, ring) && rv;
+}
+
+/**
+ * @brief log end of run summary of final status (buffer size) and I/O counters for all streams
+ *
+ * @param log logging context
+ * @param key key buffered I/O context
+ * @param input input buffered I/O context (NULL if unused)
+ * @param output output buffered I/O context (NULL if unused)
+ */
+void _log_stats(log_t *log, bufferedio_t *key, bufferedio_t *input, bufferedio_t *output)
+{
+    if (bio_status(&log->out) <= BIO_STATUS_INIT)
     {
-        const size_t wsz = bio_write(&logfinal.out, log->out.data.buf.data, log->out.data.buf.size);
-        if (wsz != log->out.data.buf.size)
-        {
-            const char *fmt = "only wrote %zu of %zu bytes in fully buffered log\n";
-            fprintf(stderr, fmt, wsz, log->out.data.buf.size);
-        }
+        /* checking log status before to save bio_status_str work */
+        return;
+    }
+    /* status string includes I/O counters */
+    char sstr[DEF_STRSZ];
+    const char *fmt = "%s stream final: %s\n";
+    log_printfl(log, LOG_INFO, fmt, "key", bio_status_str(key, sstr, sizeof(sstr)));
+    if (input)
+    {
+        log_printfl(log, LOG_INFO, fmt, "input", bio_status_str(input, sstr, sizeof(sstr)));
+    }
+    if (output)
+    {
+        log_printfl(log, LOG_INFO, fmt, "output", bio_status_str(output, sstr, sizeof(sstr)));
+    }
+    log_printfl(log, LOG_INFO, fmt, "log", bio_status_str(&log->out, sstr, sizeof(sstr)));
+}
+
+/**
+ * @brief run command lines of input, writing one result line per command to output
+ *
+ * Key hashes and file buffers stay warm between commands, the key argument is the default key.
+ *
+ * @param log logging context
+ * @param bufsz buffer size
+ * @param bflags FDIO_AUTO for automatic buffer size, 0 otherwise
+ * @param key_hash hash of key argument
+ * @param input command stream
+ * @param output result stream
+ */
+void _run_commands(log_t *log, int bufsz, int bflags, const sha256hash_t *key_hash, bufferedio_t *input, bufferedio_t *output)
+{
+    cmd_cache_t cache = {0};
+    cmd_ctx_t ctx = {0};
+    ctx.log = log;
+    ctx.defkey = key_hash;
+    ctx.cache = &cache;
+    ctx.bufsz = bufsz < 0 ? DEF_CMD_BUFSZ : bufsz;
+    ctx.cflags = bflags;
+    cmd_serve(&ctx, input, output);
+    log_printfl(log, LOG_INFO, "ran %zu commands (%zu failed), %zu key hash cache hits\n", ctx.ncmds, ctx.nfailed, ctx.nhits);
+    cmd_ctx_free(&ctx);
+    cmd_cache_free(&cache);
+}
+
+/**
+ * @brief serve commands of clients connected to Unix domain socket until SIGINT or SIGTERM
+ *
+ * @param cli command line interface
+ * @param log logging context
+ * @param logasync nonzero if log is written from the background thread (workers log only then)
+ * @param bufsz buffer size
+ * @param bflags FDIO_AUTO for automatic buffer size, 0 otherwise
+ * @param key_hash hash of key argument
+ * @return 1 if served until signaled, 0 if failed to start
+ */
+int _run_daemon(cli_t *cli, log_t *log, int logasync, int bufsz, int bflags, const sha256hash_t *key_hash)
+{
+    const cli_opt_t *dopt = cli_get_opt(cli, "daemon");
+    const cli_opt_t *wopt = cli_get_opt(cli, "workers");
+    const long optworkers = atol(wopt && wopt->val ? wopt->val : DEF_WORKERS);
+    const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t nworkers = optworkers > 0 ? (size_t)optworkers : (ncpu > 0 ? (size_t)ncpu : 1);
+    cmd_cache_t cache = {0};
+    cmd_ctx_t conf = {0};
+    conf.log = logasync ? log : NULL;
+    conf.defkey = key_hash;
+    conf.cache = &cache;
+    conf.bufsz = bufsz < 0 ? DEF_CMD_BUFSZ : bufsz;
+    conf.cflags = bflags;
+    if (!logasync && bio_status(&log->out) > BIO_STATUS_INIT)
+    {
+        log_printfl(log, LOG_WARNING, "no background log thread, daemon workers will not log\n");
+    }
+    log_printfl(log, LOG_INFO, "serving commands on unix socket \"%s\" with %zu workers\n", dopt->val, nworkers);
+    const int rv = daemon_serve(dopt->val, nworkers, &conf);
+    if (rv)
+    {
+        log_printfl(log, LOG_INFO, "ran %zu commands (%zu failed), %zu key hash cache hits\n", conf.ncmds, conf.nfailed, conf.nhits);
     }
     else
     {
-        const char *fmt = "failed to initialize final stream for writing fully buffered log\n";
-        fprintf(stderr, fmt);
+        const char *fmt = "failed to serve on unix socket \"%s\": %s\n";
+        fprintf(stderr, fmt, dopt->val, strerror(errno));
+        log_printfl(log, LOG_ERROR, fmt, dopt->val, strerror(errno));
+    }
+    cmd_cache_free(&cache);
+    return rv;
+}
+
+/**
+ * @brief commit atomic output and log files, once input and output are known to be intact
+ *
+ * @param log log whose output is committed if written atomically
+ * @param input input stream of the run, NULL if none
+ * @param output output stream written atomically, NULL if none
+ * @return 1 if committed, 0 on error (temporary files left to be discarded)
+ */
+int _commit_atomic(log_t *log, bufferedio_t *input, bufferedio_t *output)
+{
+    int rv = 1; /* return 0 on error */
+    char sstr[DEF_STRSZ];
+    bufferedio_t *bad = input && bio_status(input) < BIO_STATUS_INIT ? input : NULL;
+    bad = !bad && output && bio_status(output) < BIO_STATUS_INIT ? output : bad;
+    if (bad)
+    {
+        /* partial output never replaces the previous file */
+        const char *fmt = "%s stream failed, not committing output: %s\n";
+        const char *name = bad == input ? "input" : "output";
+        bio_status_str(bad, sstr, sizeof(sstr));
+        log_printfl(log, LOG_ERROR, fmt, name, sstr);
+        fprintf(stderr, fmt, name, sstr);
+        rv = 0;
+    }
+    else if (output && fdio_commit(output))
+    {
+        log_printfl(log, LOG_INFO, "committed output stream\n");
+    }
+    else if (output)
+    {
+        const char *fmt = "failed to commit output stream: %s\n";
+        bio_status_str(output, sstr, sizeof(sstr));
+        log_printfl(log, LOG_ERROR, fmt, sstr);
+        fprintf(stderr, fmt, sstr);
+        rv = 0;
+    }
+    if (bio_status(&log->out) > BIO_STATUS_INIT && !fdio_commit(&log->out))
+    {
+        const char *fmt = "failed to commit log stream: %s\n";
+        fprintf(stderr, fmt, bio_status_str(&log->out, sstr, sizeof(sstr)));
         rv = 0;
     }
-    bio_dfree(&outfinal);
     return rv;
 }
 
@@ -191,6 +672,7 @@ int main(int argc, char **argv)
     /* core objects */
     int rv = 0;
     log_t log = {0};
+    bufring_t logring = {0}; /* log kept in memory with negative --bufsize */
     bufferedio_t key = {0};
     bufferedio_t input = {0};
     bufferedio_t output = {0};
@@ -205,10 +687,20 @@ int main(int argc, char **argv)
     cli_opt_t opts[] = {
         {'h', "help", "print application usage (to stderr)", NULL, NULL, NULL},
         {'s', "sha256", "output SHA256 hash of key (ignore input)", NULL, NULL, NULL},
-        {'b', "bufsize", "set buffer size for file io in bytes", "bytes", DEF_BUFSZ, NULL},
+        {'c', "stdin-commands", "run command lines of input, one result line each (key is the default key)", NULL, NULL, NULL},
+        {'D', "daemon", "serve commands of clients of unix socket at path until SIGTERM (ignore input)", "path", NULL, NULL},
+        {'w', "workers", "number of daemon worker threads (0 for one per CPU)", "count", DEF_WORKERS, NULL},
+        {'b', "bufsize", "set buffer size for file io in bytes (or auto)", "bytes", DEF_BUFSZ, NULL},
+        {'a', "atomic", "replace output and log files only upon success", NULL, NULL, NULL},
         {'k', "keyfile", "use bytes of file at <key> argument as key", NULL, NULL, NULL},
         {'l', "logfile", "log verbose info to filepath", "path", NULL, NULL},
+        {'L', "loglevel", "log only records at or above level (trace, debug, info, warning, error)", "level", "info", NULL},
+        {'r', "logring", "keep only most recent bytes of log in memory with negative bufsize", "bytes", DEF_LOG_RINGSZ, NULL},
+        {'t', "lograwtime", "log raw numeric timestamps (nanoseconds) instead of dates", NULL, NULL, NULL},
+        {'B', "logbinary", "log binary records, rendered later by logdecode (cheaper)", NULL, NULL, NULL},
+        {'q', "logqueue", "write log from a background thread, drop or block when it falls behind", "policy", NULL, NULL},
         {'i', "infile", "read input from filepath (instead of stdin)", "path", NULL, NULL},
+        {'d', "indir", "read input from files in directory, concatenated in name order", "path", NULL, NULL},
         {'o', "outfile", "write output to filepath (instead of stdout)", "path", NULL, NULL}};
     cli_t cli = {
         NULL,
@@ -226,14 +718,53 @@ int main(int argc, char **argv)
     {
         cli_print_usage(&cli);
     }
+    opt = cli_get_opt(&cli, "atomic");
+    const int atomic = opt && opt->val;
     opt = cli_get_opt(&cli, "bufsize");
-    const int bufsz = atoi(opt ? opt->val : DEF_BUFSZ);
+    const char *bufszstr = opt ? opt->val : DEF_BUFSZ;
+    const int optauto = strcmp(bufszstr, "auto") == 0;
+    const int optbufsz = optauto ? 0 : atoi(bufszstr);
+    /* atomic files give the same all or nothing result as full buffering in bounded memory */
+    const int atomicauto = atomic && optbufsz < 0;
+    /* automatic sizing carried as fdio flag, every size stays a literal size */
+    const int bflags = optauto || atomicauto ? FDIO_AUTO : 0;
+    const int bufsz = atomicauto ? 0 : optbufsz;
+    opt = cli_get_opt(&cli, "loglevel");
+    if (opt && opt->val && !log_lvlparse(opt->val, &log.minlvl))
+    {
+        fprintf(stderr, "unknown log level \"%s\"\n", opt->val);
+        cli_print_usage(&cli);
+        goto error;
+    }
+    opt = cli_get_opt(&cli, "logqueue");
+    const int logqueue = opt && opt->val;
+    /* daemon workers log concurrently, only possible through the queue (never dropping by default) */
+    log_overflow_t policy = LOG_BLOCK;
+    if (logqueue && !log_overflowparse(opt->val, &policy))
+    {
+        fprintf(stderr, "unknown log queue policy \"%s\"\n", opt->val);
+        cli_print_usage(&cli);
+        goto error;
+    }
+    opt = cli_get_opt(&cli, "lograwtime");
+    log.flags |= opt && opt->val ? LOG_RAWTIME : 0;
+    opt = cli_get_opt(&cli, "logbinary");
+    log.flags |= opt && opt->val ? LOG_BINARY : 0;
+    opt = cli_get_opt(&cli, "stdin-commands");
+    const int commands = opt && opt->val;
+    opt = cli_get_opt(&cli, "daemon");
+    const char *daemon = opt ? opt->val : NULL;
+    opt = cli_get_opt(&cli, "sha256");
+    /* daemon commands open their own files, input and output never touched (unless only hashing the key) */
+    const int streams = !daemon || (opt && opt->val);
+    /* commands and results stream while the controller waits on them, never held in memory until exit */
+    const int iobufsz = commands && bufsz < 0 ? DEF_CMD_BUFSZ : bufsz;
     /* initialization (let all core objects attempt to initialize) */
     size_t init_err = 0;
-    init_err += _init_log(&cli, bufsz, &log) ? 0 : 1;
-    init_err += _init_key(&cli, bufsz, &log, &key) ? 0 : 1;
-    init_err += _init_input(&cli, bufsz, &log, &input) ? 0 : 1;
-    init_err += _init_output(&cli, bufsz, &log, &output) ? 0 : 1;
+    init_err += _init_log(&cli, bufsz, bflags, &log, &logring) ? 0 : 1;
+    init_err += _init_key(&cli, bufsz, bflags, &log, &key) ? 0 : 1;
+    init_err += streams && !_init_input(&cli, iobufsz, bflags, &log, &input) ? 1 : 0;
+    init_err += streams && !_init_output(&cli, iobufsz, bflags, &log, &output) ? 1 : 0;
     if (init_err)
     {
         /* failed initialization */
@@ -242,7 +773,24 @@ int main(int argc, char **argv)
         log_printfl(&log, LOG_ERROR, fmt);
         goto error;
     }
-    if (bufsz == 0)
+    int logasync = 0;
+    if ((logqueue || daemon) && bio_status(&log.out) > BIO_STATUS_INIT)
+    {
+        logasync = log_async_start(&log, DEF_LOG_RECS, policy);
+        if (!logasync)
+        {
+            log_printfl(&log, LOG_WARNING, "failed to start background log thread, logging synchronously\n");
+        }
+    }
+    if (atomicauto)
+    {
+        log_printfl(&log, LOG_INFO, "atomic output, using automatic buffer size instead of %d\n", optbufsz);
+    }
+    if (bflags)
+    {
+        log_printfl(&log, LOG_INFO, "automatic buffer size, adjusting to measured throughput\n");
+    }
+    else if (bufsz == 0)
     {
         log_printfl(&log, LOG_INFO, "buffer size 0, not buffer inputs or outputs\n");
     }
@@ -250,6 +798,10 @@ int main(int argc, char **argv)
     {
         log_printfl(&log, LOG_INFO, "buffer size %d < 0, will use unlimited size\n", bufsz);
     }
+    if (iobufsz != bufsz)
+    {
+        log_printfl(&log, LOG_INFO, "running commands, streaming input and output with buffer size %d\n", iobufsz);
+    }
     if (bio_status(&log.out) > BIO_STATUS_INIT)
     {
         /* checking log status before to save bio_status_str work */
@@ -257,8 +809,11 @@ int main(int argc, char **argv)
         const char *fmt = "%s stream: %s\n";
         log_printfl(&log, LOG_INFO, fmt, "log", bio_status_str(&log.out, sstr, sizeof(sstr)));
         log_printfl(&log, LOG_INFO, fmt, "key", bio_status_str(&key, sstr, sizeof(sstr)));
-        log_printfl(&log, LOG_INFO, fmt, "input", bio_status_str(&input, sstr, sizeof(sstr)));
-        log_printfl(&log, LOG_INFO, fmt, "output", bio_status_str(&output, sstr, sizeof(sstr)));
+        if (streams)
+        {
+            log_printfl(&log, LOG_INFO, fmt, "input", bio_status_str(&input, sstr, sizeof(sstr)));
+            log_printfl(&log, LOG_INFO, fmt, "output", bio_status_str(&output, sstr, sizeof(sstr)));
+        }
     }
     /* main work */
     sha256hash_t key_hash;
@@ -273,22 +828,56 @@ int main(int argc, char **argv)
         {
             bio_write(&output, hash_str.str, strlen(hash_str.str));
             /* no more work, output is only hash */
-            goto end;
+            goto flush;
         }
     }
+    if (daemon)
+    {
+        rv = !_run_daemon(&cli, &log, logasync, bufsz, bflags, &key_hash);
+        goto flush;
+    }
+    if (commands)
+    {
+        _run_commands(&log, bufsz, bflags, &key_hash, &input, &output);
+        goto flush;
+    }
     const size_t csz = cypher_xor(&input, &key_hash, &output);
     log_printfl(&log, LOG_INFO, "encoded %zu bytes\n", csz);
-    if (bufsz < 0 && !_flush_bio_buffers(&cli, &log, &output))
+flush:
+    if (streams && iobufsz >= 0)
+    {
+        /* count pending output in summary */
+        bio_flush(&output);
+    }
+    _log_stats(&log, &key, streams ? &input : NULL, streams ? &output : NULL);
+    /* log output handled directly from here on (committed or written from memory) */
+    log_async_stop(&log);
+    if (bufsz < 0 && !_flush_bio_buffers(&cli, &log, &logring, streams && iobufsz < 0 ? &output : NULL))
+    {
+        goto error;
+    }
+    /* daemon runs still commit their log, output only committed if it is a file written atomically */
+    opt = cli_get_opt(&cli, "outfile");
+    bufferedio_t *atomicout = streams && opt && opt->val ? &output : NULL;
+    if (atomic && !_commit_atomic(&log, streams ? &input : NULL, atomicout))
     {
         goto error;
     }
     goto end;
 error:
     rv = 1;
+    if (logring.data)
+    {
+        /* keep most recent log of failed run */
+        log_async_stop(&log);
+        _dump_log(&cli, &log, &logring);
+    }
 end:
     bio_dfree(&output);
     bio_dfree(&input);
     bio_dfree(&key);
     bio_dfree(&log.out);
+    buf_free(&log.buf);
+    buf_free(&log.defs);
     return rv;
 }
\ No newline at end of file
@@ -0,0 +1,189 @@
+/**
+ * @file mmio.c
+ * @author Rob Griffith
+ */
+
+#include "mmio.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct _mmio_opqd
+{
+    int err;
+} _mmio_opqd_t;
+
+int _mmio_status(const bio_data_t *bd)
+{
+    const _mmio_opqd_t *opqd = bd->opaque.data;
+    if (!opqd)
+    {
+        return BIO_STATUS_INIT;
+    }
+    return opqd->err ? BIO_STATUS_INIT - opqd->err : BIO_STATUS_INIT + 1;
+}
+
+void _mmio_status_str(const bio_data_t *bd, char *str, size_t n)
+{
+    const _mmio_opqd_t *opqd = bd->opaque.data;
+    int rv;
+    if (!opqd)
+    {
+        strncpy(str, "uninitialized, no mapping", n);
+        return;
+    }
+    if (opqd->err)
+    {
+        rv = snprintf(str, n, "{mmap: %zu, offset: %zu}, error: %s", bd->buf.size, bd->offset, strerror(opqd->err));
+    }
+    else
+    {
+        rv = snprintf(str, n, "{mmap: %zu, offset: %zu}", bd->buf.size, bd->offset);
+    }
+    if (rv < 0)
+    {
+        strncpy(str, "(mmio status_str failed to format string)", n);
+    }
+}
+
+size_t _mmio_read(bio_data_t *bd, void *data, size_t sz)
+{
+    const size_t rsz = bd->buf.size - bd->offset;
+    const size_t osz = rsz < sz ? rsz : sz;
+    memcpy(data, (const char *)bd->buf.data + bd->offset, osz);
+    bd->offset += osz;
+    bd->stats.rbytes += osz;
+    return osz;
+}
+
+const void *_mmio_peek(bio_data_t *bd, size_t *sz)
+{
+    /* rest of mapping in place */
+    *sz = bd->buf.size - bd->offset;
+    return *sz ? (const char *)bd->buf.data + bd->offset : NULL;
+}
+
+void _mmio_consume(bio_data_t *bd, size_t sz)
+{
+    bd->offset += sz;
+    bd->stats.rbytes += sz;
+}
+
+size_t _mmio_write(bio_data_t *bd, const void *data, size_t sz)
+{
+    _mmio_opqd_t *opqd = bd->opaque.data;
+    opqd->err = EBADF;
+    return 0;
+}
+
+void _mmio_flush(bio_data_t *bd)
+{
+    /* nothing ever buffered for writing */
+}
+
+ssize_t _mmio_seek(bio_data_t *bd, long offset, int whence)
+{
+    _mmio_opqd_t *opqd = bd->opaque.data;
+    ssize_t pos;
+    switch (whence)
+    {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = (ssize_t)bd->offset + offset;
+        break;
+    case SEEK_END:
+        pos = (ssize_t)bd->buf.size + offset;
+        break;
+    default:
+        pos = -1;
+    }
+    if (pos < 0 || (size_t)pos > bd->buf.size)
+    {
+        opqd->err = EINVAL;
+        return -1;
+    }
+    opqd->err = 0;
+    bd->offset = (size_t)pos;
+    return pos;
+}
+
+int _mmio_size_hint(const bio_data_t *bd, size_t *sz)
+{
+    /* mapping size always known */
+    *sz = bd->buf.size - bd->offset;
+    return BIO_HINT_EXACT;
+}
+
+void _mmio_dfree(bio_data_t *bd)
+{
+    if (bd->buf.data && bd->buf.size)
+    {
+        munmap(bd->buf.data, bd->buf.size);
+    }
+    /* mapping not owned by buffer, never passed to free */
+    memset(&bd->buf, 0, sizeof(bd->buf));
+    buf_free(&bd->opaque);
+}
+
+void mmio_wrap(bufferedio_t *bio, int fd, int cflags)
+{
+    _mmio_opqd_t opqd = {0};
+    struct stat st;
+    void *map = NULL;
+    size_t sz = 0;
+    off_t pos = 0;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        opqd.err = fd < 0 ? EBADF : errno;
+    }
+    else if (!S_ISREG(st.st_mode))
+    {
+        opqd.err = ENODEV;
+    }
+    else if (st.st_size > 0)
+    {
+        /* empty files cannot be mapped, but are still readable */
+        sz = (size_t)st.st_size;
+        /* bytes before the current file offset were already consumed (e.g. inherited stdin) */
+        pos = lseek(fd, 0, SEEK_CUR);
+        pos = pos < 0 ? 0 : (pos > st.st_size ? st.st_size : pos);
+        map = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            opqd.err = errno;
+            map = NULL;
+            sz = 0;
+        }
+        else
+        {
+            madvise(map, sz, MADV_SEQUENTIAL);
+        }
+    }
+    if (!opqd.err && (cflags & MMIO_CLOSE))
+    {
+        close(fd);
+    }
+    /* mapping not owned by buffer, never inline */
+    memset(&bio->data.buf, 0, sizeof(bio->data.buf));
+    bio->data.buf.data = map;
+    bio->data.buf.capacity = sz;
+    bio->data.buf.size = sz;
+    bio->data.offset = map ? (size_t)pos : 0;
+    buf_copy(&bio->data.opaque, &opqd, sizeof(_mmio_opqd_t));
+    bio->status = &_mmio_status;
+    bio->status_str = &_mmio_status_str;
+    bio->read = &_mmio_read;
+    bio->peek = &_mmio_peek;
+    bio->consume = &_mmio_consume;
+    bio->write = &_mmio_write;
+    bio->flush = &_mmio_flush;
+    bio->seek = &_mmio_seek;
+    bio->size_hint = &_mmio_size_hint;
+    bio->dfree = &_mmio_dfree;
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+/**
+ * @file mmio.h
+ * @author Rob Griffith
+ */
+
+#ifndef MMIO_H
+#define MMIO_H
+
+#include "bufferedio.h"
+
+/**
+ * @def MMIO_CLOSE
+ * @brief memory mapped buffered I/O flag for invoking close(2) once mapped (fd left open if mapping fails)
+ */
+#define MMIO_CLOSE 1
+
+/**
+ * @brief initialize read-only buffered I/O context to wrap a memory mapping of a regular file
+ *
+ * The entire file is mapped once, reading copies directly from the mapping (no read(2) calls).
+ * Reading starts at the current offset of fd, like reading fd would (seek offsets are from the start of the file).
+ * Writing is not supported and sets an error status.
+ * Seeking will change where reads start from.
+ * Use @ref bio_status to check for sucessful initialization (fails for files that are not regular).
+ *
+ * @param[inout] bio buffered I/O context to use
+ * @param fd file descriptor of regular file opened for reading
+ * @param cflags flags for controlling manipulation of fd
+ */
+void mmio_wrap(bufferedio_t *bio, int fd, int cflags);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,264 @@
+/**
+ * @file ringio.c
+ * @author Rob Griffith
+ */
+
+#include "ringio.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct _ringio_opqd
+{
+    bufring_t *ring;
+    int err;
+    int clfags;
+    size_t dropped; /* bytes discarded by overwrite */
+    size_t dlines;  /* newlines within discarded bytes */
+} _ringio_opqd_t;
+
+int _ringio_status(const bio_data_t *bd)
+{
+    const _ringio_opqd_t *opqd = bd->opaque.data;
+    if (!opqd)
+    {
+        return BIO_STATUS_INIT;
+    }
+    if (opqd->err == EAGAIN)
+    {
+        /* ring empty or full, not an error */
+        return BIO_STATUS_WOULDBLOCK;
+    }
+    return opqd->err ? BIO_STATUS_INIT - opqd->err : BIO_STATUS_INIT + 1;
+}
+
+void _ringio_status_str(const bio_data_t *bd, char *str, size_t n)
+{
+    const _ringio_opqd_t *opqd = bd->opaque.data;
+    int rv;
+    if (!opqd)
+    {
+        strncpy(str, "uninitialized, no ring", n);
+        return;
+    }
+    const size_t cap = opqd->ring ? opqd->ring->capacity : 0;
+    const size_t size = opqd->ring ? bring_size(opqd->ring) : 0;
+    const char *closed = opqd->ring && bring_closed(opqd->ring) ? ", closed" : "";
+    if (opqd->err)
+    {
+        rv = snprintf(str, n, "{ring: %zu/%zu%s}, error: %s", size, cap, closed, strerror(opqd->err));
+    }
+    else if (opqd->clfags & RINGIO_OVERWRITE)
+    {
+        rv = snprintf(str, n, "{ring: %zu/%zu%s, dropped: %zu bytes, %zu lines}", size, cap, closed, opqd->dropped,
+                      opqd->dlines);
+    }
+    else
+    {
+        rv = snprintf(str, n, "{ring: %zu/%zu%s}", size, cap, closed);
+    }
+    if (rv < 0)
+    {
+        strncpy(str, "(ringio status_str failed to format string)", n);
+    }
+}
+
+size_t _ringio_read(bio_data_t *bd, void *data, size_t sz)
+{
+    /* single copy from contiguous readable span, relies on bio_read re-trying until complete or 0 */
+    _ringio_opqd_t *opqd = bd->opaque.data;
+    size_t rsz;
+    if (!opqd->ring)
+    {
+        return 0;
+    }
+    const void *head = bring_head(opqd->ring, &rsz);
+    const size_t osz = rsz < sz ? rsz : sz;
+    if (!osz)
+    {
+        /* empty, EOF only once closed by producer */
+        opqd->err = sz && !bring_closed(opqd->ring) ? EAGAIN : opqd->err;
+        return 0;
+    }
+    memcpy(data, head, osz);
+    bring_consume(opqd->ring, osz);
+    opqd->err = opqd->err == EAGAIN ? 0 : opqd->err;
+    bd->stats.rbytes += osz;
+    return osz;
+}
+
+void _ringio_overwrite(_ringio_opqd_t *opqd, size_t sz)
+{
+    /* discard oldest bytes through end of line until sz bytes (at most capacity) are free */
+    bufring_t *ring = opqd->ring;
+    size_t rsz;
+    const char *head = bring_head(ring, &rsz);
+    const size_t need = sz < ring->capacity ? sz : ring->capacity;
+    const size_t avail = ring->capacity - rsz;
+    if (avail >= need)
+    {
+        return;
+    }
+    size_t n = need - avail;
+    const char *nl = memchr(head + n - 1, '\n', rsz - (n - 1));
+    n = nl ? (size_t)(nl - head) + 1 : rsz;
+    for (const char *p = head; (p = memchr(p, '\n', (size_t)(head + n - p))); p++)
+    {
+        opqd->dlines++;
+    }
+    opqd->dropped += n;
+    bring_consume(ring, n);
+}
+
+const void *_ringio_peek(bio_data_t *bd, size_t *sz)
+{
+    /* all committed bytes are contiguous in the mirrored mapping */
+    _ringio_opqd_t *opqd = bd->opaque.data;
+    if (!opqd->ring)
+    {
+        return NULL;
+    }
+    const void *head = bring_head(opqd->ring, sz);
+    if (!*sz)
+    {
+        /* empty, EOF only once closed by producer */
+        opqd->err = bring_closed(opqd->ring) ? opqd->err : EAGAIN;
+        return NULL;
+    }
+    opqd->err = opqd->err == EAGAIN ? 0 : opqd->err;
+    return head;
+}
+
+void _ringio_consume(bio_data_t *bd, size_t sz)
+{
+    _ringio_opqd_t *opqd = bd->opaque.data;
+    bring_consume(opqd->ring, sz);
+    bd->stats.rbytes += sz;
+}
+
+size_t _ringio_write(bio_data_t *bd, const void *data, size_t sz)
+{
+    /* single copy into contiguous writable span, relies on bio_write re-trying until complete or 0 */
+    _ringio_opqd_t *opqd = bd->opaque.data;
+    size_t wsz;
+    if (!opqd->ring)
+    {
+        return 0;
+    }
+    if (opqd->clfags & RINGIO_OVERWRITE)
+    {
+        _ringio_overwrite(opqd, sz);
+    }
+    void *tail = bring_tail(opqd->ring, &wsz);
+    const size_t osz = wsz < sz ? wsz : sz;
+    if (bring_closed(opqd->ring))
+    {
+        opqd->err = EPIPE;
+        return 0;
+    }
+    if (!osz)
+    {
+        /* full, consumer must catch up */
+        opqd->err = sz ? EAGAIN : opqd->err;
+        return 0;
+    }
+    memcpy(tail, data, osz);
+    bring_commit(opqd->ring, osz);
+    opqd->err = opqd->err == EAGAIN ? 0 : opqd->err;
+    bd->stats.wbytes += osz;
+    return osz;
+}
+
+void _ringio_flush(bio_data_t *bd)
+{
+    /* committed bytes are already readable */
+}
+
+ssize_t _ringio_seek(bio_data_t *bd, long offset, int whence)
+{
+    _ringio_opqd_t *opqd = bd->opaque.data;
+    opqd->err = ESPIPE;
+    return -1;
+}
+
+int _ringio_size_hint(const bio_data_t *bd, size_t *sz)
+{
+    /* committed bytes ready now, exact once producer closed the ring */
+    const _ringio_opqd_t *opqd = bd->opaque.data;
+    if (!opqd->ring)
+    {
+        *sz = 0;
+        return BIO_HINT_NONE;
+    }
+    const int closed = bring_closed(opqd->ring);
+    *sz = bring_size(opqd->ring);
+    return closed ? BIO_HINT_EXACT : (*sz ? BIO_HINT_MIN : BIO_HINT_NONE);
+}
+
+int _ringio_wait(bio_data_t *bd, int events, int timeout)
+{
+    _ringio_opqd_t *opqd = bd->opaque.data;
+    bufring_t *ring = opqd->ring;
+    if (!ring)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    const uint64_t t = bio_clock_ns();
+    bring_wait(ring, events & BIO_WAIT_READ, events & BIO_WAIT_WRITE, timeout);
+    bd->stats.blocked_ns += bio_clock_ns() - t;
+    const size_t size = bring_size(ring);
+    int ready = 0;
+    ready |= (events & BIO_WAIT_READ) && (size || bring_closed(ring)) ? BIO_WAIT_READ : 0;
+    ready |= (events & BIO_WAIT_WRITE) && size < ring->capacity ? BIO_WAIT_WRITE : 0;
+    return ready;
+}
+
+void _ringio_dfree(bio_data_t *bd)
+{
+    _ringio_opqd_t *opqd = bd->opaque.data;
+    if (opqd && opqd->ring)
+    {
+        if (opqd->clfags & RINGIO_CLOSE)
+        {
+            bring_close(opqd->ring);
+        }
+        if (opqd->clfags & RINGIO_FREE)
+        {
+            bring_free(opqd->ring);
+        }
+    }
+    buf_free(&bd->buf);
+    buf_free(&bd->opaque);
+}
+
+void ringio_wrap(bufferedio_t *bio, bufring_t *ring, int cflags)
+{
+    /* ring is the storage, buffer left empty */
+    _ringio_opqd_t opqd = {ring && ring->data ? ring : NULL, ring && ring->data ? 0 : EINVAL, cflags, 0, 0};
+    buf_init(&bio->data.buf, 0);
+    bio->data.offset = 0;
+    buf_copy(&bio->data.opaque, &opqd, sizeof(_ringio_opqd_t));
+    bio->status = &_ringio_status;
+    bio->status_str = &_ringio_status_str;
+    bio->read = &_ringio_read;
+    bio->peek = &_ringio_peek;
+    bio->consume = &_ringio_consume;
+    bio->write = &_ringio_write;
+    bio->flush = &_ringio_flush;
+    bio->seek = &_ringio_seek;
+    bio->size_hint = &_ringio_size_hint;
+    bio->wait = &_ringio_wait;
+    bio->dfree = &_ringio_dfree;
+}
+
+size_t ringio_dropped(const bufferedio_t *bio, size_t *lines)
+{
+    const _ringio_opqd_t *opqd = bio->data.opaque.data;
+    if (lines)
+    {
+        *lines = opqd ? opqd->dlines : 0;
+    }
+    return opqd ? opqd->dropped : 0;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+/**
+ * @file ringio.h
+ * @author Rob Griffith
+ */
+
+#ifndef RINGIO_H
+#define RINGIO_H
+
+#include "bufferedio.h"
+#include "bufring.h"
+
+/**
+ * @def RINGIO_CLOSE
+ * @brief ring buffered I/O flag for invoking @ref bring_close in cleanup (producer end of a pipeline stage)
+ */
+#define RINGIO_CLOSE 1
+
+/**
+ * @def RINGIO_FREE
+ * @brief ring buffered I/O flag for invoking @ref bring_free in cleanup (last context using the ring)
+ */
+#define RINGIO_FREE 2
+
+/**
+ * @def RINGIO_OVERWRITE
+ * @brief ring buffered I/O flag for discarding oldest whole lines when writing a full ring (bounded recent history)
+ *
+ * Writing never blocks, the writer consumes the head itself, so no other context may read the ring concurrently.
+ * Bytes up to the next newline are discarded with the oldest bytes, the ring starts at a line once drained.
+ * Discarded bytes and lines are counted (see @ref ringio_dropped).
+ */
+#define RINGIO_OVERWRITE 4
+
+/**
+ * @brief initialize buffered I/O context to use a ring buffer as its storage (pipelined stages)
+ *
+ * Writing commits bytes to the tail of the ring, reading consumes bytes from its head,
+ * each copied once as a single contiguous span (no intermediate buffer, no system calls).
+ * @ref bio_peek provides all committed bytes in place (nothing copied).
+ * A producer and a consumer context may wrap the same ring from different threads.
+ * Reading an empty ring or writing a full ring sets @ref BIO_STATUS_WOULDBLOCK, use @ref bio_wait.
+ * Reading returns EOF once the ring is drained after @ref bring_close, writing a closed ring sets EPIPE.
+ * Seeking is not supported and sets an error status.
+ * Use @ref bio_status to check for sucessful initialization (fails for uninitialized rings).
+ *
+ * @param[inout] bio buffered I/O context to use
+ * @param ring initialized ring buffer (not owned unless @ref RINGIO_FREE, must outlive the context)
+ * @param cflags flags for controlling manipulation of ring
+ */
+void ringio_wrap(bufferedio_t *bio, bufring_t *ring, int cflags);
+
+/**
+ * @brief get number of bytes discarded from the ring by writes with @ref RINGIO_OVERWRITE
+ *
+ * @param bio buffered I/O context initialized with @ref ringio_wrap
+ * @param[out] lines number of newlines within the discarded bytes (may be NULL)
+ * @return number of bytes discarded
+ */
+size_t ringio_dropped(const bufferedio_t *bio, size_t *lines);
+
+#endif
\ No newline at end of file
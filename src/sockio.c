@@ -0,0 +1,435 @@
+/**
+ * @file sockio.c
+ * @author Rob Griffith
+ */
+
+#include "sockio.h"
+
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+typedef struct _sockio_opqd
+{
+    int fd;
+    int err;
+    int clfags;
+    int family;        /* AF_UNIX, AF_INET or AF_INET6 */
+    int corked;        /* last send used MSG_MORE, TCP frames may be held back */
+    size_t zc_pending; /* MSG_ZEROCOPY sends not yet completed */
+    buffer_t wbuf;     /* pending writes (bd->buf only holds read bytes) */
+} _sockio_opqd_t;
+
+int _sockio_status(const bio_data_t *bd)
+{
+    const _sockio_opqd_t *opqd = bd->opaque.data;
+    if (opqd && (opqd->err == EAGAIN || opqd->err == EWOULDBLOCK))
+    {
+        /* nonblocking socket not ready, not an error */
+        return BIO_STATUS_WOULDBLOCK;
+    }
+    if (opqd && opqd->err)
+    {
+        return BIO_STATUS_INIT - opqd->err;
+    }
+    return BIO_STATUS_INIT + ((bd->buf.data && opqd && (opqd->fd >= 0)) ? 1 : 0);
+}
+
+void _sockio_status_str(const bio_data_t *bd, char *str, size_t n)
+{
+    const _sockio_opqd_t *opqd = bd->opaque.data;
+    if (!opqd)
+    {
+        strncpy(str, "uninitialized, no socket", n);
+        return;
+    }
+    const char *family = opqd->family == AF_UNIX ? "unix" : (opqd->family == AF_INET ? "inet" : (opqd->family == AF_INET6 ? "inet6" : "unknown"));
+    const char *zc = (opqd->clfags & SOCKIO_ZEROCOPY) ? ", zerocopy" : "";
+    int rv;
+    if (opqd->err)
+    {
+        rv = snprintf(str, n, "{socket: %d (%s), bufsz: %zu%s}, error: %s", opqd->fd, family, bd->buf.capacity, zc, strerror(opqd->err));
+    }
+    else
+    {
+        rv = snprintf(str, n, "{socket: %d (%s), bufsz: %zu%s}", opqd->fd, family, bd->buf.capacity, zc);
+    }
+    if (rv < 0)
+    {
+        strncpy(str, "(sockio status_str failed to format string)", n);
+    }
+}
+
+int _sockio_zc_reap(bio_data_t *bd)
+{
+    /* wait for completion notifications of all zero-copy sends, bytes are no longer referenced after */
+    _sockio_opqd_t *opqd = bd->opaque.data;
+    while (opqd->zc_pending)
+    {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct msghdr msg = {0};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        const ssize_t rv = recvmsg(opqd->fd, &msg, MSG_ERRQUEUE);
+        bd->stats.nsyscall++;
+        if (rv < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                /* error queue readiness always reported as POLLERR */
+                struct pollfd pfd = {opqd->fd, 0, 0};
+                const uint64_t t = bio_clock_ns();
+                poll(&pfd, 1, -1);
+                bd->stats.nsyscall++;
+                bd->stats.blocked_ns += bio_clock_ns() - t;
+            }
+            else if (errno != EINTR)
+            {
+                opqd->err = errno;
+                return 0;
+            }
+            continue;
+        }
+        struct cmsghdr *cm;
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+            const struct sock_extended_err *serr = (const struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno)
+            {
+                continue;
+            }
+            /* completed range of send ids [ee_info, ee_data] */
+            const size_t ndone = (size_t)(serr->ee_data - serr->ee_info) + 1;
+            opqd->zc_pending -= ndone < opqd->zc_pending ? ndone : opqd->zc_pending;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                /* kernel copied anyway (e.g. loopback), only costs pinning and notifications */
+                opqd->clfags &= ~SOCKIO_ZEROCOPY;
+            }
+        }
+    }
+    return 1;
+}
+
+size_t _sockio_send(bio_data_t *bd, const void *data, size_t sz, int more)
+{
+    /*
+    single sendmsg of pending writes followed by data (gathered, data never copied into buffer)
+    returns number of bytes of data sent, pending bytes sent are removed from write buffer
+    */
+    _sockio_opqd_t *opqd = bd->opaque.data;
+    const size_t psz = opqd->wbuf.size;
+    struct iovec iov[2] = {{opqd->wbuf.data, psz}, {(void *)data, sz}};
+    struct msghdr msg = {0};
+    msg.msg_iov = psz ? iov : iov + 1;
+    msg.msg_iovlen = psz ? (sz ? 2 : 1) : 1;
+    int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+    const int zc = (opqd->clfags & SOCKIO_ZEROCOPY) && sz >= SOCKIO_ZEROCOPY_MIN;
+    const uint64_t t = bio_clock_ns();
+    ssize_t rv;
+    do
+    {
+        rv = sendmsg(opqd->fd, &msg, flags | (zc ? MSG_ZEROCOPY : 0));
+    } while (rv < 0 && errno == EINTR);
+    if (rv < 0 && zc && errno == ENOBUFS)
+    {
+        /* out of memory for pinning pages, copy instead */
+        rv = sendmsg(opqd->fd, &msg, flags);
+        bd->stats.nsyscall++;
+    }
+    else if (rv > 0 && zc)
+    {
+        opqd->zc_pending++;
+    }
+    opqd->err = rv < 0 ? errno : 0;
+    bio_stats_sysio(&bd->stats, 1, psz + sz, rv, t);
+    opqd->corked = rv > 0 ? more : opqd->corked;
+    const size_t osz = rv < 0 ? 0 : (size_t)rv;
+    if (zc && !_sockio_zc_reap(bd))
+    {
+        /* kernel may still reference the write buffer, left as is */
+        return 0;
+    }
+    /* keep unsent pending bytes at front of write buffer (only moved once no longer referenced) */
+    const size_t wsz = osz < psz ? osz : psz;
+    memmove(opqd->wbuf.data, (const char *)opqd->wbuf.data + wsz, psz - wsz);
+    buf_resize(&opqd->wbuf, psz - wsz);
+    return osz - wsz;
+}
+
+void _sockio_flush(bio_data_t *bd)
+{
+    /* send pending writes without MSG_MORE, then push frames held back by earlier MSG_MORE */
+    _sockio_opqd_t *opqd = bd->opaque.data;
+    while (opqd->wbuf.size)
+    {
+        bd->stats.nflush++;
+        const size_t psz = opqd->wbuf.size;
+        _sockio_send(bd, NULL, 0, 0);
+        if (opqd->wbuf.size == psz)
+        {
+            /* failed or would block, keep pending */
+            return;
+        }
+    }
+    if (opqd->corked && opqd->family != AF_UNIX)
+    {
+        /* setting TCP_NODELAY always pushes pending frames */
+        const int on = 1;
+        setsockopt(opqd->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        bd->stats.nsyscall++;
+    }
+    opqd->corked = 0;
+}
+
+size_t _sockio_recv(bio_data_t *bd, void *data, size_t sz)
+{
+    /* single underlying recv, flushing pending writes before it could wait on a peer waiting on them */
+    _sockio_opqd_t *opqd = bd->opaque.data;
+    if (opqd->wbuf.size || opqd->corked)
+    {
+        _sockio_flush(bd);
+    }
+    const uint64_t t = bio_clock_ns();
+    ssize_t rv;
+    do
+    {
+        rv = recv(opqd->fd, data, sz, 0);
+    } while (rv < 0 && errno == EINTR);
+    opqd->err = rv < 0 ? errno : 0;
+    bio_stats_sysio(&bd->stats, 0, sz, rv, t);
+    return rv < 0 ? 0 : (size_t)rv;
+}
+
+size_t _sockio_refill(bio_data_t *bd)
+{
+    /* replace drained read buffer with bytes of one underlying receive */
+    bd->offset = 0;
+    bd->stats.nrefill++;
+    return buf_resize(&bd->buf, _sockio_recv(bd, bd->buf.data, bd->buf.capacity));
+}
+
+size_t _sockio_read(bio_data_t *bd, void *data, size_t sz)
+{
+    /*
+    get bytes from internal buffer when possible
+    refill buffer as needed (only once)
+    relies on bio_read re-trying until complete or 0
+    */
+    size_t rsz = bd->buf.size - bd->offset;
+    size_t osz;
+    if (sz > rsz + bd->buf.capacity)
+    {
+        /* drain buffer and read directly */
+        memcpy(data, (const char *)bd->buf.data + bd->offset, rsz);
+        bd->offset = 0;
+        buf_clear(&bd->buf);
+        osz = rsz + _sockio_recv(bd, (char *)data + rsz, sz - rsz);
+    }
+    else
+    {
+        if (!rsz)
+        {
+            rsz = _sockio_refill(bd);
+        }
+        osz = rsz < sz ? rsz : sz;
+        memcpy(data, (const char *)bd->buf.data + bd->offset, osz);
+        bd->offset += osz;
+    }
+    return osz;
+}
+
+const void *_sockio_peek(bio_data_t *bd, size_t *sz)
+{
+    /* buffered bytes in place, refilled once when drained (unbuffered contexts cannot peek) */
+    if (!bd->buf.capacity)
+    {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    *sz = bd->buf.size - bd->offset;
+    if (!*sz)
+    {
+        *sz = _sockio_refill(bd);
+    }
+    return *sz ? (const char *)bd->buf.data + bd->offset : NULL;
+}
+
+void _sockio_consume(bio_data_t *bd, size_t sz)
+{
+    bd->offset += sz;
+}
+
+size_t _sockio_write(bio_data_t *bd, const void *data, size_t sz)
+{
+    /*
+    batch writes in write buffer while they fit
+    otherwise send pending and new bytes together (only once)
+    relies on bio_write re-trying until complete or 0
+    */
+    _sockio_opqd_t *opqd = bd->opaque.data;
+    const size_t wsz = opqd->wbuf.capacity - opqd->wbuf.size;
+    if (sz <= wsz)
+    {
+        return buf_push(&opqd->wbuf, data, sz);
+    }
+    /* more bytes likely follow an overflowing write */
+    const size_t osz = _sockio_send(bd, data, sz, 1);
+    if (!osz && !opqd->err)
+    {
+        /* only pending bytes sent, batch what now fits */
+        const size_t fsz = opqd->wbuf.capacity - opqd->wbuf.size;
+        return buf_push(&opqd->wbuf, data, fsz < sz ? fsz : sz);
+    }
+    return osz;
+}
+
+ssize_t _sockio_seek(bio_data_t *bd, long offset, int whence)
+{
+    _sockio_opqd_t *opqd = bd->opaque.data;
+    opqd->err = ESPIPE;
+    return -1;
+}
+
+int _sockio_size_hint(const bio_data_t *bd, size_t *sz)
+{
+    /* bytes ready now but more may follow until peer shuts down */
+    const _sockio_opqd_t *opqd = bd->opaque.data;
+    const size_t bsz = bd->buf.size - bd->offset;
+    int avail = 0;
+    if (opqd && ioctl(opqd->fd, FIONREAD, &avail) == 0 && avail > 0)
+    {
+        *sz = bsz + (size_t)avail;
+        return BIO_HINT_MIN;
+    }
+    *sz = bsz;
+    return bsz ? BIO_HINT_MIN : BIO_HINT_NONE;
+}
+
+int _sockio_wait(bio_data_t *bd, int events, int timeout)
+{
+    /* buffered bytes or room ready without polling, otherwise sleep in poll(2) */
+    _sockio_opqd_t *opqd = bd->opaque.data;
+    int ready = 0;
+    ready |= (events & BIO_WAIT_READ) && bd->offset < bd->buf.size ? BIO_WAIT_READ : 0;
+    ready |= (events & BIO_WAIT_WRITE) && opqd->wbuf.size < opqd->wbuf.capacity ? BIO_WAIT_WRITE : 0;
+    if (ready)
+    {
+        return ready;
+    }
+    if ((events & BIO_WAIT_READ) && (opqd->wbuf.size || opqd->corked))
+    {
+        /* peer may be waiting on pending writes */
+        _sockio_flush(bd);
+    }
+    struct pollfd pfd = {opqd->fd, 0, 0};
+    pfd.events |= (events & BIO_WAIT_READ) ? POLLIN : 0;
+    pfd.events |= (events & BIO_WAIT_WRITE) ? POLLOUT : 0;
+    const uint64_t t = bio_clock_ns();
+    const int rv = poll(&pfd, 1, timeout);
+    bd->stats.nsyscall++;
+    bd->stats.blocked_ns += bio_clock_ns() - t;
+    if (rv <= 0)
+    {
+        return rv;
+    }
+    /* hangup and errors are ready, the next read or write reports them */
+    ready |= (pfd.revents & (POLLIN | POLLHUP | POLLERR)) && (events & BIO_WAIT_READ) ? BIO_WAIT_READ : 0;
+    ready |= (pfd.revents & (POLLOUT | POLLHUP | POLLERR)) && (events & BIO_WAIT_WRITE) ? BIO_WAIT_WRITE : 0;
+    return ready;
+}
+
+void _sockio_dfree(bio_data_t *bd)
+{
+    _sockio_opqd_t *opqd = bd->opaque.data;
+    if (opqd)
+    {
+        if (opqd->fd >= 0)
+        {
+            _sockio_flush(bd);
+            _sockio_zc_reap(bd);
+        }
+        if (opqd->clfags & SOCKIO_CLOSE)
+        {
+            close(opqd->fd);
+        }
+        buf_free(&opqd->wbuf);
+    }
+    buf_free(&bd->opaque);
+    buf_free(&bd->buf);
+}
+
+void sockio_wrap(bufferedio_t *bio, int fd, size_t bufsz, int cflags)
+{
+    _sockio_opqd_t opqd = {fd, fd < 0 ? errno : 0, cflags, 0, 0, 0, {0}};
+    int type = 0;
+    socklen_t len = sizeof(type);
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    if (!opqd.err && getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
+    {
+        opqd.err = errno;
+    }
+    else if (!opqd.err && type != SOCK_STREAM)
+    {
+        /* datagram boundaries would be lost by buffering */
+        opqd.err = EPROTOTYPE;
+    }
+    else if (!opqd.err && getsockname(fd, (struct sockaddr *)&addr, &addrlen) == 0)
+    {
+        opqd.family = addr.ss_family;
+    }
+    const int on = 1;
+    if (!opqd.err && (opqd.family == AF_INET || opqd.family == AF_INET6))
+    {
+        /* batching done here, Nagle's algorithm would only delay flushed bytes */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if ((opqd.clfags & SOCKIO_ZEROCOPY) &&
+        (opqd.err || opqd.family == AF_UNIX || setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0))
+    {
+        /* unsupported by socket, always copy */
+        opqd.clfags &= ~SOCKIO_ZEROCOPY;
+    }
+    bio->data.buf.alloc = &buf_pool;
+    buf_init(&bio->data.buf, bufsz);
+    bio->data.offset = 0;
+    if (buf_copy(&bio->data.opaque, &opqd, sizeof(_sockio_opqd_t)))
+    {
+        /* write buffer initialized in place (small buffers are inline) */
+        _sockio_opqd_t *copqd = bio->data.opaque.data;
+        copqd->wbuf.alloc = &buf_pool;
+        buf_init(&copqd->wbuf, bufsz);
+    }
+    bio->status = &_sockio_status;
+    bio->status_str = &_sockio_status_str;
+    bio->read = &_sockio_read;
+    bio->peek = &_sockio_peek;
+    bio->consume = &_sockio_consume;
+    bio->write = &_sockio_write;
+    bio->flush = &_sockio_flush;
+    bio->seek = &_sockio_seek;
+    bio->size_hint = &_sockio_size_hint;
+    bio->wait = &_sockio_wait;
+    bio->dfree = &_sockio_dfree;
+}
\ No newline at end of file
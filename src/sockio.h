@@ -0,0 +1,54 @@
+/**
+ * @file sockio.h
+ * @author Rob Griffith
+ */
+
+#ifndef SOCKIO_H
+#define SOCKIO_H
+
+#include "bufferedio.h"
+
+/**
+ * @def SOCKIO_CLOSE
+ * @brief socket buffered I/O flag for invoking close(2) in cleanup
+ */
+#define SOCKIO_CLOSE 1
+
+/**
+ * @def SOCKIO_ZEROCOPY
+ * @brief socket buffered I/O flag for sending large writes with MSG_ZEROCOPY
+ *
+ * Only writes of at least @ref SOCKIO_ZEROCOPY_MIN bytes are sent without copying.
+ * Writing returns only once the kernel no longer references the bytes, so callers may reuse them,
+ * each such write waits on its completion notification (only worth it for very large writes on fast links).
+ * Cleared if unsupported by the socket (e.g. Unix sockets) or if the kernel copied the bytes anyway (e.g. loopback).
+ */
+#define SOCKIO_ZEROCOPY 2
+
+/**
+ * @def SOCKIO_ZEROCOPY_MIN
+ * @brief smallest write sent with MSG_ZEROCOPY (page pinning costs more than copying small writes)
+ */
+#define SOCKIO_ZEROCOPY_MIN (1 << 16)
+
+/**
+ * @brief initialize buffered I/O context to wrap a connected stream socket (TCP or Unix)
+ *
+ * Reads and writes are buffered separately, so both directions can be in use at once.
+ * Small writes are batched in the write buffer until full or flushed.
+ * Overflowing writes are sent with the batched bytes in a single sendmsg(2) call with MSG_MORE,
+ * flushing sends without MSG_MORE (and pushes corked TCP frames).
+ * Pending writes are flushed before a read needs to wait on the socket (request-response without deadlock).
+ * TCP_NODELAY is set for TCP sockets, since batching is done here instead of by Nagle's algorithm.
+ * Seeking is not supported and sets an error status.
+ * Both buffers are drawn from (and returned to) @ref buf_pool.
+ * Use @ref bio_status to check for sucessful initialization (fails for descriptors that are not stream sockets).
+ *
+ * @param[inout] bio buffered I/O context to use
+ * @param fd connected stream socket file descriptor
+ * @param bufsz buffer size to use (for each direction)
+ * @param cflags flags for controlling manipulation of fd
+ */
+void sockio_wrap(bufferedio_t *bio, int fd, size_t bufsz, int cflags);
+
+#endif
\ No newline at end of file
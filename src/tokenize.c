@@ -5,138 +5,496 @@
 
 #include "tokenize.h"
 
-#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 
-const char *tkz_parse_str_token(bufferedio_t *bio, buffer_t *buf, char *end)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* byte classes of the resumable tokenizer */
+#define TKZ_C_OTHER 0
+#define TKZ_C_SPACE 1
+#define TKZ_C_NL 2
+#define TKZ_C_QUOTE 3
+#define TKZ_C_ESC 4
+
+/* states of the resumable tokenizer */
+#define TKZ_S_SPACE 0
+#define TKZ_S_TOKEN 1
+#define TKZ_S_QUOTED 2
+#define TKZ_S_ESC 3
+#define TKZ_S_QESC 4
+
+/* actions of the resumable tokenizer on a transition */
+#define TKZ_A_NONE 0
+#define TKZ_A_PUSH 1  /* push byte to token */
+#define TKZ_A_START 2 /* start token */
+#define TKZ_A_SPUSH 3 /* start token and push byte */
+#define TKZ_A_UNESC 4 /* push unescaped byte to token */
+#define TKZ_A_END 5   /* end token */
+#define TKZ_A_ENDL 6  /* end token and line */
+#define TKZ_A_LINE 7  /* end line */
+
+typedef struct _tkz_edge
+{
+    unsigned char next;
+    unsigned char act;
+} _tkz_edge_t;
+
+const unsigned char _tkz_class[256] = {['\t'] = TKZ_C_SPACE, ['\n'] = TKZ_C_NL,    ['\v'] = TKZ_C_SPACE,
+                                       ['\f'] = TKZ_C_SPACE, ['\r'] = TKZ_C_SPACE, [' '] = TKZ_C_SPACE,
+                                       ['"'] = TKZ_C_QUOTE,  ['\\'] = TKZ_C_ESC};
+
+/* transitions indexed by state then byte class (other, space, newline, quote, backslash) */
+const _tkz_edge_t _tkz_dfa[5][5] = {
+    [TKZ_S_SPACE] = {{TKZ_S_TOKEN, TKZ_A_SPUSH},
+                     {TKZ_S_SPACE, TKZ_A_NONE},
+                     {TKZ_S_SPACE, TKZ_A_LINE},
+                     {TKZ_S_QUOTED, TKZ_A_START},
+                     {TKZ_S_ESC, TKZ_A_START}},
+    [TKZ_S_TOKEN] = {{TKZ_S_TOKEN, TKZ_A_PUSH},
+                     {TKZ_S_SPACE, TKZ_A_END},
+                     {TKZ_S_SPACE, TKZ_A_ENDL},
+                     {TKZ_S_QUOTED, TKZ_A_NONE},
+                     {TKZ_S_ESC, TKZ_A_NONE}},
+    [TKZ_S_QUOTED] = {{TKZ_S_QUOTED, TKZ_A_PUSH},
+                      {TKZ_S_QUOTED, TKZ_A_PUSH},
+                      {TKZ_S_QUOTED, TKZ_A_PUSH},
+                      {TKZ_S_TOKEN, TKZ_A_NONE},
+                      {TKZ_S_QESC, TKZ_A_NONE}},
+    [TKZ_S_ESC] = {{TKZ_S_TOKEN, TKZ_A_UNESC},
+                   {TKZ_S_TOKEN, TKZ_A_UNESC},
+                   {TKZ_S_TOKEN, TKZ_A_UNESC},
+                   {TKZ_S_TOKEN, TKZ_A_UNESC},
+                   {TKZ_S_TOKEN, TKZ_A_UNESC}},
+    [TKZ_S_QESC] = {{TKZ_S_QUOTED, TKZ_A_UNESC},
+                    {TKZ_S_QUOTED, TKZ_A_UNESC},
+                    {TKZ_S_QUOTED, TKZ_A_UNESC},
+                    {TKZ_S_QUOTED, TKZ_A_UNESC},
+                    {TKZ_S_QUOTED, TKZ_A_UNESC}}};
+
+/* token state carried across spans */
+typedef struct _tkz_state
+{
+    int quoted;  /* inside double quotes, whitespace is part of token */
+    int escaped; /* previous byte was a backslash */
+    int done;    /* token ended by whitespace */
+    size_t nc;   /* number of bytes pushed for token */
+} _tkz_state_t;
+
+int _tkz_space(char c)
+{
+    /* isspace in "C" locale, independent of current locale */
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+#ifdef __SSE2__
+unsigned int _tkz_mask(__m128i v, int quoted)
+{
+    /* bit per byte that is a quote or backslash (or whitespace unless quoted) */
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    if (!quoted)
+    {
+        /* '\t' through '\r' as unsigned c - '\t' <= 4 */
+        const __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+        const __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8('\r' - '\t')), d);
+        m = _mm_or_si128(m, _mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+    }
+    return (unsigned int)_mm_movemask_epi8(m);
+}
+
+unsigned int _tkz_space_mask(__m128i v)
+{
+    const __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    const __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8('\r' - '\t')), d);
+    return (unsigned int)_mm_movemask_epi8(_mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+}
+#endif
+
+const char *_tkz_find(const char *p, const char *end, int quoted)
+{
+    /* next byte changing token state (quote, backslash, or unquoted whitespace), end if none */
+#ifdef __SSE2__
+    for (; end - p >= 16; p += 16)
+    {
+        const unsigned int m = _tkz_mask(_mm_loadu_si128((const __m128i *)p), quoted);
+        if (m)
+        {
+            return p + __builtin_ctz(m);
+        }
+    }
+#endif
+    for (; p < end; p++)
+    {
+        if (*p == '"' || *p == '\\' || (!quoted && _tkz_space(*p)))
+        {
+            break;
+        }
+    }
+    return p;
+}
+
+const char *_tkz_skip_space(const char *p, const char *end)
+{
+    /* first non-whitespace byte, end if none */
+#ifdef __SSE2__
+    for (; end - p >= 16; p += 16)
+    {
+        const unsigned int m = ~_tkz_space_mask(_mm_loadu_si128((const __m128i *)p)) & 0xffff;
+        if (m)
+        {
+            return p + __builtin_ctz(m);
+        }
+    }
+#endif
+    while (p < end && _tkz_space(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+char _tkz_unescape(buffer_t *buf, char c, size_t *nc)
+{
+    /* escaped whitespace universally allowed */
+    if (_tkz_space(c))
+    {
+        return c;
+    }
+    switch (c)
+    {
+    case 'a':
+        return '\a';
+    case 'b':
+        return '\b';
+    case 'e':
+        return '\e';
+    case 'f':
+        return '\f';
+    case 'n':
+        return '\n';
+    case 'r':
+        return '\r';
+    case 't':
+        return '\t';
+    case 'v':
+        return '\v';
+    case '\\':
+    case '\'':
+    case '"':
+    case '?':
+        /* escaped to be literal, leave unchanged */
+        return c;
+    default:
+        /* unrecognized escaped character, push full escape sequence */
+        *nc += buf_push(buf, "\\", sizeof(char));
+        return c;
+    }
+}
+
+size_t _tkz_scan(_tkz_state_t *st, buffer_t *buf, const char *span, size_t sz, char *end)
+{
+    /* apply state machine only at bytes found by _tkz_find, runs between them pushed at once */
+    const char *p = span;
+    const char *const send = span + sz;
+    while (p < send)
+    {
+        if (st->escaped)
+        {
+            st->escaped = 0;
+            const char c = _tkz_unescape(buf, *p++, &st->nc);
+            st->nc += buf_push(buf, &c, sizeof(c));
+            continue;
+        }
+        if (!st->quoted && !st->nc)
+        {
+            /* leading whitespace */
+            p = _tkz_skip_space(p, send);
+            if (p == send)
+            {
+                break;
+            }
+        }
+        const char *q = _tkz_find(p, send, st->quoted);
+        if (q > p)
+        {
+            st->nc += buf_push(buf, p, (size_t)(q - p));
+        }
+        if (q == send)
+        {
+            p = q;
+            break;
+        }
+        p = q + 1;
+        if (*q == '\\')
+        {
+            st->escaped = 1;
+        }
+        else if (*q == '"')
+        {
+            st->quoted = !st->quoted;
+        }
+        else if (st->nc)
+        {
+            /* unquoted whitespace ends token, consumed with it */
+            st->done = 1;
+            *end = *q;
+            break;
+        }
+    }
+    return (size_t)(p - span);
+}
+
+int tkz_parse_slice(bufferedio_t *bio, buffer_t *buf, tkz_slice_t *tok, char *end)
 {
-    int err = 0;
-    int quoted = 0;
-    int escaped = 0;
-    size_t nc = 0;
-    char c;
-    do
+    _tkz_state_t st = {0};
+    const size_t insz = buf->size;
+    char c = EOF;
+    while (!st.done)
     {
-        if (!bio_read(bio, &c, sizeof(char)))
+        size_t sz;
+        const char *span = bio_peek(bio, &sz);
+        const int peeked = span != NULL;
+        if (!span && errno == ENOTSUP)
+        {
+            /* no buffered span available, one byte at a time */
+            sz = bio_read(bio, &c, sizeof(char));
+            span = sz ? &c : NULL;
+        }
+        if (!span)
         {
-            /* check error for EOF or EINTR */
+            /* check error for EOF or nonblocking input not ready */
             const int status = bio_status(bio);
-            printf("bio_read returned 0, status: %d\n", status);
-            if (status <= BIO_STATUS_INIT)
+            if (status == BIO_STATUS_WOULDBLOCK)
             {
-                printf("processing bio_read 0 as error\n");
-                int retry = 0;
-                switch (BIO_STATUS_INIT - status)
-                {
-                case EINTR:
-                case EAGAIN:
-                    /* retry (TODO: maybe add delay) */
-                    retry = 1;
-                    break;
-                default:
-                    /* stop with error */
-                    err = 1;
-                }
-                if (retry)
+                /* sleep until readable instead of spinning */
+                if (bio_wait(bio, BIO_WAIT_READ, -1) >= 0 || errno == EINTR)
                 {
                     continue;
                 }
+                return 0;
             }
-            else
+            if (status <= BIO_STATUS_INIT)
             {
-                /* EOF, stop cleanly */
-                printf("processing bio_read 0 as EOF\n");
-                c = EOF;
+                return 0;
             }
-            /* stop processing */
+            /* EOF, stop cleanly */
+            c = EOF;
             break;
         }
-        if (escaped)
+        if (peeked && !st.nc && !st.quoted && !st.escaped)
         {
-            escaped = 0;
-            /* escaped whitespace universally allowed */
-            if (!isspace(c))
+            /* plain token ending within span is returned in place */
+            const char *send = span + sz;
+            const char *p = _tkz_skip_space(span, send);
+            const char *q = _tkz_find(p, send, 0);
+            if (q < send && _tkz_space(*q))
             {
-                switch (c)
+                tok->data = p;
+                tok->size = (size_t)(q - p);
+                tok->owned = 0;
+                if (end)
                 {
-                case 'a':
-                    c = '\a';
-                    break;
-                case 'b':
-                    c = '\b';
-                    break;
-                case 'e':
-                    c = '\e';
-                    break;
-                case 'f':
-                    c = '\f';
-                    break;
-                case 'n':
-                    c = '\n';
-                    break;
-                case 'r':
-                    c = '\r';
-                    break;
-                case 't':
-                    c = '\t';
-                    break;
-                case 'v':
-                    c = '\v';
-                    break;
-                case '\\':
-                case '\'':
-                case '"':
-                case '?':
-                    /* escaped to be literal, leave unchanged */
-                    break;
-                default:
-                    /* unrecognized escaped character, push full escape sequence */
-                    nc += buf_push(buf, "\\", sizeof(c));
+                    *end = *q;
                 }
+                bio_consume(bio, (size_t)(q + 1 - span));
+                return 1;
             }
-            nc += buf_push(buf, &c, sizeof(c));
         }
-        else if (c == '\\')
+        const size_t used = _tkz_scan(&st, buf, span, sz, &c);
+        if (peeked)
         {
-            escaped = 1;
+            bio_consume(bio, used);
         }
-        else if (quoted)
+    }
+    /* rewritten (escapes, quotes), split across reads, or ended by EOF */
+    tok->data = st.nc ? (const char *)buf->data + insz : "";
+    tok->size = st.nc;
+    tok->owned = st.nc != 0;
+    if (end)
+    {
+        *end = c;
+    }
+    return 1;
+}
+
+const char *tkz_parse_str_token(bufferedio_t *bio, buffer_t *buf, char *end)
+{
+    tkz_slice_t tok;
+    if (!tkz_parse_slice(bio, buf, &tok, end))
+    {
+        return NULL;
+    }
+    if (!tok.owned)
+    {
+        buf_push(buf, tok.data, tok.size);
+    }
+    buf_push(buf, "", sizeof(char));
+    return (const char *)buf->data + buf->size - tok.size - 1;
+}
+
+void _tkz_dfa_next(tkz_dfa_t *dfa)
+{
+    /* tokens of completed line released for the next line */
+    if (dfa->line)
+    {
+        buf_clear(&dfa->toks);
+        buf_clear(&dfa->offs);
+        dfa->line = 0;
+    }
+}
+
+int _tkz_dfa_put(tkz_dfa_t *dfa, const void *data, size_t sz)
+{
+    return buf_push(&dfa->toks, data, sz) == sz;
+}
+
+int _tkz_dfa_start(tkz_dfa_t *dfa)
+{
+    const size_t offset = dfa->toks.size;
+    return buf_push(&dfa->offs, &offset, sizeof(offset)) == sizeof(offset);
+}
+
+int tkz_feed(tkz_dfa_t *dfa, const void *data, size_t sz, size_t *used)
+{
+    const char *p = data;
+    const char *const end = p + sz;
+    int ok = 1;
+    _tkz_dfa_next(dfa);
+    while (ok && p < end && !dfa->line)
+    {
+        if (dfa->state == TKZ_S_TOKEN || dfa->state == TKZ_S_QUOTED)
         {
-            if (c == '"')
-            {
-                quoted = 0;
-            }
-            else
+            /* run of bytes without transitions pushed at once */
+            const char *q = _tkz_find(p, end, dfa->state == TKZ_S_QUOTED);
+            ok = q == p || _tkz_dfa_put(dfa, p, (size_t)(q - p));
+            p = q;
+            if (!ok || p == end)
             {
-                nc += buf_push(buf, &c, sizeof(c));
+                break;
             }
         }
-        else if (c == '"')
+        const char c = *p++;
+        const _tkz_edge_t e = _tkz_dfa[dfa->state][_tkz_class[(unsigned char)c]];
+        dfa->state = e.next;
+        switch (e.act)
+        {
+        case TKZ_A_PUSH:
+            ok = _tkz_dfa_put(dfa, &c, sizeof(c));
+            break;
+        case TKZ_A_START:
+            ok = _tkz_dfa_start(dfa);
+            break;
+        case TKZ_A_SPUSH:
+            ok = _tkz_dfa_start(dfa) && _tkz_dfa_put(dfa, &c, sizeof(c));
+            break;
+        case TKZ_A_UNESC:
+        {
+            size_t nc = 0;
+            const char u = _tkz_unescape(&dfa->toks, c, &nc);
+            ok = _tkz_dfa_put(dfa, &u, sizeof(u));
+            break;
+        }
+        case TKZ_A_END:
+            ok = _tkz_dfa_put(dfa, "", sizeof(char));
+            break;
+        case TKZ_A_ENDL:
+            ok = _tkz_dfa_put(dfa, "", sizeof(char));
+            dfa->line = 1;
+            break;
+        case TKZ_A_LINE:
+            /* lines without tokens skipped */
+            dfa->line = dfa->offs.size != 0;
+            break;
+        default:
+            break;
+        }
+    }
+    *used = (size_t)(p - (const char *)data);
+    return !ok ? TKZ_ERROR : (dfa->line ? TKZ_LINE : TKZ_MORE);
+}
+
+int tkz_feed_eof(tkz_dfa_t *dfa)
+{
+    _tkz_dfa_next(dfa);
+    if (dfa->state != TKZ_S_SPACE && dfa->state != TKZ_S_TOKEN)
+    {
+        /* unterminated quote or escape, partial line discarded so the parser can be fed again */
+        buf_clear(&dfa->toks);
+        buf_clear(&dfa->offs);
+        dfa->state = TKZ_S_SPACE;
+        errno = EINVAL;
+        return TKZ_ERROR;
+    }
+    if (dfa->state != TKZ_S_SPACE && !_tkz_dfa_put(dfa, "", sizeof(char)))
+    {
+        return TKZ_ERROR;
+    }
+    dfa->state = TKZ_S_SPACE;
+    dfa->line = dfa->offs.size != 0;
+    return dfa->line ? TKZ_LINE : TKZ_EOF;
+}
+
+int tkz_feed_bio(tkz_dfa_t *dfa, bufferedio_t *bio)
+{
+    int rv = TKZ_MORE;
+    _tkz_dfa_next(dfa);
+    while (rv == TKZ_MORE)
+    {
+        size_t sz;
+        size_t used;
+        char c;
+        const char *span = bio_peek(bio, &sz);
+        const int peeked = span != NULL;
+        if (!span && errno == ENOTSUP)
         {
-            quoted = 1;
+            /* no buffered span available, one byte at a time */
+            sz = bio_read(bio, &c, sizeof(char));
+            span = sz ? &c : NULL;
         }
-        else if (isspace(c))
+        if (!span)
         {
-            if (nc)
+            /* state kept, resumed once more bytes are readable */
+            const int status = bio_status(bio);
+            if (status == BIO_STATUS_WOULDBLOCK)
             {
-                break;
+                return TKZ_MORE;
             }
+            return status <= BIO_STATUS_INIT ? TKZ_ERROR : tkz_feed_eof(dfa);
         }
-        else
-        {
-            nc += buf_push(buf, &c, sizeof(c));
-        }
-    } while (1);
-    const char *rv = NULL;
-    if (!err)
-    {
-        buf_push(buf, "", sizeof(c));
-        rv = (const char *)buf->data + buf->size - nc - 1;
-        if (end)
+        rv = tkz_feed(dfa, span, sz, &used);
+        if (peeked)
         {
-            *end = c;
+            bio_consume(bio, used);
         }
     }
     return rv;
+}
+
+size_t tkz_argv(tkz_dfa_t *dfa, char ***argv)
+{
+    const size_t *offs = dfa->offs.data;
+    const size_t argc = dfa->line ? dfa->offs.size / sizeof(size_t) : 0;
+    if (!argc || buf_resize(&dfa->argv, (argc + 1) * sizeof(char *)) != (argc + 1) * sizeof(char *))
+    {
+        return 0;
+    }
+    char **ptrs = dfa->argv.data;
+    for (size_t i = 0; i < argc; i++)
+    {
+        ptrs[i] = (char *)dfa->toks.data + offs[i];
+    }
+    ptrs[argc] = NULL;
+    *argv = ptrs;
+    return argc;
+}
+
+void tkz_dfa_free(tkz_dfa_t *dfa)
+{
+    buf_free(&dfa->toks);
+    buf_free(&dfa->offs);
+    buf_free(&dfa->argv);
+    memset(dfa, 0, sizeof(tkz_dfa_t));
 }
\ No newline at end of file
@@ -8,6 +8,133 @@
 
 #include "bufferedio.h"
 
+/**
+ * @def TKZ_ERROR
+ * @brief incremental parsing failed (I/O error, check buffered I/O context status, or allocation failure)
+ */
+#define TKZ_ERROR -1
+
+/**
+ * @def TKZ_MORE
+ * @brief incremental parsing consumed all input without completing a line, feed more (e.g. after @ref bio_wait)
+ */
+#define TKZ_MORE 0
+
+/**
+ * @def TKZ_LINE
+ * @brief incremental parsing completed a line, its tokens are available from @ref tkz_argv
+ */
+#define TKZ_LINE 1
+
+/**
+ * @def TKZ_EOF
+ * @brief incremental parsing reached end of input without any pending tokens
+ */
+#define TKZ_EOF 2
+
+/**
+ * @struct tkz_dfa
+ * @brief resumable line tokenizer, a table-driven state machine fed arbitrary chunks of input
+ * @typedef tkz_dfa_t
+ *
+ * Tokens are split like @ref tkz_parse_str_token (whitespace, double quotes, backslash escapes),
+ * but newlines always end a line (lines without tokens are skipped) and "" is an empty token.
+ * All state lives in the struct, so one thread may parse many nonblocking inputs, one parser each.
+ * Generally, parsers should be zero-initialized.
+ */
+typedef struct tkz_dfa
+{
+    buffer_t toks;  /** null-terminated tokens of the current line */
+    buffer_t offs;  /** offset into toks of each token of the current line */
+    buffer_t argv;  /** token pointers built by @ref tkz_argv */
+    int state;      /** state reached by the last byte fed */
+    int line;       /** current line is complete (cleared by the next feed) */
+} tkz_dfa_t;
+
+/**
+ * @brief feed bytes to parser until a line completes
+ *
+ * Tokens of a completed line stay available until the next feed, which starts a new line.
+ *
+ * @param[inout] dfa parser
+ * @param data bytes to parse
+ * @param sz number of bytes
+ * @param[out] used number of bytes consumed (through the newline ending a line)
+ * @return @ref TKZ_LINE if a line completed, @ref TKZ_MORE if all bytes were consumed, @ref TKZ_ERROR if failed
+ */
+int tkz_feed(tkz_dfa_t *dfa, const void *data, size_t sz, size_t *used);
+
+/**
+ * @brief end input of parser, completing any pending line
+ *
+ * A pending line with an unterminated quote or escape is an error (errno EINVAL), its tokens are discarded
+ * and the parser is left ready for new input.
+ *
+ * @param[inout] dfa parser
+ * @return @ref TKZ_LINE if a pending line completed, @ref TKZ_EOF if no tokens were pending, @ref TKZ_ERROR if failed
+ */
+int tkz_feed_eof(tkz_dfa_t *dfa);
+
+/**
+ * @brief feed bytes from buffered I/O context to parser until a line completes, without waiting
+ *
+ * Parses buffered spans in place (@ref bio_peek), consuming only bytes through the end of a line.
+ * Stops with @ref TKZ_MORE when the context would block, so resume once ready (@ref bio_wait).
+ * EOF of the context is fed with @ref tkz_feed_eof.
+ *
+ * @param[inout] dfa parser
+ * @param[inout] bio buffered I/O context (nonblocking for multiplexing)
+ * @return @ref TKZ_LINE, @ref TKZ_MORE, @ref TKZ_EOF, or @ref TKZ_ERROR
+ */
+int tkz_feed_bio(tkz_dfa_t *dfa, bufferedio_t *bio);
+
+/**
+ * @brief get tokens of the line completed by the parser
+ *
+ * @param[inout] dfa parser
+ * @param[out] argv array of argc null-terminated tokens followed by NULL (owned by parser)
+ * @return number of tokens, 0 if no completed line (or failed allocation)
+ */
+size_t tkz_argv(tkz_dfa_t *dfa, char ***argv);
+
+/**
+ * @brief free memory of parser
+ *
+ * the parser will be cleared and set to all 0
+ *
+ * @param[inout] dfa parser
+ */
+void tkz_dfa_free(tkz_dfa_t *dfa);
+
+/**
+ * @struct tkz_slice
+ * @brief token as bytes in place, either in the input of a buffered I/O context or copied to a buffer
+ * @typedef tkz_slice_t
+ */
+typedef struct tkz_slice
+{
+    const char *data; /** first byte of the token (not null-terminated) */
+    size_t size;      /** number of bytes in the token (0 only at EOF) */
+    int owned;        /** token was copied to the provided buffer, otherwise it points into the input */
+} tkz_slice_t;
+
+/**
+ * @brief parse token from buffered I/O context without copying it when possible
+ *
+ * Same tokens as @ref tkz_parse_str_token.
+ * A token without quotes or escapes that ends within the bytes buffered by the context (@ref bio_peek)
+ * points into them, valid until the context reads again (memory and mapped contexts never move their bytes).
+ * Otherwise the token is rewritten by pushing it to buf (not null-terminated), valid until buf changes.
+ * If error, 0 is returned, token and end are not set, and buffered I/O context status should be checked.
+ *
+ * @param[inout] bio buffered I/O context
+ * @param[inout] buf buffer to push rewritten tokens to (unchanged for tokens in place)
+ * @param[out] tok the parsed token
+ * @param[out] end the whitespace character marking the end of the token (or EOF), may be NULL
+ * @return nonzero if parsed, 0 if failed to parse
+ */
+int tkz_parse_slice(bufferedio_t *bio, buffer_t *buf, tkz_slice_t *tok, char *end);
+
 /**
  * @brief parse token from buffered I/O context
  *
@@ -16,10 +143,13 @@
  * All tokens are stored as null-terminated strings.
  * Empty string is only returned if EOF is reached without finding any non-whitespace characters.
  * If error, NULL is returned, end is not set, and buffered I/O context status should be checked.
+ * Scans spans of buffered bytes in place (@ref bio_peek), finding quotes, backslashes and whitespace 16 bytes at a time
+ * (SSE2 when available), only bytes after the terminating whitespace remain unconsumed.
+ * Contexts without spans (e.g. unbuffered) are read one byte at a time.
  *
  * @param[inout] bio buffered I/O context
  * @param[inout] buf buffer to store (push) token to
- * @param[inout] end the whitespace character marking the end of the token (or EOF)
+ * @param[out] end the whitespace character marking the end of the token (or EOF), may be NULL
  * @return parsed token string (stored in buffer), NULL if failed to parse
  */
 const char *tkz_parse_str_token(bufferedio_t *bio, buffer_t *buf, char *end);
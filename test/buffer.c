@@ -0,0 +1,144 @@
+/**
+ * @file buffer.c
+ * @author Rob Griffith
+ *
+ * Self-checking buffer allocator tests, exits nonzero if any check fails:
+ * reuse and growth of @ref buf_pool blocks, bump allocation, growth and reset of @ref buf_arena_t,
+ * and reads of an empty segmented buffer.
+ */
+
+#include "buffer.h"
+#include "bufferedio.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CHECK(cond)                                                         \
+    do                                                                           \
+    {                                                                            \
+        if (!(cond))                                                             \
+        {                                                                        \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            _test_nfailed++;                                                     \
+        }                                                                        \
+    } while (0)
+
+size_t _test_nfailed = 0;
+
+int _test_filled(const buffer_t *buf, size_t sz, char c)
+{
+    size_t i;
+    for (i = 0; i < sz; i++)
+    {
+        if (((const char *)buf->data)[i] != c)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void _test_pool(void)
+{
+    buffer_t a = {0};
+    buffer_t b = {0};
+    a.alloc = &buf_pool;
+    b.alloc = &buf_pool;
+    /* cache line aligned, growing within a power of 2 class never moves bytes */
+    TEST_CHECK(buf_init(&a, 600) == 600);
+    TEST_CHECK((uintptr_t)a.data % 64 == 0);
+    void *block = a.data;
+    memset(a.data, 'a', 600);
+    a.size = 600;
+    TEST_CHECK(buf_resize(&a, 1000) == 1000 && a.data == block);
+    TEST_CHECK(_test_filled(&a, 600, 'a'));
+    /* growing past the class moves bytes to a larger block */
+    TEST_CHECK(buf_resize(&a, 5000) == 5000 && a.data != block);
+    TEST_CHECK(_test_filled(&a, 600, 'a'));
+    /* freed block of a class is reused by the next buffer of that class */
+    TEST_CHECK(buf_init(&b, 700) == 700 && b.data == block);
+    void *large = a.data;
+    buf_free(&a);
+    a.alloc = &buf_pool;
+    TEST_CHECK(buf_init(&a, 8000) == 8000 && a.data == large);
+    /* page aligned from a page */
+    buf_free(&b);
+    b.alloc = &buf_pool;
+    TEST_CHECK(buf_init(&b, 4096) == 4096 && (uintptr_t)b.data % 4096 == 0);
+    /* capacities beyond the largest class allocated directly */
+    buf_free(&b);
+    b.alloc = &buf_pool;
+    TEST_CHECK(buf_init(&b, (64 << 20) + 1) == (64 << 20) + 1);
+    memset(b.data, 'b', b.capacity);
+    buf_free(&b);
+    buf_free(&a);
+    buf_pool_trim();
+}
+
+void _test_arena_work(buf_arena_t *arena, int first)
+{
+    /* same allocations every round, buffers of earlier rounds only zeroed */
+    buffer_t a = {0};
+    buffer_t b = {0};
+    a.alloc = &arena->alloc;
+    b.alloc = &arena->alloc;
+    /* bump allocated from the block in order */
+    TEST_CHECK(buf_init(&a, 100) == 100 && a.data == arena->block);
+    TEST_CHECK(buf_init(&b, 200) == 200 && (char *)b.data >= (char *)a.data + 100);
+    void *at = b.data;
+    /* most recent allocation grows in place, others move to the end */
+    memset(b.data, 'b', 200);
+    b.size = 200;
+    TEST_CHECK(buf_resize(&b, 400) == 400 && b.data == at && _test_filled(&b, 200, 'b'));
+    memset(a.data, 'a', 100);
+    a.size = 100;
+    TEST_CHECK(buf_resize(&a, 300) == 300 && a.data != arena->block && _test_filled(&a, 100, 'a'));
+    /* freeing the most recent allocation reclaims it */
+    const size_t used = arena->used;
+    buf_free(&a);
+    TEST_CHECK(arena->used < used);
+    /* overflowing the first block retires it, once reset the merged block holds everything */
+    a.alloc = &arena->alloc;
+    TEST_CHECK(buf_init(&a, 3000) == 3000 && arena->blocksz >= 3000);
+    TEST_CHECK(arena->retired.size == (first ? sizeof(void *) : 0));
+    memset(a.data, 'a', 3000);
+    TEST_CHECK(_test_filled(&b, 200, 'b'));
+}
+
+void _test_arena(void)
+{
+    buf_arena_t arena = {0};
+    TEST_CHECK(buf_arena_init(&arena, 1024) == 1024);
+    _test_arena_work(&arena, 1);
+    size_t round;
+    for (round = 0; round < 3; round++)
+    {
+        buf_arena_reset(&arena);
+        TEST_CHECK(arena.used == 0 && arena.spill == 0 && arena.retired.size == 0);
+        _test_arena_work(&arena, 0);
+    }
+    buf_arena_free(&arena);
+    TEST_CHECK(arena.block == NULL && arena.blocksz == 0);
+}
+
+void _test_seg_empty(void)
+{
+    /* wrapped uninitialized, no chunk size to index chunks with */
+    bufferedio_t bio = {0};
+    char c;
+    size_t sz = 1;
+    bio_wrap_seg(&bio, NULL);
+    TEST_CHECK(bio_read(&bio, &c, 1) == 0);
+    TEST_CHECK(bio_peek(&bio, &sz) == NULL && sz == 0);
+    bio_dfree(&bio);
+}
+
+int main(int argc, char **argv)
+{
+    _test_pool();
+    _test_arena();
+    _test_seg_empty();
+    printf("buffer: %zu failed checks\n", _test_nfailed);
+    return _test_nfailed != 0;
+}
\ No newline at end of file
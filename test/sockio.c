@@ -0,0 +1,299 @@
+/**
+ * @file sockio.c
+ * @author Rob Griffith
+ *
+ * Self-checking socket buffered I/O tests over a Unix socket pair and a loopback TCP pair,
+ * exits nonzero if any check fails: batching of small writes, partial sends of a nonblocking socket,
+ * reads flushing pending writes, and zero-copy sends.
+ */
+
+#include "sockio.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_BUFSZ 4096
+#define TEST_BIGSZ (4 << 20)
+#define TEST_SMALLSZ 8192
+
+#define TEST_CHECK(cond)                                                         \
+    do                                                                           \
+    {                                                                            \
+        if (!(cond))                                                             \
+        {                                                                        \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            _test_nfailed++;                                                     \
+        }                                                                        \
+    } while (0)
+
+typedef struct _test_sink
+{
+    int fd;
+    char *data;
+    size_t size;
+} _test_sink_t;
+
+size_t _test_nfailed = 0;
+
+void _test_small(int wfd, int rfd)
+{
+    /* little room between writer and reader, so writes stop short */
+    const int sz = TEST_SMALLSZ;
+    setsockopt(wfd, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+    setsockopt(rfd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+}
+
+int _test_unix_pair(int fds[2], int small)
+{
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        return 0;
+    }
+    if (small)
+    {
+        _test_small(fds[0], fds[1]);
+    }
+    return 1;
+}
+
+int _test_tcp_pair(int fds[2], int small)
+{
+    /* connected over loopback through an ephemeral port, receive buffer sized before the window is negotiated */
+    struct sockaddr_in addr = {0};
+    socklen_t len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    fds[0] = lfd >= 0 ? socket(AF_INET, SOCK_STREAM, 0) : -1;
+    if (small && fds[0] >= 0)
+    {
+        _test_small(fds[0], lfd);
+    }
+    int rv = fds[0] >= 0 && bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(lfd, 1) == 0 &&
+             getsockname(lfd, (struct sockaddr *)&addr, &len) == 0;
+    rv = rv && connect(fds[0], (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    fds[1] = rv ? accept(lfd, NULL, NULL) : -1;
+    if (lfd >= 0)
+    {
+        close(lfd);
+    }
+    return rv && fds[1] >= 0;
+}
+
+void _test_fill(char *data, size_t sz)
+{
+    size_t i;
+    for (i = 0; i < sz; i++)
+    {
+        data[i] = (char)(i * 31 + i / 251);
+    }
+}
+
+size_t _test_recv(int fd, char *data, size_t sz, int timeout)
+{
+    /* up to sz bytes, waiting at most timeout for the first ones, then only taking what is ready */
+    size_t osz = 0;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (osz < sz && poll(&pfd, 1, osz ? 0 : timeout) > 0)
+    {
+        const ssize_t n = recv(fd, data + osz, sz - osz, MSG_DONTWAIT);
+        if (n <= 0)
+        {
+            break;
+        }
+        osz += (size_t)n;
+    }
+    return osz;
+}
+
+void *_test_sink(void *arg)
+{
+    /* everything until the peer shuts down writing */
+    _test_sink_t *sink = arg;
+    ssize_t n;
+    while (sink->size < TEST_BIGSZ && (n = recv(sink->fd, sink->data + sink->size, TEST_BIGSZ - sink->size, 0)) > 0)
+    {
+        sink->size += (size_t)n;
+    }
+    return NULL;
+}
+
+void _test_batch(int fds[2])
+{
+    /* small writes stay in the write buffer until flushed, then go out in one send */
+    bufferedio_t bio = {0};
+    char data[1000];
+    char got[sizeof(data)];
+    _test_fill(data, sizeof(data));
+    sockio_wrap(&bio, fds[0], TEST_BUFSZ, 0);
+    TEST_CHECK(bio_status(&bio) > BIO_STATUS_INIT);
+    size_t i;
+    for (i = 0; i < sizeof(data); i += 100)
+    {
+        TEST_CHECK(bio_write(&bio, data + i, 100) == 100);
+    }
+    TEST_CHECK(bio_stats(&bio)->nsyscall == 0);
+    TEST_CHECK(_test_recv(fds[1], got, sizeof(got), 0) == 0);
+    bio_flush(&bio);
+    TEST_CHECK(bio_stats(&bio)->wbytes == sizeof(data) && bio_stats(&bio)->nflush == 1);
+    TEST_CHECK(_test_recv(fds[1], got, sizeof(got), 1000) == sizeof(got) && memcmp(got, data, sizeof(data)) == 0);
+    /* overflowing write sent together with the batched bytes */
+    char *big = malloc(3 * TEST_BUFSZ);
+    char *bgot = malloc(3 * TEST_BUFSZ + 100);
+    _test_fill(big, 3 * TEST_BUFSZ);
+    TEST_CHECK(bio_write(&bio, data, 100) == 100);
+    const size_t nsys = bio_stats(&bio)->nsyscall;
+    TEST_CHECK(bio_write(&bio, big, 3 * TEST_BUFSZ) == 3 * TEST_BUFSZ);
+    TEST_CHECK(bio_stats(&bio)->nsyscall == nsys + 1);
+    bio_flush(&bio);
+    TEST_CHECK(_test_recv(fds[1], bgot, 3 * TEST_BUFSZ + 100, 1000) == 3 * TEST_BUFSZ + 100);
+    TEST_CHECK(memcmp(bgot, data, 100) == 0 && memcmp(bgot + 100, big, 3 * TEST_BUFSZ) == 0);
+    free(bgot);
+    free(big);
+    bio_dfree(&bio);
+}
+
+void _test_interleave(int fds[2])
+{
+    /* request-response, a read waiting on the peer first sends the pending request */
+    bufferedio_t bio = {0};
+    char req[32], res[32], got[32];
+    sockio_wrap(&bio, fds[0], TEST_BUFSZ, 0);
+    int round;
+    for (round = 0; round < 20; round++)
+    {
+        const int rsz = snprintf(req, sizeof(req), "request %d\n", round);
+        const int ssz = snprintf(res, sizeof(res), "response %d\n", round);
+        TEST_CHECK(bio_write(&bio, req, rsz) == (size_t)rsz);
+        TEST_CHECK(_test_recv(fds[1], got, sizeof(got), 0) == 0);
+        TEST_CHECK(send(fds[1], res, ssz, 0) == ssz);
+        TEST_CHECK(bio_read(&bio, got, ssz) == (size_t)ssz && memcmp(got, res, ssz) == 0);
+        TEST_CHECK(_test_recv(fds[1], got, rsz, 1000) == (size_t)rsz && memcmp(got, req, rsz) == 0);
+    }
+    bio_dfree(&bio);
+}
+
+void _test_partial(int fds[2])
+{
+    /* nonblocking socket with small buffers (see _test_small), writes stop short and resume once the peer reads */
+    bufferedio_t bio = {0};
+    char *data = malloc(TEST_BIGSZ);
+    char *got = malloc(TEST_BIGSZ);
+    _test_fill(data, TEST_BIGSZ);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    sockio_wrap(&bio, fds[0], TEST_BUFSZ, 0);
+    size_t wsz = 0, rsz = 0, nshort = 0, nstall = 0;
+    while (wsz < TEST_BIGSZ)
+    {
+        const size_t step = TEST_BIGSZ - wsz < 3000 ? TEST_BIGSZ - wsz : 3000;
+        const size_t osz = bio_write(&bio, data + wsz, step);
+        wsz += osz;
+        if (osz < step)
+        {
+            nshort++;
+            TEST_CHECK(bio_status(&bio) == BIO_STATUS_WOULDBLOCK);
+            const size_t n = _test_recv(fds[1], got + rsz, TEST_BIGSZ - rsz, 10);
+            rsz += n;
+            /* neither side moving for a second */
+            nstall = osz || n ? 0 : nstall + 1;
+            if (nstall >= 100)
+            {
+                TEST_CHECK(nstall < 100);
+                break;
+            }
+        }
+    }
+    bio_flush(&bio);
+    while (rsz < TEST_BIGSZ && bio_status(&bio) > BIO_STATUS_INIT)
+    {
+        const size_t n = _test_recv(fds[1], got + rsz, TEST_BIGSZ - rsz, 1000);
+        rsz += n;
+        bio_flush(&bio);
+        if (!n)
+        {
+            break;
+        }
+    }
+    TEST_CHECK(nshort > 0 && bio_stats(&bio)->nshort_w > 0);
+    TEST_CHECK(rsz == TEST_BIGSZ && memcmp(got, data, TEST_BIGSZ) == 0);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) & ~O_NONBLOCK);
+    bio_dfree(&bio);
+    free(got);
+    free(data);
+}
+
+void _test_zerocopy(int fds[2], int supported)
+{
+    /* large writes sent without copying, bytes intact whether or not the kernel copied them anyway */
+    bufferedio_t bio = {0};
+    _test_sink_t sink = {fds[1], malloc(TEST_BIGSZ), 0};
+    char *data = malloc(TEST_BIGSZ);
+    _test_fill(data, TEST_BIGSZ);
+    pthread_t thread;
+    TEST_CHECK(pthread_create(&thread, NULL, &_test_sink, &sink) == 0);
+    sockio_wrap(&bio, fds[0], TEST_BUFSZ, SOCKIO_ZEROCOPY);
+    char sstr[256];
+    bio_status_str(&bio, sstr, sizeof(sstr));
+    TEST_CHECK(!supported || strstr(sstr, "zerocopy"));
+    /* batched bytes ahead of each large write are part of its zero-copy send */
+    size_t off;
+    for (off = 0; off < TEST_BIGSZ; off += TEST_BIGSZ / 8)
+    {
+        TEST_CHECK(bio_write(&bio, data + off, 100) == 100);
+        TEST_CHECK(bio_write(&bio, data + off + 100, TEST_BIGSZ / 8 - 100) == TEST_BIGSZ / 8 - 100);
+    }
+    bio_flush(&bio);
+    TEST_CHECK(bio_status(&bio) > BIO_STATUS_INIT);
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(thread, NULL);
+    TEST_CHECK(sink.size == TEST_BIGSZ && memcmp(sink.data, data, TEST_BIGSZ) == 0);
+    bio_dfree(&bio);
+    free(data);
+    free(sink.data);
+}
+
+void _test_pairs(const char *name, int (*pair)(int fds[2], int small), int zerocopy)
+{
+    /* fresh pair for every test, so buffer sizes and shutdowns never carry over */
+    void (*tests[])(int fds[2]) = {&_test_batch, &_test_interleave, &_test_partial};
+    int fds[2];
+    size_t i;
+    for (i = 0; i <= sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        if (!pair(fds, tests[i] == &_test_partial))
+        {
+            fprintf(stderr, "%s: failed to connect socket pair: %s\n", name, strerror(errno));
+            _test_nfailed++;
+            return;
+        }
+        if (i < sizeof(tests) / sizeof(tests[0]))
+        {
+            tests[i](fds);
+        }
+        else
+        {
+            _test_zerocopy(fds, zerocopy);
+        }
+        close(fds[0]);
+        close(fds[1]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    /* zero-copy only supported by TCP, cleared for Unix sockets */
+    _test_pairs("unix", &_test_unix_pair, 0);
+    _test_pairs("tcp", &_test_tcp_pair, 1);
+    printf("sockio: %zu failed checks\n", _test_nfailed);
+    return _test_nfailed != 0;
+}
\ No newline at end of file
@@ -0,0 +1,372 @@
+/**
+ * @file tokenize.c
+ * @author Rob Griffith
+ *
+ * Self-checking tokenizer tests, exits nonzero if any check fails:
+ * vectorized scanning against a byte at a time, token slices against copied tokens,
+ * and the resumable parser fed arbitrary chunks against @ref cli_parse_line (and ended inside quotes or escapes).
+ */
+
+#include "cli.h"
+#include "fdio.h"
+#include "tokenize.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_NLINES 500
+#define TEST_NARGS 3
+
+#define TEST_CHECK(cond)                                                         \
+    do                                                                           \
+    {                                                                            \
+        if (!(cond))                                                             \
+        {                                                                        \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            _test_nfailed++;                                                     \
+        }                                                                        \
+    } while (0)
+
+/* internal scanners of tokenize.c */
+const char *_tkz_find(const char *p, const char *end, int quoted);
+const char *_tkz_skip_space(const char *p, const char *end);
+
+size_t _test_nfailed = 0;
+uint64_t _test_seed = 88172645463325252ULL;
+
+uint64_t _test_rand(void)
+{
+    /* xorshift64, same sequence every run */
+    _test_seed ^= _test_seed << 13;
+    _test_seed ^= _test_seed >> 7;
+    _test_seed ^= _test_seed << 17;
+    return _test_seed;
+}
+
+size_t _test_below(size_t n)
+{
+    return (size_t)(_test_rand() % n);
+}
+
+int _test_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+const char *_test_find(const char *p, const char *end, int quoted)
+{
+    /* byte at a time reference of _tkz_find */
+    while (p < end && *p != '"' && *p != '\\' && (quoted || !_test_space(*p)))
+    {
+        p++;
+    }
+    return p;
+}
+
+const char *_test_skip_space(const char *p, const char *end)
+{
+    /* byte at a time reference of _tkz_skip_space */
+    while (p < end && _test_space(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+void _test_scan(void)
+{
+    /* every class boundary, including bytes whose unsigned difference wraps and high bytes */
+    const char bytes[] = {'a', 'z', ' ', '\t', '\n', '\v', '\f', '\r', '"', '\\', 0x08, 0x0e, 0x1f, 0x21, 0x7f, (char)0x80, (char)0x89, (char)0xff};
+    char data[96];
+    size_t n;
+    for (n = 0; n < 20000; n++)
+    {
+        /* mostly plain bytes, so long runs reach the vector loop */
+        const size_t sz = _test_below(sizeof(data));
+        const size_t off = _test_below(16);
+        size_t i;
+        for (i = 0; i < sizeof(data); i++)
+        {
+            data[i] = _test_below(8) ? 'x' : bytes[_test_below(sizeof(bytes))];
+        }
+        const char *p = data + (off < sz ? off : sz);
+        const char *end = data + sz;
+        TEST_CHECK(_tkz_find(p, end, 0) == _test_find(p, end, 0));
+        TEST_CHECK(_tkz_find(p, end, 1) == _test_find(p, end, 1));
+        for (i = 0; i < sizeof(data); i++)
+        {
+            data[i] = _test_below(8) ? bytes[2 + _test_below(6)] : bytes[_test_below(sizeof(bytes))];
+        }
+        TEST_CHECK(_tkz_skip_space(p, end) == _test_skip_space(p, end));
+    }
+}
+
+void _test_push(buffer_t *buf, const char *s)
+{
+    buf_push(buf, s, strlen(s));
+}
+
+void _test_token(buffer_t *text, buffer_t *val)
+{
+    /* random token (never empty, never starting with '-' or containing '/'), text as input and its value */
+    const char plain[] = "abcdefghijklmnopqrstuvwxyz0123456789_.:=";
+    const char *escs[][2] = {{"\\n", "\n"}, {"\\t", "\t"}, {"\\\\", "\\"}, {"\\\"", "\""}, {"\\ ", " "}, {"\\x", "\\x"}};
+    const size_t nparts = 1 + _test_below(3);
+    size_t i, j;
+    for (i = 0; i < nparts; i++)
+    {
+        const size_t kind = _test_below(3);
+        const size_t len = 1 + _test_below(i ? 8 : 40);
+        if (kind == 1)
+        {
+            /* quoted run with whitespace */
+            buf_push(text, "\"", 1);
+            for (j = 0; j < len; j++)
+            {
+                const char c = _test_below(4) ? plain[_test_below(sizeof(plain) - 1)] : (_test_below(2) ? ' ' : '\t');
+                buf_push(text, &c, 1);
+                buf_push(val, &c, 1);
+            }
+            buf_push(text, "\"", 1);
+        }
+        else if (kind == 2)
+        {
+            const size_t e = _test_below(sizeof(escs) / sizeof(escs[0]));
+            _test_push(text, escs[e][0]);
+            _test_push(val, escs[e][1]);
+        }
+        else
+        {
+            for (j = 0; j < len; j++)
+            {
+                const char c = plain[_test_below(sizeof(plain) - 1)];
+                buf_push(text, &c, 1);
+                buf_push(val, &c, 1);
+            }
+        }
+    }
+    buf_push(val, "", 1);
+}
+
+void _test_lines(buffer_t *text, buffer_t *vals)
+{
+    /* lines of a command and its arguments, values null-terminated in order */
+    size_t i, k;
+    for (i = 0; i < TEST_NLINES; i++)
+    {
+        if (_test_below(4) == 0)
+        {
+            buf_push(text, "  \t", 1 + _test_below(3));
+        }
+        for (k = 0; k < 1 + TEST_NARGS; k++)
+        {
+            if (k)
+            {
+                buf_push(text, " \t ", 1 + _test_below(3));
+            }
+            _test_token(text, vals);
+        }
+        buf_push(text, "\n", 1);
+    }
+}
+
+void _test_wrap_file(bufferedio_t *bio, const buffer_t *text, size_t bufsz)
+{
+    /* bytes of text in a temporary file, read through small buffers so tokens span refills */
+    FILE *f = tmpfile();
+    const int fd = f ? dup(fileno(f)) : -1;
+    if (f)
+    {
+        fwrite(text->data, 1, text->size, f);
+        fflush(f);
+        fclose(f);
+    }
+    lseek(fd, 0, SEEK_SET);
+    fdio_wrap(bio, fd, bufsz, FDIO_CLOSE);
+}
+
+void _test_wrap_mem(bufferedio_t *bio, const buffer_t *text)
+{
+    buffer_t copy = {0};
+    buf_copy(&copy, text->data, text->size);
+    bio_wrap(bio, &copy);
+}
+
+void _test_slices(bufferedio_t *sbio, bufferedio_t *cbio, size_t *ninplace)
+{
+    /* same stream parsed twice, slices must hold the bytes of copied tokens and end the same */
+    buffer_t sbuf = {0};
+    buffer_t cbuf = {0};
+    char send = 0, cend = 0;
+    while (send != EOF && cend != EOF)
+    {
+        tkz_slice_t tok;
+        buf_clear(&sbuf);
+        buf_clear(&cbuf);
+        const int sok = tkz_parse_slice(sbio, &sbuf, &tok, &send);
+        const char *copy = tkz_parse_str_token(cbio, &cbuf, &cend);
+        TEST_CHECK(sok && copy);
+        if (!sok || !copy)
+        {
+            break;
+        }
+        TEST_CHECK(tok.size == strlen(copy) && memcmp(tok.data, copy, tok.size) == 0);
+        TEST_CHECK(send == cend);
+        TEST_CHECK(!tok.owned || tok.data == (const char *)sbuf.data);
+        *ninplace += tok.size && !tok.owned;
+    }
+    TEST_CHECK(send == EOF && cend == EOF);
+    buf_free(&sbuf);
+    buf_free(&cbuf);
+}
+
+void _test_slice(const buffer_t *text)
+{
+    size_t ninplace = 0;
+    bufferedio_t sbio = {0};
+    bufferedio_t cbio = {0};
+    /* memory never moves, plain tokens stay in place */
+    _test_wrap_mem(&sbio, text);
+    _test_wrap_mem(&cbio, text);
+    _test_slices(&sbio, &cbio, &ninplace);
+    TEST_CHECK(ninplace > 0);
+    bio_dfree(&sbio);
+    bio_dfree(&cbio);
+    /* tokens split across refills are copied */
+    const size_t bufszs[] = {1, 7, 64};
+    size_t i;
+    for (i = 0; i < sizeof(bufszs) / sizeof(bufszs[0]); i++)
+    {
+        memset(&sbio, 0, sizeof(sbio));
+        memset(&cbio, 0, sizeof(cbio));
+        _test_wrap_file(&sbio, text, bufszs[i]);
+        _test_wrap_file(&cbio, text, bufszs[i]);
+        _test_slices(&sbio, &cbio, &ninplace);
+        bio_dfree(&sbio);
+        bio_dfree(&cbio);
+    }
+}
+
+size_t _test_cli_lines(const buffer_t *text, buffer_t *toks)
+{
+    /* reference tokens of every line from cli_parse_line, null-terminated in order */
+    cli_arg_t args[TEST_NARGS] = {{"a", "", NULL}, {"b", "", NULL}, {"c", "", NULL}};
+    bufferedio_t bio = {0};
+    buffer_t line = {0};
+    size_t nlines = 0;
+    size_t i;
+    _test_wrap_mem(&bio, text);
+    while (nlines < TEST_NLINES)
+    {
+        cli_t cli = {NULL, TEST_NARGS, args, 0, NULL};
+        buf_clear(&line);
+        const int rv = cli_parse_line(&bio, &line, &cli);
+        TEST_CHECK(rv > 0);
+        if (rv <= 0)
+        {
+            break;
+        }
+        _test_push(toks, cli.cmd);
+        buf_push(toks, "", 1);
+        for (i = 0; i < TEST_NARGS; i++)
+        {
+            _test_push(toks, args[i].val);
+            buf_push(toks, "", 1);
+        }
+        nlines++;
+    }
+    buf_free(&line);
+    bio_dfree(&bio);
+    return nlines;
+}
+
+void _test_feed(const buffer_t *text, const buffer_t *toks, size_t maxchunk)
+{
+    /* whole stream fed in random chunks, every completed line matching the reference in order */
+    tkz_dfa_t dfa = {0};
+    const char *p = text->data;
+    const char *const end = p + text->size;
+    const char *ref = toks->data;
+    const char *const refend = ref + toks->size;
+    size_t nlines = 0;
+    int status = TKZ_MORE;
+    while (status != TKZ_EOF && status != TKZ_ERROR)
+    {
+        size_t used = 0;
+        if (p < end)
+        {
+            const size_t n = 1 + _test_below(maxchunk);
+            status = tkz_feed(&dfa, p, (size_t)(end - p) < n ? (size_t)(end - p) : n, &used);
+            p += used;
+        }
+        else
+        {
+            status = tkz_feed_eof(&dfa);
+        }
+        if (status == TKZ_LINE)
+        {
+            char **argv;
+            const size_t argc = tkz_argv(&dfa, &argv);
+            size_t i;
+            TEST_CHECK(argc == 1 + TEST_NARGS);
+            for (i = 0; i < argc && ref < refend; i++)
+            {
+                TEST_CHECK(strcmp(argv[i], ref) == 0);
+                ref += strlen(ref) + 1;
+            }
+            nlines++;
+        }
+    }
+    TEST_CHECK(status == TKZ_EOF);
+    TEST_CHECK(nlines == TEST_NLINES && ref == refend);
+    tkz_dfa_free(&dfa);
+}
+
+void _test_feed_eof(void)
+{
+    /* unterminated quote or escape at EOF fails, parser then usable again */
+    const char *partial[] = {"cmd \"a b", "cmd a\\", "cmd \"a\\"};
+    tkz_dfa_t dfa = {0};
+    char **argv;
+    size_t i, used;
+    for (i = 0; i < sizeof(partial) / sizeof(partial[0]); i++)
+    {
+        TEST_CHECK(tkz_feed(&dfa, partial[i], strlen(partial[i]), &used) == TKZ_MORE);
+        errno = 0;
+        TEST_CHECK(tkz_feed_eof(&dfa) == TKZ_ERROR && errno == EINVAL);
+        TEST_CHECK(tkz_feed(&dfa, "x y\n", 4, &used) == TKZ_LINE && used == 4);
+        TEST_CHECK(tkz_argv(&dfa, &argv) == 2 && strcmp(argv[0], "x") == 0 && strcmp(argv[1], "y") == 0);
+    }
+    /* unquoted token pending at EOF completes its line */
+    TEST_CHECK(tkz_feed(&dfa, "x y", 3, &used) == TKZ_MORE);
+    TEST_CHECK(tkz_feed_eof(&dfa) == TKZ_LINE && tkz_argv(&dfa, &argv) == 2 && strcmp(argv[1], "y") == 0);
+    TEST_CHECK(tkz_feed_eof(&dfa) == TKZ_EOF);
+    tkz_dfa_free(&dfa);
+}
+
+int main(int argc, char **argv)
+{
+    buffer_t text = {0};
+    buffer_t vals = {0};
+    buffer_t toks = {0};
+    _test_scan();
+    _test_lines(&text, &vals);
+    _test_slice(&text);
+    TEST_CHECK(_test_cli_lines(&text, &toks) == TEST_NLINES);
+    TEST_CHECK(toks.size == vals.size && memcmp(toks.data, vals.data, vals.size) == 0);
+    const size_t maxchunks[] = {1, 3, 17, 64, 4096};
+    size_t i;
+    for (i = 0; i < sizeof(maxchunks) / sizeof(maxchunks[0]); i++)
+    {
+        _test_feed(&text, &toks, maxchunks[i]);
+    }
+    _test_feed_eof();
+    buf_free(&text);
+    buf_free(&vals);
+    buf_free(&toks);
+    printf("tokenize: %zu failed checks\n", _test_nfailed);
+    return _test_nfailed != 0;
+}
\ No newline at end of file
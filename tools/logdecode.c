@@ -0,0 +1,87 @@
+/**
+ * @file logdecode.c
+ * @author Rob Griffith
+ *
+ * Renders binary logs (cypher --logbinary) as text logs.
+ */
+
+#include "cli.h"
+#include "fdio.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define DEF_BUFSZ (1 << 16)
+#define DEF_STRSZ 256
+#define OUTFILE_FLAG (O_WRONLY | O_CREAT | O_TRUNC)
+#define OUTFILE_MODE 0644
+
+int main(int argc, char **argv)
+{
+    int rv = 0;
+    bufferedio_t in = {0};
+    bufferedio_t out = {0};
+    char sstr[DEF_STRSZ];
+    cli_opt_t opts[] = {
+        {'h', "help", "print application usage (to stderr)", NULL, NULL, NULL},
+        {'t', "rawtime", "render raw numeric timestamps (nanoseconds) instead of dates", NULL, NULL, NULL},
+        {'i', "infile", "read binary log from filepath (instead of stdin)", "path", NULL, NULL},
+        {'o', "outfile", "write text log to filepath (instead of stdout)", "path", NULL, NULL}};
+    cli_t cli = {
+        NULL,
+        0,
+        NULL,
+        sizeof(opts) / sizeof(cli_opt_t),
+        opts};
+    if (!cli_parse(argc, argv, &cli))
+    {
+        cli_print_usage(&cli);
+        goto error;
+    }
+    const cli_opt_t *opt = cli_get_opt(&cli, "help");
+    if (opt && opt->val)
+    {
+        cli_print_usage(&cli);
+        goto end;
+    }
+    opt = cli_get_opt(&cli, "rawtime");
+    const int flags = opt && opt->val ? LOG_RAWTIME : 0;
+    opt = cli_get_opt(&cli, "infile");
+    if (opt && opt->val)
+    {
+        fdio_wrap(&in, open(opt->val, O_RDONLY), DEF_BUFSZ, FDIO_CLOSE);
+    }
+    else
+    {
+        fdio_wrap(&in, STDIN_FILENO, DEF_BUFSZ, 0);
+    }
+    opt = cli_get_opt(&cli, "outfile");
+    if (opt && opt->val)
+    {
+        fdio_wrap(&out, open(opt->val, OUTFILE_FLAG, OUTFILE_MODE), DEF_BUFSZ, FDIO_CLOSE);
+    }
+    else
+    {
+        fdio_wrap(&out, STDOUT_FILENO, DEF_BUFSZ, 0);
+    }
+    if (bio_status(&in) <= BIO_STATUS_INIT || bio_status(&out) <= BIO_STATUS_INIT)
+    {
+        fprintf(stderr, "failed to open streams, input: %s\n", bio_status_str(&in, sstr, sizeof(sstr)));
+        fprintf(stderr, "output: %s\n", bio_status_str(&out, sstr, sizeof(sstr)));
+        goto error;
+    }
+    if (log_decode(&in, &out, flags) < 0)
+    {
+        fprintf(stderr, "input is not a binary log or is truncated: %s\n", bio_status_str(&in, sstr, sizeof(sstr)));
+        goto error;
+    }
+    goto end;
+error:
+    rv = 1;
+end:
+    bio_dfree(&out);
+    bio_dfree(&in);
+    return rv;
+}
\ No newline at end of file